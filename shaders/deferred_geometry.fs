@@ -1,6 +1,17 @@
 #version 330 core
+// Variants, see ShaderVariants:
+//   COMPACT_GBUFFER   write the normal octahedron-encoded to two channels, offset by 2 so that
+//                     the cleared 0 still marks where nothing was drawn
+//   BINDLESS          read material maps through the bindless handles in the material table
+#ifdef BINDLESS
+#extension GL_ARB_bindless_texture : require
+#endif
 layout (location = 0) out vec3 gPosition;
+#ifdef COMPACT_GBUFFER
+layout (location = 1) out vec2 gNormal;
+#else
 layout (location = 1) out vec3 gNormal;
+#endif
 layout (location = 2) out vec4 gColorSpec;
 
 in vec3 pos;
@@ -10,9 +21,22 @@ in vec2 texcoords;
 uniform sampler2D texture_diffuse1;
 uniform sampler2D texture_specular1;
 
+#include "uniform_blocks.glsl"
+#include "material.glsl"
+#include "octahedral.glsl"
+
 void main() {
     gPosition = pos;
+#ifdef COMPACT_GBUFFER
+    gNormal = oct_encode(normalize(normal)) + 2.0;
+#else
     gNormal = normalize(normal);
-    gColorSpec.rgb = texture(texture_diffuse1, texcoords).rgb;
-    gColorSpec.a = texture(texture_specular1, texcoords).r;
+#endif
+    if (material_index >= 0) {
+        gColorSpec.rgb = material_diffuse(material_index, texcoords);
+        gColorSpec.a = material_specular(material_index, texcoords).r;
+    } else {
+        gColorSpec.rgb = texture(texture_diffuse1, texcoords).rgb;
+        gColorSpec.a = texture(texture_specular1, texcoords).r;
+    }
 }
\ No newline at end of file
@@ -1,4 +1,8 @@
 #version 330 core
+// Variants, see ShaderVariants:
+//   MAX_LIGHTS n      at most n lights, the loop gets a constant bound
+//   SPECULAR          add specular highlights
+//   COMPACT_GBUFFER   gNormal holds an octahedral normal offset by 2, 0 where nothing was drawn
 out vec4 frag_color;
 
 in vec2 texcoords;
@@ -8,44 +12,59 @@ uniform sampler2D gPosition;
 uniform sampler2D gNormal;
 uniform sampler2D gColorSpec;
 
-struct Light {
-    vec3 position; 
-    vec3 color;
+// lights, see LightBuffers: position in xyz as of the previous and the last simulation step,
+// and color in rgb with the radius in a
+uniform samplerBuffer light_previous_positions;
+uniform samplerBuffer light_positions;
+uniform samplerBuffer light_attributes;
 
-    float linear;
-    float quadratic;
-    float radius;
-};
-
-const int NR_LIGHTS = 100;
-uniform Light lights[NR_LIGHTS];
-uniform vec3 view_pos;
+#include "uniform_blocks.glsl"
+#include "octahedral.glsl"
 
 void main() {
     vec3 frag_pos = texture(gPosition, texcoords).rgb;
-    vec3 normal = texture(gNormal, texcoords).rgb;
     vec3 color = texture(gColorSpec, texcoords).rgb;
     float specular = texture(gColorSpec, texcoords).a;
+#ifdef COMPACT_GBUFFER
+    vec2 encoded = texture(gNormal, texcoords).rg;
+    bool background = encoded.x == 0.0;
+    vec3 normal = oct_decode(encoded - 2.0);
+#else
+    vec3 normal = texture(gNormal, texcoords).rgb;
+    bool background = normal == vec3(0.0);
+#endif
+    // nothing was drawn here, every term would be zero
+    if (background) {
+        frag_color = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
 
     // calculate lighting
     vec3 ambient = color * 0.1;
     vec3 lighting = ambient;
-    vec3 view_dir = normalize(view_pos - frag_pos);
-    for (int i = 0; i < NR_LIGHTS; i++) {
-        float distance = length(lights[i].position - frag_pos);
-        if (distance < lights[i].radius) {
+    vec3 view_dir = normalize(view_pos.xyz - frag_pos);
+#ifdef MAX_LIGHTS
+    for (int i = 0; i < MAX_LIGHTS; i++) {
+        if (i >= num_lights) break;
+#else
+    for (int i = 0; i < num_lights; i++) {
+#endif
+        vec3 light_pos = mix(
+            texelFetch(light_previous_positions, i).xyz, texelFetch(light_positions, i).xyz, light_alpha);
+        vec4 light = texelFetch(light_attributes, i);
+        float distance = length(light_pos - frag_pos);
+        if (distance < light.a) {
             // attenuation
-            float attenuation = 1.0 / (1.0 + lights[i].linear * distance + lights[i].quadratic * distance * distance);
+            float attenuation = 1.0 / (1.0 + light_linear * distance + light_quadratic * distance * distance);
             // diffuse
-            vec3 light_dir = normalize(lights[i].position - frag_pos);
-            vec3 diffuse = max(dot(normal, light_dir), 0.0) * color * lights[i].color;
+            vec3 light_dir = normalize(light_pos - frag_pos);
+            vec3 diffuse = max(dot(normal, light_dir), 0.0) * color * light.rgb;
             lighting += diffuse * attenuation;
-            // specular
-            vec3 view_dir = normalize(view_pos - frag_pos);
+#ifdef SPECULAR
             vec3 reflect_dir = reflect(-light_dir, normal);
-            vec3 spec = pow(max(dot(view_dir, reflect_dir), 0.0), 16) * specular * lights[i].color;
-            if (!(normal.x == 0 && normal.y == 0 && normal.z == 0))
-                lighting += spec * attenuation;
+            vec3 spec = pow(max(dot(view_dir, reflect_dir), 0.0), 16) * specular * light.rgb;
+            lighting += spec * attenuation;
+#endif
         }
     }
     frag_color = vec4(lighting, 1.0);
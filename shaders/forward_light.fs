@@ -2,8 +2,7 @@
 
 in vec3 pos;
 in vec3 normal;
-
-uniform vec3 light_color;
+in vec3 light_color;
 
 out vec4 frag_color;
 
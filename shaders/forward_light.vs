@@ -2,17 +2,23 @@
 
 layout (location = 0) in vec3 in_pos;
 layout (location = 1) in vec3 in_normal;
+// per instance, from LightBuffers
+layout (location = 2) in vec4 light_position;
+layout (location = 3) in vec4 light_attributes;
+layout (location = 4) in vec4 light_previous_position;
 
 // uniforms
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform float size;
+
+#include "uniform_blocks.glsl"
 
 out vec3 pos;
 out vec3 normal;
+out vec3 light_color;
 
 void main() {
-    gl_Position = projection * view * model * vec4(in_pos, 1.0);
-    pos = vec3(model * vec4(in_pos, 1.0));
-    normal = mat3(transpose(inverse(model))) * in_normal;
-}
\ No newline at end of file
+    pos = in_pos * size + mix(light_previous_position.xyz, light_position.xyz, light_alpha);
+    gl_Position = projection * view * vec4(pos, 1.0);
+    normal = in_normal;
+    light_color = light_attributes.rgb;
+}
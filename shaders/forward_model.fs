@@ -1,11 +1,15 @@
 #version 330 core
+// Variants, see ShaderVariants:
+//   SPECULAR   add specular highlights
+//   BINDLESS   read material maps through the bindless handles in the material table
+#ifdef BINDLESS
+#extension GL_ARB_bindless_texture : require
+#endif
 
 in vec3 pos;
 in vec3 normal;
 in vec2 texcoords;
 
-uniform vec3 light_pos;
-uniform vec3 view_pos;
 
 uniform sampler2D texture_diffuse1;
 uniform sampler2D texture_diffuse2;
@@ -13,6 +17,9 @@ uniform sampler2D texture_diffuse3;
 uniform sampler2D texture_specular1;
 uniform sampler2D texture_specular2;
 
+#include "uniform_blocks.glsl"
+#include "material.glsl"
+
 out vec4 frag_color;
 
 void main() {
@@ -21,19 +28,32 @@ void main() {
     vec3 light_ambient = vec3(0.2f, 0.2f, 0.2f);
     vec3 light_specular = vec3(1.0f, 1.0f, 1.0f);
 
+    // material maps
+    vec3 diffuse_map, specular_map;
+    if (material_index >= 0) {
+        diffuse_map = material_diffuse(material_index, texcoords);
+        specular_map = material_specular(material_index, texcoords);
+    } else {
+        diffuse_map = vec3(texture(texture_diffuse1, texcoords));
+        specular_map = vec3(texture(texture_specular1, texcoords));
+    }
+
     // diffuse color
     vec3 norm = normalize(normal);
-    vec3 light_dir = normalize(light_pos - pos);
+    // the light sits at the camera
+    vec3 light_dir = normalize(view_pos.xyz - pos);
     float diff = max(dot(norm, light_dir), 0.0);
-    vec3 diffuse = light_diffuse * diff * vec3(texture(texture_diffuse1, texcoords));
-    vec3 ambient = light_ambient * vec3(texture(texture_diffuse1, texcoords));
+    vec3 diffuse = light_diffuse * diff * diffuse_map;
+    vec3 ambient = light_ambient * diffuse_map;
 
+    vec3 result = ambient + diffuse;
+#ifdef SPECULAR
     // Specular color
-    vec3 view_dir = normalize(view_pos - pos);
+    vec3 view_dir = normalize(view_pos.xyz - pos);
     vec3 reflect_dir = reflect(-light_dir, norm);
     float spec = pow(max(dot(view_dir, reflect_dir), 0.0), 32);
-    vec3 specular = light_specular * spec * vec3(texture(texture_specular1, texcoords));
-    vec3 result = ambient + diffuse + specular;
+    result += light_specular * spec * specular_map;
+#endif
     frag_color = vec4(result, 1.0f);
     // frag_color = vec4(1.0, 1.0, 1.0, 1.0);
 }
\ No newline at end of file
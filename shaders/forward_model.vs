@@ -3,19 +3,25 @@
 layout (location = 0) in vec3 in_pos;
 layout (location = 1) in vec3 in_normal;
 layout (location = 2) in vec2 in_texcoords;
+// octahedral normal of compact vertices, replaces in_normal
+layout (location = 3) in vec2 in_normal_oct;
+// per-instance model matrix, takes locations 4-7
+layout (location = 4) in mat4 instance_model;
 
-// uniforms
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include "uniform_blocks.glsl"
 
 out vec3 pos;
 out vec3 normal;
 out vec2 texcoords;
 
+#include "octahedral.glsl"
+
 void main() {
-    gl_Position = projection * view * model * vec4(in_pos, 1.0);
-    pos = vec3(model * vec4(in_pos, 1.0));
-    normal = mat3(transpose(inverse(model))) * in_normal;
+    vec3 local_pos = pos_offset.xyz + in_pos * pos_scale.xyz;
+    vec3 local_normal = oct_normals != 0 ? oct_decode(in_normal_oct) : in_normal;
+    mat4 world = instanced != 0 ? instance_model * model : model;
+    gl_Position = projection * view * world * vec4(local_pos, 1.0);
+    pos = vec3(world * vec4(local_pos, 1.0));
+    normal = mat3(transpose(inverse(world))) * local_normal;
     texcoords = in_texcoords;
 }
\ No newline at end of file
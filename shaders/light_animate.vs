@@ -0,0 +1,21 @@
+#version 330 core
+
+// one point per light, see LightBuffers
+layout (location = 0) in vec4 in_state;   // position, direction of motion in w
+layout (location = 1) in vec4 in_params;  // speed, min_y, max_y
+
+uniform float dt;
+
+// captured by transform feedback
+out vec4 out_state;
+
+void main() {
+    // same bounce as bounce_lights on the CPU
+    float y = in_state.y + in_state.w * in_params.x * dt;
+    float dir = in_state.w;
+    if (y > in_params.z)
+        dir = -1.0;
+    else if (y < in_params.y)
+        dir = 1.0;
+    out_state = vec4(in_state.x, clamp(y, in_params.y, in_params.z), in_state.z, dir);
+}
@@ -0,0 +1,32 @@
+// Material maps from texture arrays, see TextureArrays. The table holds two texels per
+// material: the layers of its diffuse and specular maps, then with BINDLESS the handles of the
+// arrays they are in, split into 32-bit halves. BINDLESS needs GL_ARB_bindless_texture enabled.
+
+#define NO_LAYER 0xFFFFFFFFu
+
+uniform usamplerBuffer materials;
+#ifndef BINDLESS
+uniform sampler2DArray diffuse_array;
+uniform sampler2DArray specular_array;
+#endif
+
+vec3 material_diffuse(int m, vec2 uv) {
+    uvec4 layers = texelFetch(materials, 2 * m);
+#ifdef BINDLESS
+    uvec4 handles = texelFetch(materials, 2 * m + 1);
+    return texture(sampler2DArray(handles.xy), vec3(uv, float(layers.x))).rgb;
+#else
+    return texture(diffuse_array, vec3(uv, float(layers.x))).rgb;
+#endif
+}
+
+vec3 material_specular(int m, vec2 uv) {
+    uvec4 layers = texelFetch(materials, 2 * m);
+    if (layers.y == NO_LAYER) return vec3(0.0);
+#ifdef BINDLESS
+    uvec4 handles = texelFetch(materials, 2 * m + 1);
+    return texture(sampler2DArray(handles.zw), vec3(uv, float(layers.y))).rgb;
+#else
+    return texture(specular_array, vec3(uv, float(layers.y))).rgb;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+// Uniform blocks filled from UniformRing, see uniform_ring.h for the matching structs
+
+// camera of the frame
+layout (std140) uniform FrameBlock {
+    mat4 projection;
+    mat4 view;
+    vec4 view_pos;
+};
+
+// per draw of a mesh
+layout (std140) uniform ObjectBlock {
+    // relative to instance_model when instanced
+    mat4 model;
+    // dequantization of compact vertices, identity for full vertices
+    vec4 pos_offset;
+    vec4 pos_scale;
+    int oct_normals;
+    int instanced;
+    // index into the material table, -1 for the maps bound by the mesh
+    int material_index;
+};
+
+// lights of the frame, see LightBuffers
+layout (std140) uniform LightingBlock {
+    int num_lights;
+    float light_linear;
+    float light_quadratic;
+    // interpolation between the two simulation steps
+    float light_alpha;
+};
\ No newline at end of file
@@ -0,0 +1,215 @@
+#include "bc_encoder.h"
+
+#include "job_system.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// A 4x4 block of texels split into channels. Keeping the channels in separate arrays
+// lets the compiler vectorize the per-texel loops below.
+struct Block {
+  float r[16], g[16], b[16], a[16];
+};
+
+static void
+  fetch_block(const unsigned char* rgba, int width, int height, int bx, int by, Block& block) {
+  for (int y = 0; y < 4; y++) {
+    int sy = std::min(by * 4 + y, height - 1);
+    for (int x = 0; x < 4; x++) {
+      int sx = std::min(bx * 4 + x, width - 1);
+      const unsigned char* texel = rgba + ((size_t)sy * width + sx) * 4;
+      block.r[y * 4 + x] = texel[0];
+      block.g[y * 4 + x] = texel[1];
+      block.b[y * 4 + x] = texel[2];
+      block.a[y * 4 + x] = texel[3];
+    }
+  }
+}
+
+static uint16_t pack_565(float r, float g, float b) {
+  int r5 = std::min(std::max((int)(r * 31.0f / 255.0f + 0.5f), 0), 31);
+  int g6 = std::min(std::max((int)(g * 63.0f / 255.0f + 0.5f), 0), 63);
+  int b5 = std::min(std::max((int)(b * 31.0f / 255.0f + 0.5f), 0), 31);
+  return (uint16_t)((r5 << 11) | (g6 << 5) | b5);
+}
+
+static void unpack_565(uint16_t c, float* rgb) {
+  int r5 = (c >> 11) & 31, g6 = (c >> 5) & 63, b5 = c & 31;
+  rgb[0] = (float)((r5 << 3) | (r5 >> 2));
+  rgb[1] = (float)((g6 << 2) | (g6 >> 4));
+  rgb[2] = (float)((b5 << 3) | (b5 >> 2));
+}
+
+// Color block: endpoints from the extent of the texels along their principal axis,
+// always in four color mode so it can be reused for BC3.
+static void encode_color_block(const Block& block, unsigned char* out) {
+  float mean[3] = { 0, 0, 0 };
+  for (int i = 0; i < 16; i++) {
+    mean[0] += block.r[i];
+    mean[1] += block.g[i];
+    mean[2] += block.b[i];
+  }
+  for (int c = 0; c < 3; c++) mean[c] /= 16.0f;
+
+  // covariance, then a few power iterations for the principal axis
+  float cov[6] = { 0, 0, 0, 0, 0, 0 };
+  for (int i = 0; i < 16; i++) {
+    float r = block.r[i] - mean[0], g = block.g[i] - mean[1], b = block.b[i] - mean[2];
+    cov[0] += r * r;
+    cov[1] += r * g;
+    cov[2] += r * b;
+    cov[3] += g * g;
+    cov[4] += g * b;
+    cov[5] += b * b;
+  }
+  float axis[3] = { 1, 1, 1 };
+  for (int iter = 0; iter < 4; iter++) {
+    float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+    float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+    float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+    float len = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+    if (len == 0.0f) break;
+    axis[0] = x / len;
+    axis[1] = y / len;
+    axis[2] = z / len;
+  }
+
+  float min_proj = 1e30f, max_proj = -1e30f;
+  int min_i = 0, max_i = 0;
+  for (int i = 0; i < 16; i++) {
+    float p = block.r[i] * axis[0] + block.g[i] * axis[1] + block.b[i] * axis[2];
+    if (p < min_proj) {
+      min_proj = p;
+      min_i = i;
+    }
+    if (p > max_proj) {
+      max_proj = p;
+      max_i = i;
+    }
+  }
+
+  // inset the endpoints slightly, the extremes are rarely worth a full palette entry
+  float lo[3] = { block.r[min_i], block.g[min_i], block.b[min_i] };
+  float hi[3] = { block.r[max_i], block.g[max_i], block.b[max_i] };
+  for (int c = 0; c < 3; c++) {
+    float inset = (hi[c] - lo[c]) / 32.0f;
+    lo[c] += inset;
+    hi[c] -= inset;
+  }
+  uint16_t c0 = pack_565(hi[0], hi[1], hi[2]);
+  uint16_t c1 = pack_565(lo[0], lo[1], lo[2]);
+  // four color mode needs c0 > c1
+  if (c0 < c1) std::swap(c0, c1);
+
+  uint32_t indices = 0;
+  if (c0 != c1) {
+    float palette[4][3];
+    unpack_565(c0, palette[0]);
+    unpack_565(c1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+      palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+    float best[16];
+    uint32_t best_index[16];
+    for (int i = 0; i < 16; i++) {
+      best[i] = 1e30f;
+      best_index[i] = 0;
+    }
+    for (uint32_t p = 0; p < 4; p++) {
+      for (int i = 0; i < 16; i++) {
+        float dr = block.r[i] - palette[p][0];
+        float dg = block.g[i] - palette[p][1];
+        float db = block.b[i] - palette[p][2];
+        float d = dr * dr + dg * dg + db * db;
+        bool closer = d < best[i];
+        best[i] = closer ? d : best[i];
+        best_index[i] = closer ? p : best_index[i];
+      }
+    }
+    for (int i = 0; i < 16; i++) indices |= best_index[i] << (2 * i);
+  }
+
+  out[0] = c0 & 0xff;
+  out[1] = c0 >> 8;
+  out[2] = c1 & 0xff;
+  out[3] = c1 >> 8;
+  for (int i = 0; i < 4; i++) out[4 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+// Single channel block (BC4, BC3 alpha, BC5 halves) in eight value mode:
+// the endpoints are the channel extremes and the six values in between are implied.
+static void encode_channel_block(const float* values, unsigned char* out) {
+  float lo = values[0], hi = values[0];
+  for (int i = 1; i < 16; i++) {
+    lo = std::min(lo, values[i]);
+    hi = std::max(hi, values[i]);
+  }
+  unsigned char a0 = (unsigned char)hi;
+  unsigned char a1 = (unsigned char)lo;
+
+  uint64_t indices = 0;
+  if (a0 > a1) {
+    float scale = 7.0f / (a0 - a1);
+    for (int i = 0; i < 16; i++) {
+      // position on the ramp from a1 (0) to a0 (7)
+      int ramp = (int)((values[i] - a1) * scale + 0.5f);
+      ramp = std::min(std::max(ramp, 0), 7);
+      uint64_t index = ramp == 7 ? 0 : ramp == 0 ? 1 : 8 - ramp;
+      indices |= index << (3 * i);
+    }
+  }
+
+  out[0] = a0;
+  out[1] = a1;
+  for (int i = 0; i < 6; i++) out[2 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+size_t bc_encoded_size(int width, int height, int block_bytes) {
+  return (size_t)((width + 3) / 4) * ((height + 3) / 4) * block_bytes;
+}
+
+// run encode(block, out) over every block of the image, at least one block row per job
+template<typename F>
+static void encode_blocks(
+  const unsigned char* rgba, int width, int height, int block_bytes, unsigned char* out, F encode) {
+  int blocks_x = (width + 3) / 4;
+  int blocks_y = (height + 3) / 4;
+  parallel_for(0, blocks_y, 1, [&](size_t first, size_t last) {
+    Block block;
+    for (int by = first; by < (int)last; by++) {
+      for (int bx = 0; bx < blocks_x; bx++) {
+        fetch_block(rgba, width, height, bx, by, block);
+        encode(block, out + ((size_t)by * blocks_x + bx) * block_bytes);
+      }
+    }
+  });
+}
+
+void encode_bc1(const unsigned char* rgba, int width, int height, unsigned char* out) {
+  encode_blocks(rgba, width, height, 8, out, [](const Block& block, unsigned char* dst) {
+    encode_color_block(block, dst);
+  });
+}
+
+void encode_bc3(const unsigned char* rgba, int width, int height, unsigned char* out) {
+  encode_blocks(rgba, width, height, 16, out, [](const Block& block, unsigned char* dst) {
+    encode_channel_block(block.a, dst);
+    encode_color_block(block, dst + 8);
+  });
+}
+
+void encode_bc4(const unsigned char* rgba, int width, int height, unsigned char* out) {
+  encode_blocks(rgba, width, height, 8, out, [](const Block& block, unsigned char* dst) {
+    encode_channel_block(block.r, dst);
+  });
+}
+
+void encode_bc5(const unsigned char* rgba, int width, int height, unsigned char* out) {
+  encode_blocks(rgba, width, height, 16, out, [](const Block& block, unsigned char* dst) {
+    encode_channel_block(block.r, dst);
+    encode_channel_block(block.g, dst + 8);
+  });
+}
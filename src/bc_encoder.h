@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+// CPU block compression encoders used by the texture cook step. All of them take
+// tightly packed RGBA8 texels and write 4x4 blocks in row-major block order; edges of
+// images that are not a multiple of four are padded by clamping.
+
+// bytes needed for a width x height image with blocks of block_bytes
+size_t bc_encoded_size(int width, int height, int block_bytes);
+// BC1 (DXT1), 8 bytes per block, opaque RGB
+void encode_bc1(const unsigned char* rgba, int width, int height, unsigned char* out);
+// BC3 (DXT5), 16 bytes per block, RGB plus interpolated alpha
+void encode_bc3(const unsigned char* rgba, int width, int height, unsigned char* out);
+// BC4 (RGTC1), 8 bytes per block, the red channel only
+void encode_bc4(const unsigned char* rgba, int width, int height, unsigned char* out);
+// BC5 (RGTC2), 16 bytes per block, red and green channels
+void encode_bc5(const unsigned char* rgba, int width, int height, unsigned char* out);
@@ -0,0 +1,166 @@
+#include "command_buffer.h"
+
+#include "gl_state.h"
+#include "mesh.h"
+#include "uniform_ring.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstring>
+
+struct BindVertexArrayCommand {
+  CommandHeader header;
+  uint32_t vao;
+};
+
+struct BindTextureCommand {
+  CommandHeader header;
+  uint32_t unit;
+  uint32_t target;
+  uint32_t texture;
+};
+
+// followed by size bytes of constants
+struct PushConstantsCommand {
+  CommandHeader header;
+  uint32_t binding;
+  uint32_t size;
+};
+
+struct BindMeshTexturesCommand {
+  CommandHeader header;
+  const Mesh* mesh;
+};
+
+struct DrawElementsCommand {
+  CommandHeader header;
+  uint32_t count;
+  uint32_t index_type;
+  const void* offset;
+};
+
+// followed by num_draws offsets, then num_draws counts
+struct MultiDrawElementsCommand {
+  CommandHeader header;
+  uint32_t index_type;
+  uint32_t num_draws;
+};
+
+// bytes rounded up to whole words
+static size_t word_count(size_t size) {
+  return (size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+}
+
+void CommandBuffer::reset() {
+  used = 0;
+  num_commands = 0;
+}
+
+void* CommandBuffer::allocate(CommandType type, size_t size) {
+  size_t count = word_count(size);
+  if (used + count > words.size()) words.resize(std::max(words.size() * 2, used + count));
+  CommandHeader* header = (CommandHeader*)(words.data() + used);
+  header->type = type;
+  header->size = count * sizeof(uint64_t);
+  used += count;
+  num_commands++;
+  return header;
+}
+
+void CommandBuffer::bind_vertex_array(unsigned int vao) {
+  BindVertexArrayCommand* command = (BindVertexArrayCommand*)allocate(
+    COMMAND_BIND_VERTEX_ARRAY, sizeof(BindVertexArrayCommand));
+  command->vao = vao;
+}
+
+void CommandBuffer::bind_texture(unsigned int unit, unsigned int target, unsigned int texture) {
+  BindTextureCommand* command =
+    (BindTextureCommand*)allocate(COMMAND_BIND_TEXTURE, sizeof(BindTextureCommand));
+  command->unit = unit;
+  command->target = target;
+  command->texture = texture;
+}
+
+void CommandBuffer::push_constants(unsigned int binding, const void* data, size_t size) {
+  PushConstantsCommand* command = (PushConstantsCommand*)allocate(
+    COMMAND_PUSH_CONSTANTS, sizeof(PushConstantsCommand) + size);
+  command->binding = binding;
+  command->size = size;
+  memcpy(command + 1, data, size);
+}
+
+void CommandBuffer::bind_mesh_textures(const Mesh* mesh) {
+  BindMeshTexturesCommand* command = (BindMeshTexturesCommand*)allocate(
+    COMMAND_BIND_MESH_TEXTURES, sizeof(BindMeshTexturesCommand));
+  command->mesh = mesh;
+}
+
+void CommandBuffer::draw_elements(unsigned int count, unsigned int index_type, const void* offset) {
+  DrawElementsCommand* command =
+    (DrawElementsCommand*)allocate(COMMAND_DRAW_ELEMENTS, sizeof(DrawElementsCommand));
+  command->count = count;
+  command->index_type = index_type;
+  command->offset = offset;
+}
+
+void CommandBuffer::multi_draw_elements(
+  unsigned int index_type,
+  const int* counts,
+  const void* const* offsets,
+  unsigned int num_draws) {
+  // the offsets come first, they need the 8-byte alignment
+  size_t size =
+    sizeof(MultiDrawElementsCommand) + num_draws * (sizeof(const void*) + sizeof(GLsizei));
+  MultiDrawElementsCommand* command =
+    (MultiDrawElementsCommand*)allocate(COMMAND_MULTI_DRAW_ELEMENTS, size);
+  command->index_type = index_type;
+  command->num_draws = num_draws;
+  const void** command_offsets = (const void**)(command + 1);
+  memcpy(command_offsets, offsets, num_draws * sizeof(const void*));
+  memcpy(command_offsets + num_draws, counts, num_draws * sizeof(GLsizei));
+}
+
+void CommandBuffer::execute(Shader& shader) const {
+  const uint64_t* word = words.data();
+  const uint64_t* end = word + used;
+  while (word < end) {
+    const CommandHeader* header = (const CommandHeader*)word;
+    switch (header->type) {
+    case COMMAND_BIND_VERTEX_ARRAY: {
+      const BindVertexArrayCommand* command = (const BindVertexArrayCommand*)header;
+      gl_bind_vertex_array(command->vao);
+      break;
+    }
+    case COMMAND_BIND_TEXTURE: {
+      const BindTextureCommand* command = (const BindTextureCommand*)header;
+      gl_bind_texture(command->unit, command->target, command->texture);
+      break;
+    }
+    case COMMAND_PUSH_CONSTANTS: {
+      const PushConstantsCommand* command = (const PushConstantsCommand*)header;
+      uniform_ring_push(command->binding, command + 1, command->size);
+      break;
+    }
+    case COMMAND_BIND_MESH_TEXTURES: {
+      const BindMeshTexturesCommand* command = (const BindMeshTexturesCommand*)header;
+      command->mesh->bindMeshTextures(shader);
+      break;
+    }
+    case COMMAND_DRAW_ELEMENTS: {
+      const DrawElementsCommand* command = (const DrawElementsCommand*)header;
+      glDrawElements(GL_TRIANGLES, command->count, command->index_type, command->offset);
+      break;
+    }
+    case COMMAND_MULTI_DRAW_ELEMENTS: {
+      const MultiDrawElementsCommand* command = (const MultiDrawElementsCommand*)header;
+      const void* const* offsets = (const void* const*)(command + 1);
+      const GLsizei* counts = (const GLsizei*)(offsets + command->num_draws);
+      glMultiDrawElements(
+        GL_TRIANGLES, counts, command->index_type, offsets, command->num_draws);
+      break;
+    }
+    }
+    word += header->size / sizeof(uint64_t);
+  }
+}
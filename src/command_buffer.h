@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Mesh;
+class Shader;
+
+// Draw commands recorded without a GL context and replayed on the thread owning it. Commands
+// are small PODs laid out one after the other in a buffer that only grows: reset() rewinds it
+// and keeps the memory, so after the first frames recording allocates nothing. Every recording
+// thread fills buffers of its own, the GL thread executes them in order.
+enum CommandType : uint32_t {
+  COMMAND_BIND_VERTEX_ARRAY,
+  COMMAND_BIND_TEXTURE,
+  COMMAND_PUSH_CONSTANTS,
+  COMMAND_BIND_MESH_TEXTURES,
+  COMMAND_DRAW_ELEMENTS,
+  COMMAND_MULTI_DRAW_ELEMENTS,
+};
+
+// starts every command. size counts the header and the payload, a multiple of 8 bytes.
+struct CommandHeader {
+  CommandType type;
+  uint32_t size;
+};
+
+class CommandBuffer {
+public:
+  // forget the recorded commands, keeping the memory
+  void reset();
+  void bind_vertex_array(unsigned int vao);
+  void bind_texture(unsigned int unit, unsigned int target, unsigned int texture);
+  // size bytes of data to a uniform block binding point, copied into the buffer now and into
+  // the uniform ring on execution
+  void push_constants(unsigned int binding, const void* data, size_t size);
+  template <typename T> void push_constants(unsigned int binding, const T& constants) {
+    push_constants(binding, &constants, sizeof(T));
+  }
+  // the per-mesh textures of a mesh not drawing from texture arrays, their sampler uniforms
+  // belong to the shader passed to execute
+  void bind_mesh_textures(const Mesh* mesh);
+  // triangles of the bound vertex array
+  void draw_elements(unsigned int count, unsigned int index_type, const void* offset);
+  void multi_draw_elements(
+    unsigned int index_type,
+    const int* counts,
+    const void* const* offsets,
+    unsigned int num_draws);
+  // issue the commands on the GL thread with shader bound
+  void execute(Shader& shader) const;
+  unsigned int command_count() const {
+    return num_commands;
+  }
+  size_t byte_size() const {
+    return used * sizeof(uint64_t);
+  }
+
+private:
+  // 8-byte words, so that every command starts aligned
+  std::vector<uint64_t> words;
+  // words in use
+  size_t used = 0;
+  unsigned int num_commands = 0;
+  // room for a command of size bytes, header included, at the end of the buffer
+  void* allocate(CommandType type, size_t size);
+};
@@ -0,0 +1,55 @@
+#include "entity.h"
+
+Entity EntityPool::create() {
+  Entity entity;
+  if (!free_slots.empty()) {
+    entity.index = free_slots.back();
+    free_slots.pop_back();
+  } else {
+    entity.index = generations.size();
+    generations.push_back(0);
+  }
+  entity.generation = ++generations[entity.index];
+  return entity;
+}
+
+void EntityPool::destroy(Entity entity) {
+  if (!alive(entity)) return;
+  generations[entity.index]++;
+  free_slots.push_back(entity.index);
+}
+
+bool EntityPool::alive(Entity entity) const {
+  return entity.index < generations.size() && generations[entity.index] == entity.generation &&
+         (entity.generation & 1) == 1;
+}
+
+int ComponentIndex::row(Entity entity) const {
+  if (entity.index >= rows.size() || rows[entity.index] < 0) return -1;
+  int r = rows[entity.index];
+  return entities[r] == entity ? r : -1;
+}
+
+unsigned int ComponentIndex::add(Entity entity) {
+  if (entity.index >= rows.size()) rows.resize(entity.index + 1, -1);
+  rows[entity.index] = entities.size();
+  entities.push_back(entity);
+  return entities.size() - 1;
+}
+
+int ComponentIndex::remove(Entity entity) {
+  int r = row(entity);
+  if (r < 0) return -1;
+  Entity last = entities.back();
+  entities[r] = last;
+  rows[last.index] = r;
+  entities.pop_back();
+  rows[entity.index] = -1;
+  // also right when entity held the last row, the assignment above is undone here
+  return r;
+}
+
+void ComponentIndex::clear() {
+  rows.clear();
+  entities.clear();
+}
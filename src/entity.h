@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Stable entity handle. The generation tells a live entity from an older one that used the
+// same slot, so handles to destroyed entities are detected instead of aliasing new ones.
+struct Entity {
+  uint32_t index;
+  uint32_t generation;
+  bool operator==(const Entity& other) const {
+    return index == other.index && generation == other.generation;
+  }
+  bool operator!=(const Entity& other) const {
+    return !(*this == other);
+  }
+};
+
+// handle that never refers to a live entity
+const Entity NULL_ENTITY = { UINT32_MAX, 0 };
+
+// Allocates entity handles, recycling slots of destroyed entities
+class EntityPool {
+public:
+  Entity create();
+  // no-op for handles that are not alive
+  void destroy(Entity entity);
+  bool alive(Entity entity) const;
+  // number of live entities
+  size_t size() const {
+    return generations.size() - free_slots.size();
+  }
+
+private:
+  // current generation of every slot, odd while the slot is alive
+  std::vector<uint32_t> generations;
+  std::vector<uint32_t> free_slots;
+};
+
+// Maps entities to the dense rows of one component type. Component data lives in parallel
+// arrays indexed by row, so systems walk them front to back without gaps. Removing an
+// entity moves the last row into its place; component types mirror that with swap_remove.
+class ComponentIndex {
+public:
+  // row of entity, -1 if it has no such component
+  int row(Entity entity) const;
+  // append a row for entity, which must not have one yet
+  unsigned int add(Entity entity);
+  // drop the row of entity and return it, -1 if there was none. The last row now lives there.
+  int remove(Entity entity);
+  Entity entity(unsigned int row) const {
+    return entities[row];
+  }
+  size_t size() const {
+    return entities.size();
+  }
+  void clear();
+
+private:
+  // row by entity slot, -1 for none
+  std::vector<int> rows;
+  // entity by row
+  std::vector<Entity> entities;
+};
+
+// move the last element into row and shrink, matching ComponentIndex::remove
+template <typename T>
+void swap_remove(std::vector<T>& values, unsigned int row) {
+  values[row] = values.back();
+  values.pop_back();
+}
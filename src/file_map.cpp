@@ -0,0 +1,101 @@
+#include "file_map.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& path) {
+#ifdef _WIN32
+  // no mmap, fall back to reading the file into memory
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) return;
+  fseek(file, 0, SEEK_END);
+  long file_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (file_size > 0) {
+    bytes = (unsigned char*)malloc(file_size);
+    if (bytes && fread(bytes, 1, file_size, file) == (size_t)file_size) {
+      length = file_size;
+    } else {
+      free(bytes);
+      bytes = nullptr;
+    }
+  }
+  fclose(file);
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr != MAP_FAILED) {
+      bytes = (unsigned char*)ptr;
+      length = st.st_size;
+    }
+  }
+  // the mapping stays valid after the descriptor is closed
+  close(fd);
+#endif
+}
+
+MappedFile::~MappedFile() {
+  if (!bytes) return;
+#ifdef _WIN32
+  free(bytes);
+#else
+  munmap(bytes, length);
+#endif
+}
+
+bool MappedFile::is_open() const {
+  return bytes != nullptr;
+}
+
+const unsigned char* MappedFile::data() const {
+  return bytes;
+}
+
+size_t MappedFile::size() const {
+  return length;
+}
+
+bool file_stat(const std::string& path, uint64_t* mtime, uint64_t* size) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return false;
+  if (mtime) *mtime = (uint64_t)st.st_mtime;
+  if (size) *size = (uint64_t)st.st_size;
+  return true;
+}
+
+bool write_file_atomically(const std::string& path, const std::vector<FileChunk>& chunks) {
+  std::string tmp_path = path + ".tmp";
+  FILE* file = fopen(tmp_path.c_str(), "wb");
+  if (!file) return false;
+  static const char padding[16] = { 0 };
+  uint64_t pos = 0;
+  bool ok = true;
+  for (const FileChunk& chunk : chunks) {
+    if (chunk.offset != 0 && chunk.offset < pos) ok = false;
+    while (ok && chunk.offset > pos) {
+      uint64_t pad = chunk.offset - pos < sizeof(padding) ? chunk.offset - pos : sizeof(padding);
+      ok = fwrite(padding, 1, pad, file) == pad;
+      pos += pad;
+    }
+    ok = ok && (chunk.size == 0 || fwrite(chunk.data, 1, chunk.size, file) == chunk.size);
+    pos += chunk.size;
+    if (!ok) break;
+  }
+  ok = (fclose(file) == 0) && ok;
+  if (!ok) {
+    remove(tmp_path.c_str());
+    return false;
+  }
+  remove(path.c_str());
+  return rename(tmp_path.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file, memory mapped where the platform allows it
+class MappedFile {
+public:
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+
+  // whether the file was opened and mapped successfully
+  bool is_open() const;
+  const unsigned char* data() const;
+  size_t size() const;
+
+private:
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  unsigned char* bytes = nullptr;
+  size_t length = 0;
+};
+
+// Modification time and size of a file, used to invalidate cooked caches.
+// Returns false if the file does not exist.
+bool file_stat(const std::string& path, uint64_t* mtime, uint64_t* size);
+
+// Bytes to write at offset of a file. Offset 0 puts them right after the previous chunk,
+// gaps before an offset are filled with zeros.
+struct FileChunk {
+  const void* data;
+  uint64_t size;
+  uint64_t offset;
+};
+
+// Write chunks, in order, to a temporary file next to path and rename it over path once it is
+// complete, so an interrupted write never leaves a valid-looking file behind.
+// Returns false if anything failed, path is then left as it was or removed.
+bool write_file_atomically(const std::string& path, const std::vector<FileChunk>& chunks);
@@ -0,0 +1,77 @@
+#include "file_watcher.h"
+
+#include "file_map.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// directory part of a path with its trailing separator, "" for a bare file name
+static std::string directory_of(const std::string& path) {
+  size_t slash = path.find_last_of("/\\");
+  return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+FileWatcher::FileWatcher() {
+#ifdef __linux__
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+FileWatcher::~FileWatcher() {
+#ifdef __linux__
+  if (fd >= 0) close(fd);
+#endif
+}
+
+bool FileWatcher::add(const std::string& path) {
+  uint64_t mtime, size;
+  if (!file_stat(path, &mtime, &size)) return false;
+  files[path] = mtime;
+#ifdef __linux__
+  if (fd >= 0) {
+    std::string directory = directory_of(path);
+    // watching a directory twice returns the same descriptor
+    int wd = inotify_add_watch(
+      fd, directory.empty() ? "." : directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd >= 0) directories[wd] = directory;
+  }
+#endif
+  return true;
+}
+
+std::vector<std::string> FileWatcher::poll() {
+  std::vector<std::string> changed;
+#ifdef __linux__
+  if (fd >= 0) {
+    alignas(struct inotify_event) char buffer[4096];
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+      for (char* p = buffer; p < buffer + length;) {
+        const struct inotify_event* event = (const struct inotify_event*)p;
+        p += sizeof(struct inotify_event) + event->len;
+        auto directory = directories.find(event->wd);
+        if (directory == directories.end() || event->len == 0) continue;
+        std::string path = directory->second + event->name;
+        bool watched = files.count(path) > 0;
+        if (watched && std::find(changed.begin(), changed.end(), path) == changed.end()) {
+          changed.push_back(path);
+        }
+      }
+    }
+    return changed;
+  }
+#endif
+  // no change notifications, compare modification times
+  for (auto& file : files) {
+    uint64_t mtime, size;
+    if (file_stat(file.first, &mtime, &size) && mtime != file.second) {
+      file.second = mtime;
+      changed.push_back(file.first);
+    }
+  }
+  return changed;
+}
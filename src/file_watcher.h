@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Reports files that changed on disk. Uses inotify on Linux, watching the directories of the
+// files so that editors replacing a file by renaming over it are noticed too, and compares
+// modification times on every poll elsewhere.
+class FileWatcher {
+public:
+  FileWatcher();
+  ~FileWatcher();
+
+  // start watching path, false if it does not exist
+  bool add(const std::string& path);
+  // files written since the last poll, each reported once; never blocks
+  std::vector<std::string> poll();
+
+private:
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+
+  // inotify instance, -1 where unavailable
+  int fd = -1;
+  // watched directories by watch descriptor
+  std::map<int, std::string> directories;
+  // watched files and their modification time
+  std::map<std::string, uint64_t> files;
+};
@@ -0,0 +1,145 @@
+#include "frame_arena.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+// block of an arena, its bytes follow
+struct ArenaBlock {
+  ArenaBlock* next;
+  size_t size;
+};
+
+struct FrameArena {
+  // blocks in the order they are filled, the one being filled and the bytes used of it
+  ArenaBlock* first = nullptr;
+  ArenaBlock* current = nullptr;
+  size_t offset = 0;
+  // frame the arena was last rewound for
+  unsigned int frame = 0;
+  ~FrameArena() {
+    while (first) {
+      ArenaBlock* next = first->next;
+      std::free(first);
+      first = next;
+    }
+  }
+};
+
+static std::atomic<unsigned int> frame(0);
+static thread_local FrameArena arena;
+
+// statistics, bytes handed out since the last report and bytes of every block
+static std::atomic<size_t> frame_bytes(0), reserved_bytes(0);
+
+static std::atomic<size_t> heap_allocations(0);
+static size_t reported_heap_allocations = 0;
+static std::atomic<HeapAllocationHook> heap_hook(nullptr);
+
+void frame_arena_new_frame() {
+  frame++;
+}
+
+void* frame_alloc(size_t size, size_t alignment) {
+  FrameArena& a = arena;
+  unsigned int current_frame = frame.load(std::memory_order_relaxed);
+  if (a.frame != current_frame) {
+    a.current = a.first;
+    a.offset = 0;
+    a.frame = current_frame;
+  }
+  frame_bytes.fetch_add(size, std::memory_order_relaxed);
+  for (;;) {
+    if (a.current) {
+      uintptr_t base = (uintptr_t)(a.current + 1);
+      size_t start = (base + a.offset + alignment - 1) / alignment * alignment - base;
+      if (start + size <= a.current->size) {
+        a.offset = start + size;
+        return (void*)(base + start);
+      }
+      // the rest of the block is wasted for this frame
+      if (a.current->next) {
+        a.current = a.current->next;
+        a.offset = 0;
+        continue;
+      }
+    }
+    size_t block_size = std::max((size_t)FRAME_ARENA_BLOCK_SIZE, size + alignment);
+    ArenaBlock* block = (ArenaBlock*)std::malloc(sizeof(ArenaBlock) + block_size);
+    if (!block) throw std::bad_alloc();
+    block->next = nullptr;
+    block->size = block_size;
+    if (a.current)
+      a.current->next = block;
+    else
+      a.first = block;
+    a.current = block;
+    a.offset = 0;
+    reserved_bytes.fetch_add(block_size, std::memory_order_relaxed);
+  }
+}
+
+size_t heap_allocation_count() {
+  return heap_allocations.load(std::memory_order_relaxed);
+}
+
+void set_heap_allocation_hook(HeapAllocationHook hook) {
+  heap_hook = hook;
+}
+
+void frame_arena_report(unsigned int frames) {
+  if (frames == 0) return;
+  size_t allocations = heap_allocation_count();
+  std::cout << "Memory: " << (double)(allocations - reported_heap_allocations) / frames
+            << " heap allocations and " << frame_bytes / 1024.0 / frames
+            << " KB from frame arenas per frame, " << reserved_bytes / 1024 << " KB of arenas"
+            << std::endl;
+  reported_heap_allocations = allocations;
+  frame_bytes = 0;
+}
+
+static void* tracked_malloc(size_t size) {
+  heap_allocations.fetch_add(1, std::memory_order_relaxed);
+  HeapAllocationHook hook = heap_hook.load(std::memory_order_relaxed);
+  if (hook) hook(size);
+  return std::malloc(size > 0 ? size : 1);
+}
+
+void* operator new(size_t size) {
+  void* p = tracked_malloc(size);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) {
+  void* p = tracked_malloc(size);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return tracked_malloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return tracked_malloc(size);
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  std::free(p);
+}
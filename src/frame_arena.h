@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Per-frame linear allocation. Every thread bumps a pointer through blocks of its own arena,
+// nothing is freed one by one: frame_arena_new_frame() hands all of it back at once and the
+// blocks are reused, so once the arenas have grown to fit a frame, transient data costs no
+// heap allocations. Memory from the arena is only valid until the next frame_arena_new_frame.
+#define FRAME_ARENA_BLOCK_SIZE (64 * 1024)
+
+// start a new frame, the next allocation of every thread reuses its arena from the start.
+// Only call while no other thread holds frame memory.
+void frame_arena_new_frame();
+// size bytes aligned to alignment from the arena of the calling thread
+void* frame_alloc(size_t size, size_t alignment = alignof(std::max_align_t));
+
+// STL allocator drawing from the frame arenas, deallocation does nothing
+template <typename T> class FrameAllocator {
+public:
+  typedef T value_type;
+  template <typename U> struct rebind {
+    typedef FrameAllocator<U> other;
+  };
+  FrameAllocator() {
+  }
+  template <typename U> FrameAllocator(const FrameAllocator<U>&) {
+  }
+  T* allocate(size_t count) {
+    return (T*)frame_alloc(count * sizeof(T), alignof(T));
+  }
+  void deallocate(T*, size_t) {
+  }
+};
+template <typename T, typename U>
+bool operator==(const FrameAllocator<T>&, const FrameAllocator<U>&) {
+  return true;
+}
+template <typename T, typename U>
+bool operator!=(const FrameAllocator<T>&, const FrameAllocator<U>&) {
+  return false;
+}
+
+typedef std::basic_string<char, std::char_traits<char>, FrameAllocator<char>> FrameString;
+template <typename T> using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+// Heap tracking: operator new and delete are replaced to count every general-heap allocation of
+// the process. The arenas take their blocks from malloc and are not counted.
+typedef void (*HeapAllocationHook)(size_t size);
+// allocations through operator new since startup, from every thread
+size_t heap_allocation_count();
+// call hook on every allocation through operator new, from the allocating thread, before the
+// memory is allocated. nullptr removes it. The hook must not allocate itself.
+void set_heap_allocation_hook(HeapAllocationHook hook);
+
+// print the heap allocations and the arena bytes per frame over the last frames frames, and
+// start counting again
+void frame_arena_report(unsigned int frames);
@@ -0,0 +1,159 @@
+#include "gl_state.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+// a name no object has, for state that is not known
+#define UNKNOWN 0xFFFFFFFFu
+
+// the kinds of calls counted separately
+enum StateCall {
+  CALL_PROGRAM,
+  CALL_VERTEX_ARRAY,
+  CALL_FRAMEBUFFER,
+  CALL_TEXTURE,
+  CALL_CAPABILITY,
+  NUM_STATE_CALLS,
+};
+static const char* CALL_NAMES[NUM_STATE_CALLS] = {
+  "program", "vertex array", "framebuffer", "texture", "capability",
+};
+
+static const GLenum TEXTURE_TARGETS[3] = {
+  GL_TEXTURE_2D,
+  GL_TEXTURE_2D_ARRAY,
+  GL_TEXTURE_BUFFER,
+};
+static const GLenum CAPABILITIES[4] = {
+  GL_BLEND,
+  GL_DEPTH_TEST,
+  GL_CULL_FACE,
+  GL_RASTERIZER_DISCARD,
+};
+
+static unsigned int program = UNKNOWN, vertex_array = UNKNOWN;
+static unsigned int read_framebuffer = UNKNOWN, draw_framebuffer = UNKNOWN;
+static unsigned int active_unit = UNKNOWN;
+static unsigned int textures[GL_STATE_TEXTURE_UNITS][3];
+// 0 disabled, 1 enabled
+static unsigned int capabilities[4] = { UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN };
+// textures holds UNKNOWN everywhere once set
+static bool textures_known = false;
+
+// calls since the last report
+static unsigned int issued[NUM_STATE_CALLS] = {}, filtered[NUM_STATE_CALLS] = {};
+
+// whether a call setting cached to value can be dropped, updating cached and the counts
+static bool redundant(unsigned int& cached, unsigned int value, StateCall call) {
+  if (cached == value) {
+    filtered[call]++;
+    return true;
+  }
+  cached = value;
+  issued[call]++;
+  return false;
+}
+
+static int texture_target_index(GLenum target) {
+  for (int i = 0; i < 3; i++) {
+    if (TEXTURE_TARGETS[i] == target) return i;
+  }
+  return -1;
+}
+
+static int capability_index(GLenum capability) {
+  for (int i = 0; i < 4; i++) {
+    if (CAPABILITIES[i] == capability) return i;
+  }
+  return -1;
+}
+
+void gl_use_program(unsigned int id) {
+  if (!redundant(program, id, CALL_PROGRAM)) glUseProgram(id);
+}
+
+void gl_bind_vertex_array(unsigned int vao) {
+  if (!redundant(vertex_array, vao, CALL_VERTEX_ARRAY)) glBindVertexArray(vao);
+}
+
+void gl_bind_framebuffer(unsigned int target, unsigned int fbo) {
+  if (target == GL_FRAMEBUFFER) {
+    if (read_framebuffer == fbo && draw_framebuffer == fbo) {
+      filtered[CALL_FRAMEBUFFER]++;
+      return;
+    }
+    read_framebuffer = draw_framebuffer = fbo;
+    issued[CALL_FRAMEBUFFER]++;
+    glBindFramebuffer(target, fbo);
+    return;
+  }
+  unsigned int& cached = target == GL_READ_FRAMEBUFFER ? read_framebuffer : draw_framebuffer;
+  if (!redundant(cached, fbo, CALL_FRAMEBUFFER)) glBindFramebuffer(target, fbo);
+}
+
+void gl_bind_texture(unsigned int unit, unsigned int target, unsigned int texture) {
+  if (!textures_known) {
+    for (auto& unit_textures : textures) {
+      for (unsigned int& bound : unit_textures) bound = UNKNOWN;
+    }
+    textures_known = true;
+  }
+  int index = texture_target_index(target);
+  if (unit < GL_STATE_TEXTURE_UNITS && index >= 0) {
+    if (redundant(textures[unit][index], texture, CALL_TEXTURE)) return;
+  } else {
+    issued[CALL_TEXTURE]++;
+  }
+  if (active_unit != unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    active_unit = unit;
+  }
+  glBindTexture(target, texture);
+}
+
+void gl_edit_texture(unsigned int target, unsigned int texture) {
+  gl_bind_texture(GL_STATE_EDIT_UNIT, target, texture);
+  if (active_unit != GL_STATE_EDIT_UNIT) {
+    glActiveTexture(GL_TEXTURE0 + GL_STATE_EDIT_UNIT);
+    active_unit = GL_STATE_EDIT_UNIT;
+  }
+}
+
+void gl_set_enabled(unsigned int capability, bool enabled) {
+  int index = capability_index(capability);
+  if (index >= 0) {
+    if (redundant(capabilities[index], enabled, CALL_CAPABILITY)) return;
+  } else {
+    issued[CALL_CAPABILITY]++;
+  }
+  if (enabled)
+    glEnable(capability);
+  else
+    glDisable(capability);
+}
+
+void gl_state_invalidate() {
+  program = vertex_array = UNKNOWN;
+  read_framebuffer = draw_framebuffer = UNKNOWN;
+  active_unit = UNKNOWN;
+  textures_known = false;
+  for (unsigned int& capability : capabilities) capability = UNKNOWN;
+}
+
+void gl_state_report(unsigned int frames) {
+  if (frames == 0) return;
+  unsigned int total_issued = 0, total_filtered = 0;
+  for (int i = 0; i < NUM_STATE_CALLS; i++) {
+    total_issued += issued[i];
+    total_filtered += filtered[i];
+  }
+  std::cout << "GL state: " << (double)total_issued / frames << " calls issued, "
+            << (double)total_filtered / frames << " filtered per frame (";
+  for (int i = 0; i < NUM_STATE_CALLS; i++) {
+    std::cout << (i > 0 ? ", " : "") << CALL_NAMES[i] << " " << (double)issued[i] / frames
+              << "/" << (double)filtered[i] / frames;
+    issued[i] = filtered[i] = 0;
+  }
+  std::cout << ")" << std::endl;
+}
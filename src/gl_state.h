@@ -0,0 +1,31 @@
+#pragma once
+
+// Cache of the GL state the frame changes most: program, vertex array, framebuffers, textures
+// of the units below GL_STATE_TEXTURE_UNITS and a few capabilities. Calls that would set what
+// is already set are dropped. The cache only knows about changes made through it, so code that
+// binds these objects directly has to call gl_state_invalidate() afterwards, as does code that
+// deletes objects which may be bound, since their names get reused.
+#define GL_STATE_TEXTURE_UNITS 16
+// unit gl_edit_texture binds to, no shader samples from it
+#define GL_STATE_EDIT_UNIT (GL_STATE_TEXTURE_UNITS - 1)
+
+void gl_use_program(unsigned int program);
+void gl_bind_vertex_array(unsigned int vao);
+// target GL_FRAMEBUFFER binds both the read and the draw framebuffer
+void gl_bind_framebuffer(unsigned int target, unsigned int fbo);
+// bind texture to target of unit. GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY and GL_TEXTURE_BUFFER are
+// tracked, other targets and units always go through.
+void gl_bind_texture(unsigned int unit, unsigned int target, unsigned int texture);
+// bind texture to target of GL_STATE_EDIT_UNIT and make that the active unit, so that the
+// texture can be specified or changed. gl_bind_texture leaves the active unit as it is when it
+// filters a call.
+void gl_edit_texture(unsigned int target, unsigned int texture);
+// glEnable/glDisable. GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE and GL_RASTERIZER_DISCARD are
+// tracked, other capabilities always go through.
+void gl_set_enabled(unsigned int capability, bool enabled);
+
+// forget the cached state, the next call of each kind goes through
+void gl_state_invalidate();
+// print the calls issued and filtered per frame over the last frames frames, and start
+// counting again
+void gl_state_report(unsigned int frames);
@@ -0,0 +1,124 @@
+#include "gpu_resources.h"
+
+#include "gl_state.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+struct GpuObject {
+  unsigned int name = 0;
+  std::string label;
+};
+
+static const char* KIND_NAMES[NUM_GPU_OBJECT_KINDS] = {
+  "buffers", "vertex arrays", "textures", "renderbuffers", "framebuffers", "programs",
+};
+
+static ResourcePool<GpuObject> pools[NUM_GPU_OBJECT_KINDS];
+
+static void delete_object(GpuObjectKind kind, unsigned int name) {
+  switch (kind) {
+  case GPU_BUFFER:
+    glDeleteBuffers(1, &name);
+    break;
+  case GPU_VERTEX_ARRAY:
+    glDeleteVertexArrays(1, &name);
+    break;
+  case GPU_TEXTURE:
+    glDeleteTextures(1, &name);
+    break;
+  case GPU_RENDERBUFFER:
+    glDeleteRenderbuffers(1, &name);
+    break;
+  case GPU_FRAMEBUFFER:
+    glDeleteFramebuffers(1, &name);
+    break;
+  case GPU_PROGRAM:
+    glDeleteProgram(name);
+    break;
+  default:
+    break;
+  }
+  // deleting unbinds the object and its name may come back for another one
+  gl_state_invalidate();
+}
+
+GpuHandle gpu_create(GpuObjectKind kind, const std::string& label) {
+  unsigned int name = 0;
+  switch (kind) {
+  case GPU_BUFFER:
+    glGenBuffers(1, &name);
+    break;
+  case GPU_VERTEX_ARRAY:
+    glGenVertexArrays(1, &name);
+    break;
+  case GPU_TEXTURE:
+    glGenTextures(1, &name);
+    break;
+  case GPU_RENDERBUFFER:
+    glGenRenderbuffers(1, &name);
+    break;
+  case GPU_FRAMEBUFFER:
+    glGenFramebuffers(1, &name);
+    break;
+  default:
+    std::cout << "Cannot generate GL " << KIND_NAMES[kind] << ", adopt them instead" << std::endl;
+    break;
+  }
+  return gpu_adopt(kind, name, label);
+}
+
+GpuHandle gpu_adopt(GpuObjectKind kind, unsigned int name, const std::string& label) {
+  GpuHandle handle;
+  handle.kind = kind;
+  if (name == 0) return handle;
+  GpuObject object;
+  object.name = name;
+  object.label = label;
+  handle.slot = pools[kind].create(object);
+  return handle;
+}
+
+unsigned int gpu_name(GpuHandle handle) {
+  GpuObject* object = pools[handle.kind].get(handle.slot);
+  return object ? object->name : 0;
+}
+
+bool gpu_destroy(GpuHandle handle) {
+  GpuObject* object = pools[handle.kind].get(handle.slot);
+  if (!object) return false;
+  delete_object(handle.kind, object->name);
+  pools[handle.kind].destroy(handle.slot);
+  return true;
+}
+
+void gpu_replace(GpuHandle handle, unsigned int name) {
+  GpuObject* object = pools[handle.kind].get(handle.slot);
+  if (!object) return;
+  delete_object(handle.kind, object->name);
+  object->name = name;
+}
+
+void gpu_resources_report() {
+  std::cout << "GPU objects:";
+  for (int kind = 0; kind < NUM_GPU_OBJECT_KINDS; kind++) {
+    std::cout << (kind > 0 ? ", " : " ") << pools[kind].size() << " " << KIND_NAMES[kind];
+  }
+  std::cout << std::endl;
+}
+
+void gpu_resources_shutdown() {
+  size_t leaked = 0;
+  for (int kind = 0; kind < NUM_GPU_OBJECT_KINDS; kind++) {
+    ResourcePool<GpuObject>& pool = pools[kind];
+    pool.for_each([&](ResourceHandle slot, GpuObject& object) {
+      std::cout << "Leaked GL object: " << object.label << " (" << KIND_NAMES[kind] << ", name "
+                << object.name << ")" << std::endl;
+      delete_object((GpuObjectKind)kind, object.name);
+      pool.destroy(slot);
+      leaked++;
+    });
+  }
+  if (leaked > 0) std::cout << leaked << " GL objects leaked" << std::endl;
+}
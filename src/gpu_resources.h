@@ -0,0 +1,49 @@
+#pragma once
+
+#include "resource_pool.h"
+
+#include <string>
+
+// Registry owning GL objects. Every object lives in a pool of its kind and is referred to by a
+// GpuHandle, which values such as Mesh and Texture copy freely: the copies share the object,
+// and once any owner destroys it the handles of all the others go stale and resolve to 0
+// rather than to a name GL may have handed out again. What is still alive at shutdown is
+// reported as leaked and deleted. Handles may be resolved on any thread while no object is
+// being created or destroyed.
+enum GpuObjectKind {
+  GPU_BUFFER,
+  GPU_VERTEX_ARRAY,
+  GPU_TEXTURE,
+  GPU_RENDERBUFFER,
+  GPU_FRAMEBUFFER,
+  GPU_PROGRAM,
+  NUM_GPU_OBJECT_KINDS,
+};
+
+struct GpuHandle {
+  GpuObjectKind kind = GPU_BUFFER;
+  ResourceHandle slot;
+  bool operator==(const GpuHandle& other) const {
+    return kind == other.kind && slot == other.slot;
+  }
+  bool operator!=(const GpuHandle& other) const {
+    return !(*this == other);
+  }
+};
+
+// generate an object of kind, named label in reports. Programs are made by shader.cpp and
+// adopted instead.
+GpuHandle gpu_create(GpuObjectKind kind, const std::string& label);
+// take ownership of an object made elsewhere, the null handle for name 0
+GpuHandle gpu_adopt(GpuObjectKind kind, unsigned int name, const std::string& label);
+// GL name of the object, 0 for null and stale handles
+unsigned int gpu_name(GpuHandle handle);
+// delete the object, false if the handle was null or stale already
+bool gpu_destroy(GpuHandle handle);
+// delete the object and let the handle name another one of the same kind instead
+void gpu_replace(GpuHandle handle, unsigned int name);
+
+// print the live objects of every kind
+void gpu_resources_report();
+// report the objects nobody destroyed and delete them, before the context goes away
+void gpu_resources_shutdown();
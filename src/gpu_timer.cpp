@@ -0,0 +1,52 @@
+#include "gpu_timer.h"
+
+// clang-format off
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+// clang-format on
+
+#include <iostream>
+
+#define REPORT_INTERVAL 2.0
+
+GpuTimer::GpuTimer(const std::string& name) : name(name) {
+  glGenQueries(NUM_QUERIES, queries);
+  for (int i = 0; i < NUM_QUERIES; i++) pending[i] = false;
+  last_report = glfwGetTime();
+}
+
+GpuTimer::~GpuTimer() {
+  glDeleteQueries(NUM_QUERIES, queries);
+}
+
+void GpuTimer::begin() {
+  // the slot was issued NUM_QUERIES frames ago, its result is normally ready by now
+  if (pending[current]) collect(current);
+  glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+}
+
+void GpuTimer::end() {
+  glEndQuery(GL_TIME_ELAPSED);
+  pending[current] = true;
+  current = (current + 1) % NUM_QUERIES;
+
+  double now = glfwGetTime();
+  if (now - last_report > REPORT_INTERVAL && samples > 0) {
+    std::cout << name << ": " << average_ms() << " ms" << std::endl;
+    total_ms = 0;
+    samples = 0;
+    last_report = now;
+  }
+}
+
+double GpuTimer::average_ms() const {
+  return samples > 0 ? total_ms / samples : 0.0;
+}
+
+void GpuTimer::collect(int slot) {
+  GLuint64 elapsed_ns;
+  glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &elapsed_ns);
+  total_ms += elapsed_ns / 1.0e6;
+  samples++;
+  pending[slot] = false;
+}
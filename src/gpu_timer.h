@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+
+// Measures the GPU time spent between begin() and end() with GL_TIME_ELAPSED queries.
+// Queries are recycled from a small ring and read back a few frames late, so timing a
+// pass never stalls the pipeline. The running average is printed every few seconds.
+class GpuTimer {
+public:
+  explicit GpuTimer(const std::string& name);
+  ~GpuTimer();
+
+  void begin(void);
+  void end(void);
+  // average GPU time in milliseconds over the current report period
+  double average_ms(void) const;
+
+private:
+  static const int NUM_QUERIES = 4;
+  // fold the result of a finished query into the average
+  void collect(int slot);
+
+  std::string name;
+  unsigned int queries[NUM_QUERIES];
+  bool pending[NUM_QUERIES];
+  int current = 0;
+  double total_ms = 0;
+  int samples = 0;
+  double last_report = 0;
+};
@@ -0,0 +1,444 @@
+#include "job_system.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// jobs taken from the pool of a thread before reusing the first, a power of two
+#define JOB_POOL_SIZE 4096
+// rounds of finding nothing to do before an idle worker sleeps
+#define IDLE_SPINS 64
+// an automatic grain gives every thread this many pieces to balance with
+#define PARALLEL_FOR_PIECES 8
+
+struct Job {
+  JobFunction function;
+  void* data;
+  size_t begin, end, grain;
+  JobCounter* counter;
+  // set while queued or running, the pool skips such slots
+  std::atomic<bool> in_use;
+  Job() : in_use(false) {
+  }
+};
+
+// Chase-Lev deque with a fixed capacity, after Le et al., "Correct and efficient work-stealing
+// for weak memory models". Only the owner pushes and pops, any thread steals.
+class WorkDeque {
+public:
+  WorkDeque() : top(0), bottom(0) {
+    for (int i = 0; i < JOB_DEQUE_SIZE; i++) jobs[i].store(nullptr, std::memory_order_relaxed);
+  }
+
+  // false when full
+  bool push(Job* job) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    if (b - t >= JOB_DEQUE_SIZE) return false;
+    jobs[b & (JOB_DEQUE_SIZE - 1)].store(job, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // newest job, nullptr when empty or a thief took the last one
+  Job* pop() {
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    Job* job = jobs[b & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+    if (t == b) {
+      // last job, race the thieves for it
+      if (!top.compare_exchange_strong(
+            t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        job = nullptr;
+      bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return job;
+  }
+
+  // oldest job, nullptr when empty or another thread got it first
+  Job* steal() {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b) return nullptr;
+    Job* job = jobs[t & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+    if (!top.compare_exchange_strong(
+          t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+      return nullptr;
+    return job;
+  }
+
+  bool empty() const {
+    return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<int64_t> top;
+  std::atomic<int64_t> bottom;
+  std::atomic<Job*> jobs[JOB_DEQUE_SIZE];
+};
+
+// per-thread scheduler state
+struct JobThread {
+  WorkDeque deque;
+  Job pool[JOB_POOL_SIZE];
+  unsigned int next_job = 0;
+  // victim selection
+  unsigned int random;
+};
+
+// published with release once constructed, null while a thread is still registering
+static std::atomic<JobThread*> job_threads[MAX_JOB_THREADS];
+static std::atomic<unsigned int> num_job_threads(0);
+static std::vector<std::thread> workers;
+static std::atomic<bool> running(false);
+// idle workers sleep here until a job is pushed, which bumps the epoch
+static std::mutex sleep_mutex;
+static std::condition_variable wake;
+static std::atomic<unsigned int> sleeping(0);
+static std::atomic<unsigned int> push_epoch(0);
+
+static thread_local JobThread* this_job_thread = nullptr;
+
+// state of the calling thread, registered on first use. nullptr when jobs run inline.
+static JobThread* current_thread() {
+  if (this_job_thread || !running.load(std::memory_order_acquire)) return this_job_thread;
+  unsigned int index = num_job_threads.load();
+  do {
+    if (index >= MAX_JOB_THREADS) return nullptr;
+  } while (!num_job_threads.compare_exchange_weak(index, index + 1));
+  JobThread* thread = new JobThread();
+  thread->random = index * 2654435761u + 1;
+  job_threads[index].store(thread, std::memory_order_release);
+  this_job_thread = thread;
+  return thread;
+}
+
+static Job* find_job(JobThread* self) {
+  Job* job = self->deque.pop();
+  if (job) return job;
+  // xorshift, starting at a random victim spreads the thieves over the deques
+  self->random ^= self->random << 13;
+  self->random ^= self->random >> 17;
+  self->random ^= self->random << 5;
+  unsigned int count = num_job_threads.load(std::memory_order_acquire);
+  for (unsigned int i = 0; i < count; i++) {
+    JobThread* victim = job_threads[(self->random + i) % count].load(std::memory_order_acquire);
+    if (!victim || victim == self) continue;
+    job = victim->deque.steal();
+    if (job) return job;
+  }
+  return nullptr;
+}
+
+// queue a job on the deque of self, false when it has to run inline
+static bool push_job(
+  JobThread* self,
+  JobFunction function,
+  void* data,
+  size_t begin,
+  size_t end,
+  size_t grain,
+  JobCounter& counter) {
+  if (!self) return false;
+  Job* job = &self->pool[self->next_job++ & (JOB_POOL_SIZE - 1)];
+  // the slot still belongs to a job that has not finished
+  if (job->in_use.load(std::memory_order_acquire)) return false;
+  job->function = function;
+  job->data = data;
+  job->begin = begin;
+  job->end = end;
+  job->grain = grain;
+  job->counter = &counter;
+  job->in_use.store(true, std::memory_order_relaxed);
+  counter.pending.fetch_add(1, std::memory_order_relaxed);
+  if (!self->deque.push(job)) {
+    counter.pending.fetch_sub(1, std::memory_order_relaxed);
+    job->in_use.store(false, std::memory_order_relaxed);
+    return false;
+  }
+  push_epoch++;
+  if (sleeping.load() > 0) {
+    // a worker between checking the epoch and blocking holds the mutex, the notify waits for it
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    wake.notify_one();
+  }
+  return true;
+}
+
+// run [begin, end) in pieces of grain, splitting off the upper half whenever the own deque ran
+// empty, that is when other threads may be looking for work
+static void run_range(
+  JobThread* self,
+  JobFunction function,
+  void* data,
+  size_t begin,
+  size_t end,
+  size_t grain,
+  JobCounter& counter) {
+  while (begin < end) {
+    if (end - begin > grain && self && self->deque.empty()) {
+      size_t middle = begin + (end - begin) / 2;
+      if (push_job(self, function, data, middle, end, grain, counter)) {
+        end = middle;
+        continue;
+      }
+    }
+    size_t last = std::min(end, begin + grain);
+    function(data, begin, last);
+    begin = last;
+  }
+}
+
+static void execute(JobThread* self, Job* job) {
+  JobCounter& counter = *job->counter;
+  run_range(self, job->function, job->data, job->begin, job->end, job->grain, counter);
+  job->in_use.store(false, std::memory_order_release);
+  // the waiter may return and release data as soon as this drops to zero
+  counter.pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+static void worker_main() {
+  JobThread* self = current_thread();
+  unsigned int idle = 0;
+  while (running.load(std::memory_order_acquire)) {
+    // read before looking, a push after it changes the epoch and keeps the worker awake
+    unsigned int epoch = push_epoch.load();
+    Job* job = find_job(self);
+    if (job) {
+      execute(self, job);
+      idle = 0;
+    } else if (++idle < IDLE_SPINS) {
+      std::this_thread::yield();
+    } else {
+      std::unique_lock<std::mutex> lock(sleep_mutex);
+      sleeping++;
+      wake.wait(lock, [epoch] { return push_epoch.load() != epoch || !running.load(); });
+      sleeping--;
+      idle = 0;
+    }
+  }
+}
+
+void job_system_init(unsigned int num_workers) {
+  if (running.load()) return;
+  if (num_workers == 0) num_workers = std::max(1u, std::thread::hardware_concurrency()) - 1;
+  num_workers = std::min(num_workers, (unsigned int)MAX_JOB_THREADS - 1);
+  running.store(true);
+  // workers still running at exit would abort the process
+  static bool exit_registered = false;
+  if (!exit_registered) std::atexit(job_system_shutdown);
+  exit_registered = true;
+  // the initializing thread takes part too
+  current_thread();
+  for (unsigned int i = 0; i < num_workers; i++) workers.push_back(std::thread(worker_main));
+}
+
+void job_system_shutdown() {
+  if (!running.load()) return;
+  running.store(false);
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    wake.notify_all();
+  }
+  for (std::thread& worker : workers) worker.join();
+  workers.clear();
+  // threads that called in keep their state until exit, they may still hold it
+}
+
+unsigned int job_system_concurrency() {
+  return running.load() ? workers.size() + 1 : 1;
+}
+
+void job_spawn(
+  JobFunction function,
+  void* data,
+  size_t begin,
+  size_t end,
+  size_t grain,
+  JobCounter& counter) {
+  grain = std::max<size_t>(grain, 1);
+  JobThread* self = current_thread();
+  if (!push_job(self, function, data, begin, end, grain, counter))
+    run_range(self, function, data, begin, end, grain, counter);
+}
+
+void job_wait(JobCounter& counter) {
+  JobThread* self = current_thread();
+  while (counter.pending.load(std::memory_order_acquire) > 0) {
+    Job* job = self ? find_job(self) : nullptr;
+    if (job)
+      execute(self, job);
+    else
+      std::this_thread::yield();
+  }
+}
+
+void parallel_for(size_t begin, size_t end, size_t grain, JobFunction function, void* data) {
+  if (begin >= end) return;
+  if (grain == 0) grain = (end - begin) / (job_system_concurrency() * PARALLEL_FOR_PIECES);
+  grain = std::max<size_t>(grain, 1);
+  // the calling thread works on the range itself, idle threads steal the halves it splits off
+  JobCounter counter;
+  run_range(current_thread(), function, data, begin, end, grain, counter);
+  job_wait(counter);
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// some arithmetic per index that the compiler cannot drop
+static float work_item(size_t i, int iterations) {
+  float x = (float)(i & 1023) * 0.001f;
+  for (int k = 0; k < iterations; k++) x = x * 0.999f + 0.5f / (1.0f + x);
+  return x;
+}
+
+void benchmark_job_system() {
+  std::cout << "Job system: " << job_system_concurrency() << " threads" << std::endl;
+
+  // overhead of a job that does nothing
+  const int num_jobs = 200000;
+  JobCounter counter;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_jobs; i++) {
+    job_spawn([](void*, size_t, size_t) {}, nullptr, 0, 1, 1, counter);
+    // keep the deque from filling up, jobs past it would just run inline
+    if (i % 1024 == 1023) job_wait(counter);
+  }
+  job_wait(counter);
+  std::cout << "Empty jobs: " << seconds_since(start) * 1e9 / num_jobs << " ns per job"
+            << std::endl;
+
+  // parallel_for over uniform and uneven work, serial first as the baseline
+  const size_t n = 1 << 22;
+  std::vector<float> out(n);
+  for (int uneven = 0; uneven < 2; uneven++) {
+    auto body = [&out, uneven](size_t first, size_t last) {
+      for (size_t i = first; i < last; i++)
+        out[i] = work_item(i, uneven && i % 64 == 0 ? 400 : 8);
+    };
+    start = std::chrono::steady_clock::now();
+    body(0, n);
+    double serial = seconds_since(start);
+    std::cout << (uneven ? "Uneven" : "Uniform") << " work, " << n << " items: serial "
+              << serial * 1000.0 << " ms" << std::endl;
+    const size_t grains[] = { 0, 64, 4096, 65536 };
+    for (size_t grain : grains) {
+      start = std::chrono::steady_clock::now();
+      parallel_for(0, n, grain, body);
+      double parallel = seconds_since(start);
+      std::cout << "  grain " << (grain ? std::to_string(grain) : std::string("auto")) << ": "
+                << parallel * 1000.0 << " ms, " << serial / parallel << "x" << std::endl;
+    }
+  }
+}
+
+// recursive spawns, as jobs that split their work into jobs of their own do
+static void spawn_tree(void* data, size_t depth, size_t) {
+  std::atomic<unsigned int>* leaves = (std::atomic<unsigned int>*)data;
+  if (depth == 0) {
+    leaves->fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  JobCounter counter;
+  for (int i = 0; i < 4; i++) job_spawn(spawn_tree, data, depth - 1, depth, 1, counter);
+  job_wait(counter);
+}
+
+bool stress_test_job_system() {
+  bool ok = true;
+  std::cout << "Job system stress test: " << job_system_concurrency() << " threads" << std::endl;
+
+  // one owner pushing and popping against thieves on every other hardware thread
+  {
+    const int rounds = 2000000;
+    unsigned int num_thieves = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    WorkDeque* deque = new WorkDeque();
+    std::vector<Job> jobs(rounds);
+    std::vector<std::atomic<unsigned char>> taken(rounds);
+    for (int i = 0; i < rounds; i++) taken[i].store(0);
+    std::atomic<bool> done(false);
+    auto take = [&](Job* job) { taken[job - jobs.data()].fetch_add(1); };
+    std::vector<std::thread> thieves;
+    for (unsigned int t = 0; t < num_thieves; t++) {
+      thieves.push_back(std::thread([&] {
+        while (!done.load()) {
+          Job* job = deque->steal();
+          if (job) take(job);
+        }
+      }));
+    }
+    for (int i = 0; i < rounds; i++) {
+      while (!deque->push(&jobs[i])) {
+        Job* job = deque->pop();
+        if (job) take(job);
+      }
+      if (i % 3 == 0) {
+        Job* job = deque->pop();
+        if (job) take(job);
+      }
+    }
+    while (Job* job = deque->pop()) take(job);
+    done.store(true);
+    for (std::thread& thief : thieves) thief.join();
+    int wrong = 0;
+    for (int i = 0; i < rounds; i++) wrong += taken[i].load() != 1;
+    std::cout << "Deque, " << num_thieves << " thieves: " << wrong << " of " << rounds
+              << " jobs taken other than once" << std::endl;
+    ok = ok && wrong == 0;
+    delete deque;
+  }
+
+  // nested parallel_for from every level, every index must be visited exactly once
+  {
+    const size_t outer = 512, inner = 4096;
+    std::vector<std::atomic<unsigned char>> visits(outer * inner);
+    int wrong = 0;
+    for (int round = 0; round < 20; round++) {
+      for (size_t i = 0; i < visits.size(); i++) visits[i].store(0, std::memory_order_relaxed);
+      size_t grain = round % 4 == 0 ? 0 : 1 + rand() % 64;
+      parallel_for(0, outer, 1 + round % 3, [&](size_t first, size_t last) {
+        for (size_t o = first; o < last; o++) {
+          parallel_for(0, inner, grain, [&](size_t a, size_t b) {
+            for (size_t i = a; i < b; i++) visits[o * inner + i].fetch_add(1);
+          });
+        }
+      });
+      for (size_t i = 0; i < visits.size(); i++) wrong += visits[i].load() != 1;
+    }
+    std::cout << "Nested parallel_for: " << wrong << " indices visited other than once"
+              << std::endl;
+    ok = ok && wrong == 0;
+  }
+
+  // deep spawn trees from several jobs at once
+  {
+    std::atomic<unsigned int> leaves(0);
+    const int trees = 16, depth = 7;
+    JobCounter counter;
+    for (int i = 0; i < trees; i++) job_spawn(spawn_tree, &leaves, depth, depth + 1, 1, counter);
+    job_wait(counter);
+    unsigned int expected = trees * (1u << (2 * depth));
+    std::cout << "Spawn trees: " << leaves.load() << " of " << expected << " leaves"
+              << std::endl;
+    ok = ok && leaves.load() == expected;
+  }
+
+  std::cout << (ok ? "Stress test passed" : "Stress test FAILED") << std::endl;
+  return ok;
+}
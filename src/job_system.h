@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Work-stealing job scheduler. Every thread running jobs owns a Chase-Lev deque: it pushes and
+// pops its own jobs at the bottom while idle threads steal from the top. Jobs cover a range of
+// indices and hand halves of what is left to idle threads while their own deque is empty, so
+// the grain adapts to how busy the other threads are. Waiting runs other jobs in the meantime,
+// which lets jobs spawn and wait for jobs of their own.
+
+// jobs a thread can have queued before spawning runs them inline, a power of two
+#define JOB_DEQUE_SIZE 4096
+// threads that can take part, the workers and every thread calling in
+#define MAX_JOB_THREADS 64
+
+// body of a job, called with subranges of the range it was spawned with
+typedef void (*JobFunction)(void* data, size_t begin, size_t end);
+
+// number of unfinished jobs spawned against it
+struct JobCounter {
+  std::atomic<unsigned int> pending;
+  JobCounter() : pending(0) {
+  }
+};
+
+// start num_workers threads, one less than the hardware threads when 0. Without init every
+// job runs inline on the spawning thread.
+void job_system_init(unsigned int num_workers = 0);
+// stop the workers, every job must have been waited for
+void job_system_shutdown();
+// threads running jobs, the workers plus one calling thread
+unsigned int job_system_concurrency();
+
+// run function(data, ...) over [begin, end) as a job, in pieces of at most grain indices
+void job_spawn(
+  JobFunction function,
+  void* data,
+  size_t begin,
+  size_t end,
+  size_t grain,
+  JobCounter& counter);
+// run jobs until every job spawned against counter has finished
+void job_wait(JobCounter& counter);
+
+// function(data, first, last) over subranges of [begin, end) in parallel, returns when all of
+// them are done. grain 0 picks one from the range length and the thread count.
+void parallel_for(size_t begin, size_t end, size_t grain, JobFunction function, void* data);
+
+// body(first, last) over subranges of [begin, end) in parallel
+template<typename F>
+void parallel_for(size_t begin, size_t end, size_t grain, const F& body) {
+  parallel_for(
+    begin,
+    end,
+    grain,
+    [](void* data, size_t first, size_t last) { (*(const F*)data)(first, last); },
+    (void*)&body);
+}
+
+// time spawning, waiting and parallel_for at several grain sizes
+void benchmark_job_system();
+// hammer the deques and nested parallel_for from every thread, false when a job ran twice or
+// never
+bool stress_test_job_system();
@@ -7,6 +7,7 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
 #include <vector>
+#include "gl_state.h"
 #include "light.h"
 
 #define LIGHT_VERT_SHADER_PATH "shaders/forward_light.vs"
@@ -65,30 +66,35 @@ unsigned int PointLight::vbo = -1;
 unsigned int PointLight::ebo = -1;
 Shader* PointLight::shader = nullptr;
 
-PointLight::PointLight(
-  const glm::vec3 pos, const glm::vec3 color, float intensity, int dir, float speed) {
-  this->pos = pos;
-  this->color = color;
-  this->intensity = intensity;
-  this->dir = dir;
-  this->speed = speed;
+void PointLight::draw(
+  unsigned int previous_buffer,
+  unsigned int position_buffer,
+  unsigned int attribute_buffer,
+  unsigned int count) {
   if (shader == nullptr) setupLight();
+  shader->use();
+  shader->set_float("size", 0.05f);
+
+  gl_bind_vertex_array(vao);
+  // the position buffers swap with every simulation step
+  glBindBuffer(GL_ARRAY_BUFFER, previous_buffer);
+  glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+  glBindBuffer(GL_ARRAY_BUFFER, position_buffer);
+  glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+  glBindBuffer(GL_ARRAY_BUFFER, attribute_buffer);
+  glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glDrawArraysInstanced(GL_TRIANGLES, 0, 36, count);
 }
 
-void PointLight::draw(const glm::mat4& projection, const glm::mat4& view) {
-  shader->use();
-  shader->set_mat4("projection", projection);
-  shader->set_mat4("view", view);
-  shader->set_vec3("light_color", this->color);
-
-  glm::mat4 model(1.0f);
-  model = glm::translate(model, pos);
-  model = glm::scale(model, glm::vec3(0.05f, 0.05f, 0.05f));
-  shader->set_mat4("model", model);
-
-  glBindVertexArray(vao);
-  glDrawArrays(GL_TRIANGLES, 0, 36);
-  glBindVertexArray(0);
+void PointLight::release() {
+  if (shader == nullptr) return;
+  shader->release();
+  delete shader;
+  shader = nullptr;
+  glDeleteVertexArrays(1, &vao);
+  glDeleteBuffers(1, &vbo);
+  gl_state_invalidate();
 }
 
 void PointLight::setupLight() {
@@ -99,7 +105,7 @@ void PointLight::setupLight() {
   glGenBuffers(1, &vbo);
 
   // load
-  glBindVertexArray(vao);
+  gl_bind_vertex_array(vao);
   glBindBuffer(GL_ARRAY_BUFFER, vbo);
   glBufferData(GL_ARRAY_BUFFER, sizeof(box_vertices), box_vertices, GL_STATIC_DRAW);
 
@@ -110,6 +116,13 @@ void PointLight::setupLight() {
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
   glEnableVertexAttribArray(1);
   glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 3));
-
-  glBindVertexArray(0);
+  // per-light position and color, sourced in draw
+  glEnableVertexAttribArray(2);
+  glVertexAttribDivisor(2, 1);
+  glEnableVertexAttribArray(3);
+  glVertexAttribDivisor(3, 1);
+  glEnableVertexAttribArray(4);
+  glVertexAttribDivisor(4, 1);
+
+  gl_bind_vertex_array(0);
 }
\ No newline at end of file
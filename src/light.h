@@ -12,18 +12,24 @@
 #define LIGHT_DIR_UP 1
 #define LIGHT_DIR_DOWN -1
 
+// Light source cubes. The lights themselves are LightComponents of the scene.
 class PointLight {
 public:
-  glm::vec3 pos;
-  glm::vec3 color;
-  float intensity;
-  int dir;
-  float speed;
-  PointLight(const glm::vec3 pos, const glm::vec3 color, float intensity, int dir, float speed);
-  void draw(const glm::mat4& projection, const glm::mat4& view);
+  // draw a small cube at each of count lights in one instanced call. The buffers hold a vec4
+  // per light, the positions in xyz and the color in rgb. Cubes are placed light_alpha of the
+  // way from previous_buffer to position_buffer, the camera and light_alpha come from the
+  // frame and lighting blocks of the uniform ring.
+  static void draw(
+    unsigned int previous_buffer,
+    unsigned int position_buffer,
+    unsigned int attribute_buffer,
+    unsigned int count);
+  // create the cube and its shader, done by the first draw unless called before
+  static void setupLight();
+  // delete the cube and its shader
+  static void release();
 
 private:
   static unsigned int vao, vbo, ebo;
-  static void setupLight();
   static Shader* shader;
 };
\ No newline at end of file
@@ -0,0 +1,172 @@
+#include "light_animation.h"
+
+#include "job_system.h"
+#include "light.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// below this many lights one thread is faster than waking the others
+#define PARALLEL_BOUNCE_LIGHTS 16384
+// lights a job moves at least
+#define BOUNCE_CHUNK 4096
+
+static void bounce_scalar(
+  float* y,
+  float* dir,
+  const float* speed,
+  const float* min_y,
+  const float* max_y,
+  size_t begin,
+  size_t end,
+  float dt) {
+  for (size_t i = begin; i < end; i++) {
+    float moved = y[i] + dir[i] * speed[i] * dt;
+    // plain selects, the compiler turns these into min/max and blends
+    float d = moved > max_y[i] ? LIGHT_DIR_DOWN : dir[i];
+    d = moved < min_y[i] ? LIGHT_DIR_UP : d;
+    moved = moved < min_y[i] ? min_y[i] : moved;
+    y[i] = moved > max_y[i] ? max_y[i] : moved;
+    dir[i] = d;
+  }
+}
+
+static void bounce_range(
+  float* y,
+  float* dir,
+  const float* speed,
+  const float* min_y,
+  const float* max_y,
+  size_t begin,
+  size_t end,
+  float dt) {
+  size_t i = begin;
+#if defined(__AVX__)
+  __m256 step = _mm256_set1_ps(dt);
+  __m256 up = _mm256_set1_ps(LIGHT_DIR_UP);
+  __m256 down = _mm256_set1_ps(LIGHT_DIR_DOWN);
+  for (; i + 8 <= end; i += 8) {
+    __m256 d = _mm256_loadu_ps(dir + i);
+    __m256 lo = _mm256_loadu_ps(min_y + i);
+    __m256 hi = _mm256_loadu_ps(max_y + i);
+    __m256 moved = _mm256_add_ps(
+      _mm256_loadu_ps(y + i), _mm256_mul_ps(_mm256_mul_ps(d, _mm256_loadu_ps(speed + i)), step));
+    // and/andnot/or measured faster than blendv
+    __m256 over = _mm256_cmp_ps(moved, hi, _CMP_GT_OQ);
+    d = _mm256_or_ps(_mm256_and_ps(over, down), _mm256_andnot_ps(over, d));
+    __m256 under = _mm256_cmp_ps(moved, lo, _CMP_LT_OQ);
+    d = _mm256_or_ps(_mm256_and_ps(under, up), _mm256_andnot_ps(under, d));
+    _mm256_storeu_ps(y + i, _mm256_min_ps(_mm256_max_ps(moved, lo), hi));
+    _mm256_storeu_ps(dir + i, d);
+  }
+#elif defined(__SSE2__)
+  __m128 step = _mm_set1_ps(dt);
+  __m128 up = _mm_set1_ps(LIGHT_DIR_UP);
+  __m128 down = _mm_set1_ps(LIGHT_DIR_DOWN);
+  for (; i + 4 <= end; i += 4) {
+    __m128 d = _mm_loadu_ps(dir + i);
+    __m128 lo = _mm_loadu_ps(min_y + i);
+    __m128 hi = _mm_loadu_ps(max_y + i);
+    __m128 moved = _mm_add_ps(
+      _mm_loadu_ps(y + i), _mm_mul_ps(_mm_mul_ps(d, _mm_loadu_ps(speed + i)), step));
+    // select with and/andnot/or, SSE2 has no blend
+    __m128 over = _mm_cmpgt_ps(moved, hi);
+    d = _mm_or_ps(_mm_and_ps(over, down), _mm_andnot_ps(over, d));
+    __m128 under = _mm_cmplt_ps(moved, lo);
+    d = _mm_or_ps(_mm_and_ps(under, up), _mm_andnot_ps(under, d));
+    _mm_storeu_ps(y + i, _mm_min_ps(_mm_max_ps(moved, lo), hi));
+    _mm_storeu_ps(dir + i, d);
+  }
+#endif
+  bounce_scalar(y, dir, speed, min_y, max_y, i, end, dt);
+}
+
+void bounce_lights(
+  float* y,
+  float* dir,
+  const float* speed,
+  const float* min_y,
+  const float* max_y,
+  size_t n,
+  float dt) {
+  if (n < PARALLEL_BOUNCE_LIGHTS) {
+    bounce_range(y, dir, speed, min_y, max_y, 0, n, dt);
+    return;
+  }
+  parallel_for(0, n, BOUNCE_CHUNK, [&](size_t first, size_t last) {
+    bounce_range(y, dir, speed, min_y, max_y, first, last, dt);
+  });
+}
+
+// the per-light layout and update this replaced
+struct AosLight {
+  float pos[3];
+  float color[3];
+  float intensity;
+  int dir;
+  float speed;
+};
+
+static void bounce_aos(std::vector<AosLight>& lights, float min_y, float max_y, float dt) {
+  for (AosLight& light : lights) {
+    light.pos[1] += light.dir * light.speed * dt;
+    if (light.pos[1] > max_y) {
+      light.pos[1] = max_y;
+      light.dir = LIGHT_DIR_DOWN;
+    } else if (light.pos[1] < min_y) {
+      light.pos[1] = min_y;
+      light.dir = LIGHT_DIR_UP;
+    }
+  }
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void benchmark_light_animation() {
+  const size_t counts[] = { 1000, 100000, 1000000 };
+  const float dt = 1.0f / 60.0f;
+  const float min_y = 0.0f, max_y = 10.0f;
+  for (size_t n : counts) {
+    std::vector<AosLight> aos(n);
+    std::vector<float> y(n), dir(n), speed(n), lo(n, min_y), hi(n, max_y);
+    for (size_t i = 0; i < n; i++) {
+      aos[i].pos[0] = aos[i].pos[2] = 0.0f;
+      aos[i].pos[1] = y[i] = min_y + (max_y - min_y) * rand() / (float)RAND_MAX;
+      aos[i].dir = rand() % 2 ? LIGHT_DIR_UP : LIGHT_DIR_DOWN;
+      dir[i] = aos[i].dir;
+      aos[i].speed = speed[i] = 0.1f + 1.9f * rand() / (float)RAND_MAX;
+    }
+    // roughly 100M light updates per variant
+    int frames = std::max<int>(10, (int)(100000000 / n));
+
+    auto start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; f++) bounce_aos(aos, min_y, max_y, dt);
+    double aos_time = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; f++)
+      bounce_lights(y.data(), dir.data(), speed.data(), lo.data(), hi.data(), n, dt);
+    double soa_time = seconds_since(start);
+
+    // both must have moved every light the same way
+    float max_diff = 0.0f;
+    for (size_t i = 0; i < n; i++) max_diff = std::fmax(max_diff, std::fabs(aos[i].pos[1] - y[i]));
+
+    std::cout << n << " lights: AoS scalar " << aos_time * 1e9 / ((double)frames * n)
+              << " ns/light, SoA SIMD " << soa_time * 1e9 / ((double)frames * n)
+              << " ns/light, " << aos_time / soa_time << "x, max difference " << max_diff
+              << std::endl;
+  }
+}
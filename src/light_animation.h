@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+// Move n values y[i] by dir[i] * speed[i] * dt and reflect them at min_y[i] and max_y[i],
+// flipping dir[i] (LIGHT_DIR_UP or LIGHT_DIR_DOWN) when a bound is hit. Branch-free SIMD,
+// spread over threads for large n.
+void bounce_lights(
+  float* y,
+  float* dir,
+  const float* speed,
+  const float* min_y,
+  const float* max_y,
+  size_t n,
+  float dt);
+
+// time the AoS scalar update against bounce_lights at 1k, 100k and 1M lights
+void benchmark_light_animation();
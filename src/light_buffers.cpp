@@ -0,0 +1,178 @@
+// clang-format off
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+// clang-format on
+#include "light_buffers.h"
+
+#include "gl_state.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define LIGHT_ANIMATE_SHADER_PATH "shaders/light_animate.vs"
+
+float light_radius(const glm::vec3& color) {
+  const float constant = 1.0f;
+  const float linear = LIGHT_ATTENUATION_LINEAR;
+  const float quadratic = LIGHT_ATTENUATION_QUADRATIC;
+  const float max_brightness = std::max(std::max(color.x, color.y), color.z);
+  float discriminant =
+    linear * linear - 4 * quadratic * (constant - (256.0f / 5.0f) * max_brightness);
+  return (-linear + std::sqrt(discriminant)) / (2.0f * quadratic);
+}
+
+LightBuffers::LightBuffers() {
+  glGenBuffers(2, state_vbo);
+  glGenBuffers(1, &params_vbo);
+  glGenBuffers(1, &attribute_vbo);
+  glGenTextures(2, state_texture);
+  glGenTextures(1, &attribute_texture);
+  glGenVertexArrays(2, animate_vao);
+
+  for (int i = 0; i < 2; i++) {
+    gl_bind_vertex_array(animate_vao[i]);
+    // follows the layout of the shader - light_animate.vs
+    glBindBuffer(GL_ARRAY_BUFFER, state_vbo[i]);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+    glBindBuffer(GL_ARRAY_BUFFER, params_vbo);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+  }
+  gl_bind_vertex_array(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  animate_shader = new Shader(LIGHT_ANIMATE_SHADER_PATH, std::vector<const char*>{ "out_state" });
+}
+
+LightBuffers::~LightBuffers() {
+  glDeleteVertexArrays(2, animate_vao);
+  glDeleteTextures(2, state_texture);
+  glDeleteTextures(1, &attribute_texture);
+  glDeleteBuffers(2, state_vbo);
+  glDeleteBuffers(1, &params_vbo);
+  glDeleteBuffers(1, &attribute_vbo);
+  animate_shader->release();
+  delete animate_shader;
+}
+
+void LightBuffers::allocate(unsigned int count) {
+  // buffers of size 0 cannot back a buffer texture
+  size_t size = std::max(count, 1u) * sizeof(glm::vec4);
+  for (int i = 0; i < 2; i++) {
+    glBindBuffer(GL_ARRAY_BUFFER, state_vbo[i]);
+    glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+    gl_edit_texture(GL_TEXTURE_BUFFER, state_texture[i]);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, state_vbo[i]);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, params_vbo);
+  glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, attribute_vbo);
+  glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STATIC_DRAW);
+  gl_edit_texture(GL_TEXTURE_BUFFER, attribute_texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, attribute_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void LightBuffers::init(const Scene& scene) {
+  const LightComponents& lights = scene.lights;
+  const AnimatorComponents& animators = scene.animators;
+  num_lights = lights.index.size();
+  current = 0;
+  allocate(num_lights);
+  staging.resize(num_lights);
+
+  // lights without an animator stay where they are
+  std::vector<glm::vec4> params(num_lights);
+  for (unsigned int i = 0; i < num_lights; i++) {
+    staging[i] = glm::vec4(lights.x[i], lights.y[i], lights.z[i], LIGHT_DIR_UP);
+    params[i] = glm::vec4(0.0f, lights.y[i], lights.y[i], 0.0f);
+  }
+  for (unsigned int i = 0; i < animators.index.size(); i++) {
+    unsigned int light = animators.light[i];
+    staging[light].w = animators.dir[i];
+    params[light] = glm::vec4(animators.speed[i], animators.min_y[i], animators.max_y[i], 0.0f);
+  }
+  // no previous step yet, both are the initial state
+  for (int i = 0; i < 2; i++) {
+    glBindBuffer(GL_ARRAY_BUFFER, state_vbo[i]);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, num_lights * sizeof(glm::vec4), staging.data());
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, params_vbo);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, num_lights * sizeof(glm::vec4), params.data());
+
+  for (unsigned int i = 0; i < num_lights; i++) {
+    params[i] = glm::vec4(lights.color[i], light_radius(lights.color[i]));
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, attribute_vbo);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, num_lights * sizeof(glm::vec4), params.data());
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  last_upload = 4 * num_lights * sizeof(glm::vec4);
+}
+
+void LightBuffers::gather_positions(const Scene& scene, std::vector<glm::vec4>& positions) {
+  const LightComponents& lights = scene.lights;
+  positions.resize(lights.index.size());
+  for (unsigned int i = 0; i < positions.size(); i++) {
+    positions[i] = glm::vec4(lights.x[i], lights.y[i], lights.z[i], 0.0f);
+  }
+}
+
+void LightBuffers::upload_step(const std::vector<glm::vec4>& positions) {
+  last_upload = 0;
+  // lights were added or removed without init
+  if (positions.size() != num_lights || num_lights == 0) return;
+  // the current step becomes the previous one
+  glBindBuffer(GL_ARRAY_BUFFER, state_vbo[1 - current]);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, num_lights * sizeof(glm::vec4), positions.data());
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  current = 1 - current;
+  last_upload = num_lights * sizeof(glm::vec4);
+}
+
+void LightBuffers::animate_step(float dt) {
+  last_upload = 0;
+  if (num_lights == 0) return;
+  // one point per light, captured into the other state buffer and never rasterized
+  animate_shader->use();
+  animate_shader->set_float("dt", dt);
+  gl_set_enabled(GL_RASTERIZER_DISCARD, true);
+  gl_bind_vertex_array(animate_vao[current]);
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, state_vbo[1 - current]);
+  glBeginTransformFeedback(GL_POINTS);
+  glDrawArrays(GL_POINTS, 0, num_lights);
+  glEndTransformFeedback();
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+  gl_set_enabled(GL_RASTERIZER_DISCARD, false);
+  current = 1 - current;
+}
+
+void LightBuffers::set_gpu_animation(bool enabled, Scene& scene) {
+  if (enabled == gpu) return;
+  gpu = enabled;
+  if (gpu) {
+    // the GPU continues from the scene's current positions and directions
+    init(scene);
+    return;
+  }
+  if (scene.lights.index.size() != num_lights) return;
+
+  // stalls until the last animation step is done, acceptable for a mode switch
+  glBindBuffer(GL_ARRAY_BUFFER, state_vbo[current]);
+  glGetBufferSubData(GL_ARRAY_BUFFER, 0, num_lights * sizeof(glm::vec4), staging.data());
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  for (unsigned int i = 0; i < num_lights; i++) {
+    scene.lights.y[i] = staging[i].y;
+  }
+  AnimatorComponents& animators = scene.animators;
+  for (unsigned int i = 0; i < animators.index.size(); i++) {
+    animators.y[i] = staging[animators.light[i]].y;
+    animators.dir[i] = staging[animators.light[i]].w;
+  }
+}
+
+void LightBuffers::bind_textures(unsigned int unit) const {
+  gl_bind_texture(unit, GL_TEXTURE_BUFFER, state_texture[1 - current]);
+  gl_bind_texture(unit + 1, GL_TEXTURE_BUFFER, state_texture[current]);
+  gl_bind_texture(unit + 2, GL_TEXTURE_BUFFER, attribute_texture);
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "scene.h"
+#include "shader.h"
+
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <vector>
+
+// attenuation of every point light, 1 / (1 + linear * d + quadratic * d^2)
+#define LIGHT_ATTENUATION_LINEAR 0.7f
+#define LIGHT_ATTENUATION_QUADRATIC 1.8f
+
+// GPU copy of the scene lights, read as buffer textures by the lighting pass and per instance
+// by the light cubes. The two most recent simulation steps are kept so that frames can
+// interpolate between them. Positions are either animated on the CPU and uploaded every step,
+// or animated on the GPU by transform feedback from one state buffer into the other, in which
+// case nothing is uploaded after init.
+class LightBuffers {
+public:
+  LightBuffers();
+  ~LightBuffers();
+  // upload every light and animator of scene, again whenever lights are added or removed
+  void init(const Scene& scene);
+  // positions of the scene's lights as upload_step takes them. Touches no GL state, so it can
+  // run while another thread submits the frame.
+  static void gather_positions(const Scene& scene, std::vector<glm::vec4>& positions);
+  // record the next simulation step from positions gathered after the animators ran
+  void upload_step(const std::vector<glm::vec4>& positions);
+  // with GPU animation, advance the lights by dt on the GPU instead
+  void animate_step(float dt);
+  // switch where the animators run. Going back to the CPU reads the positions back into scene.
+  void set_gpu_animation(bool enabled, Scene& scene);
+  bool gpu_animation() const {
+    return gpu;
+  }
+  // bind the previous positions, the positions and the attributes as buffer textures to
+  // texture units unit, unit + 1 and unit + 2
+  void bind_textures(unsigned int unit) const;
+  // vec4 per light, position in xyz as of the last step
+  unsigned int position_buffer() const {
+    return state_vbo[current];
+  }
+  // same as of the step before, equal to position_buffer right after init
+  unsigned int previous_position_buffer() const {
+    return state_vbo[1 - current];
+  }
+  // vec4 per light, color in rgb and radius of influence in a
+  unsigned int attribute_buffer() const {
+    return attribute_vbo;
+  }
+  unsigned int count() const {
+    return num_lights;
+  }
+  // bytes sent to the GPU by the last step
+  size_t uploaded_bytes() const {
+    return last_upload;
+  }
+
+private:
+  // vec4(x, y, z, dir) per light, a step reads state_vbo[current] and writes the other
+  unsigned int state_vbo[2], state_texture[2];
+  // vec4(speed, min_y, max_y, 0) per light, min_y == max_y for lights that do not move
+  unsigned int params_vbo;
+  unsigned int attribute_vbo, attribute_texture;
+  // sources the animation from state_vbo[i] and params_vbo
+  unsigned int animate_vao[2];
+  unsigned int current = 0;
+  unsigned int num_lights = 0;
+  bool gpu = false;
+  size_t last_upload = 0;
+  std::vector<glm::vec4> staging;
+  Shader* animate_shader = nullptr;
+  // (re)allocate every buffer for count lights
+  void allocate(unsigned int count);
+};
+
+// distance at which a light of color no longer lights up anything noticeably
+float light_radius(const glm::vec3& color);
@@ -1,11 +1,33 @@
-
+#include "job_system.h"
+#include "light_animation.h"
 #include "renderer.h"
 
+#include <cstring>
 #include <iostream>
 
-int main() {
+int main(int argc, char** argv) {
+  job_system_init();
+  // micro-benchmarks and tests run without opening a window
+  if (argc > 1 && strcmp(argv[1], "--bench-lights") == 0) {
+    benchmark_light_animation();
+    job_system_shutdown();
+    return 0;
+  }
+  if (argc > 1 && strcmp(argv[1], "--bench-jobs") == 0) {
+    benchmark_job_system();
+    job_system_shutdown();
+    return 0;
+  }
+  if (argc > 1 && strcmp(argv[1], "--stress-jobs") == 0) {
+    bool passed = stress_test_job_system();
+    job_system_shutdown();
+    return passed ? 0 : 1;
+  }
   Renderer* renderer = Renderer::get_instance();
   renderer->loop();
+  // release the GL objects while the context is alive, reporting the leaked ones
+  Renderer::destroy();
 
+  job_system_shutdown();
   return 0;
 }
\ No newline at end of file
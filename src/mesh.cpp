@@ -1,6 +1,11 @@
 #include "mesh.h"
 
+#include "command_buffer.h"
+#include "frame_arena.h"
+#include "gl_state.h"
 #include "stb_image.h"
+#include "texture_arrays.h"
+#include "uniform_ring.h"
 
 // clang-format off
 #include <glad/glad.h>
@@ -10,64 +15,398 @@
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
+#include <cmath>
+#include <cstdio>
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
 #include <iostream>
 
+// fraction of the error budget a coarser level must fit in before switching to it
+#define LOD_HYSTERESIS 0.75f
+
+unsigned int vertex_size(VertexFormat format) {
+  return format == VERTEX_FORMAT_COMPACT ? sizeof(CompactVertex) : sizeof(Vertex);
+}
+
+static float sign_not_zero(float v) {
+  return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+// map a unit vector onto the octahedron, folded into the [-1, 1] square
+static glm::vec2 oct_encode(const glm::vec3& n) {
+  float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+  if (l1 == 0.0f) return glm::vec2(0.0f, 0.0f);
+  glm::vec2 p(n.x / l1, n.y / l1);
+  if (n.z < 0.0f) {
+    p = glm::vec2(
+      (1.0f - std::fabs(p.y)) * sign_not_zero(p.x), (1.0f - std::fabs(p.x)) * sign_not_zero(p.y));
+  }
+  return p;
+}
+
+static int16_t pack_snorm16(float v) {
+  v = std::fmin(std::fmax(v, -1.0f), 1.0f);
+  return (int16_t)std::lround(v * 32767.0f);
+}
+
+static uint16_t pack_unorm16(float v) {
+  v = std::fmin(std::fmax(v, 0.0f), 1.0f);
+  return (uint16_t)std::lround(v * 65535.0f);
+}
+
+void compact_vertices(
+  const Vertex* vertices,
+  unsigned int num_vertices,
+  const glm::vec3& pos_offset,
+  const glm::vec3& pos_scale,
+  CompactVertex* out) {
+  for (unsigned int i = 0; i < num_vertices; i++) {
+    const Vertex& v = vertices[i];
+    CompactVertex& c = out[i];
+    for (int axis = 0; axis < 3; axis++) {
+      float extent = pos_scale[axis];
+      c.position[axis] =
+        extent > 0.0f ? pack_unorm16((v.position[axis] - pos_offset[axis]) / extent) : 0;
+    }
+    c.padding = 0;
+    glm::vec2 oct = oct_encode(v.normal);
+    c.normal[0] = pack_snorm16(oct.x);
+    c.normal[1] = pack_snorm16(oct.y);
+    c.texCoords[0] = glm::packHalf1x16(v.texCoords.x);
+    c.texCoords[1] = glm::packHalf1x16(v.texCoords.y);
+  }
+}
+
+bool fits_short_indices(unsigned int num_vertices) {
+  return num_vertices <= 65536;
+}
+
+void compute_bounds(
+  const Vertex* vertices,
+  unsigned int num_vertices,
+  glm::vec3& center,
+  float& radius) {
+  glm::vec3 lo(0.0f), hi(0.0f);
+  if (num_vertices > 0) lo = hi = vertices[0].position;
+  for (unsigned int i = 0; i < num_vertices; i++) {
+    lo = glm::min(lo, vertices[i].position);
+    hi = glm::max(hi, vertices[i].position);
+  }
+  center = (lo + hi) * 0.5f;
+  radius = 0.0f;
+  for (unsigned int i = 0; i < num_vertices; i++)
+    radius = std::fmax(radius, glm::length(vertices[i].position - center));
+}
+
 // Mesh class
 Mesh::Mesh(
-  std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures) {
+  std::vector<Vertex> vertices,
+  std::vector<unsigned int> indices,
+  std::vector<Texture> textures,
+  VertexFormat format,
+  std::vector<MeshLod> lods,
+  std::vector<Meshlet> meshlets) {
   this->vertices = vertices;
   this->indices = indices;
   this->textures = textures;
-  setupMesh();
+  if (lods.empty()) {
+    MeshLod lod = { 0, (unsigned int)indices.size(), 0.0f };
+    lods.push_back(lod);
+  }
+
+  MeshBuffers buffers;
+  buffers.vertex_data = this->vertices.data();
+  buffers.num_vertices = this->vertices.size();
+  buffers.format = format;
+  buffers.pos_offset = glm::vec3(0.0f);
+  buffers.pos_scale = glm::vec3(1.0f);
+  buffers.index_data = this->indices.data();
+  buffers.num_indices = this->indices.size();
+  buffers.index_size = sizeof(unsigned int);
+  buffers.lods = lods.data();
+  buffers.num_lods = lods.size();
+  buffers.meshlets = meshlets.data();
+  buffers.num_meshlets = meshlets.size();
+  compute_bounds(vertices.data(), vertices.size(), buffers.center, buffers.radius);
+
+  std::vector<CompactVertex> compact;
+  if (format == VERTEX_FORMAT_COMPACT) {
+    // quantize relative to the bounds of the mesh
+    glm::vec3 lo(0.0f), hi(0.0f);
+    if (!vertices.empty()) lo = hi = vertices[0].position;
+    for (const Vertex& v : vertices) {
+      lo = glm::min(lo, v.position);
+      hi = glm::max(hi, v.position);
+    }
+    buffers.pos_offset = lo;
+    buffers.pos_scale = hi - lo;
+    compact.resize(vertices.size());
+    compact_vertices(
+      vertices.data(), vertices.size(), buffers.pos_offset, buffers.pos_scale, compact.data());
+    buffers.vertex_data = compact.data();
+  }
+
+  std::vector<uint16_t> short_indices;
+  if (fits_short_indices(vertices.size())) {
+    short_indices.assign(indices.begin(), indices.end());
+    buffers.index_data = short_indices.data();
+    buffers.index_size = sizeof(uint16_t);
+  }
+  setupMesh(buffers);
+}
+
+Mesh::Mesh(const MeshBuffers& buffers, std::vector<Texture> textures) {
+  this->textures = textures;
+  setupMesh(buffers);
 }
 
-void Mesh::setupMesh() {
-  glGenVertexArrays(1, &vao);
-  glGenBuffers(1, &vbo);
-  glGenBuffers(1, &ebo);
+void Mesh::setupMesh(const MeshBuffers& buffers) {
+  vertex_count = buffers.num_vertices;
+  index_count = buffers.num_indices;
+  index_type = buffers.index_size == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+  format = buffers.format;
+  pos_offset = buffers.pos_offset;
+  pos_scale = buffers.pos_scale;
+  lods.assign(buffers.lods, buffers.lods + buffers.num_lods);
+  center = buffers.center;
+  radius = buffers.radius;
+  meshlets.assign(buffers.meshlets, buffers.meshlets + buffers.num_meshlets);
+  meshlet_bounds.assign(meshlets.data(), meshlets.size());
 
-  glBindVertexArray(vao);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+  vertex_array = gpu_create(GPU_VERTEX_ARRAY, "mesh vertex array");
+  vertex_buffer = gpu_create(GPU_BUFFER, "mesh vertices");
+  index_buffer = gpu_create(GPU_BUFFER, "mesh indices");
+
+  gl_bind_vertex_array(gpu_name(vertex_array));
+  glBindBuffer(GL_ARRAY_BUFFER, gpu_name(vertex_buffer));
+  glBufferData(
+    GL_ARRAY_BUFFER,
+    buffers.num_vertices * vertex_size(format),
+    buffers.vertex_data,
+    GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpu_name(index_buffer));
   glBufferData(
-    GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+    GL_ELEMENT_ARRAY_BUFFER,
+    buffers.num_indices * buffers.index_size,
+    buffers.index_data,
+    GL_STATIC_DRAW);
 
-  // vertex positions
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(
-    2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoords));
+  if (format == VERTEX_FORMAT_COMPACT) {
+    // normalized integers are expanded by the vertex fetch, the shader only rescales.
+    // octahedral normals go to location 3 instead of 1.
+    GLsizei stride = sizeof(CompactVertex);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)0);
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(
+      3, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(CompactVertex, normal));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(
+      2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(CompactVertex, texCoords));
+  } else {
+    // vertex positions
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(
+      1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(
+      2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texCoords));
+  }
 
   // release the bind
-  glBindVertexArray(0);
+  gl_bind_vertex_array(0);
+}
+
+ObjectConstants Mesh::objectConstants(const glm::mat4& model, bool instanced) const {
+  ObjectConstants constants;
+  constants.model = model;
+  constants.pos_offset = glm::vec4(pos_offset, 0.0f);
+  constants.pos_scale = glm::vec4(pos_scale, 0.0f);
+  constants.oct_normals = format == VERTEX_FORMAT_COMPACT;
+  constants.instanced = instanced;
+  constants.material_index = material;
+  constants.padding = 0;
+  return constants;
+}
+
+void Mesh::bindTextures(Shader& shader, const glm::mat4& model, bool instanced) {
+  uniform_ring_push(OBJECT_BLOCK_BINDING, objectConstants(model, instanced));
+  if (material >= 0) texture_arrays->bind(material);
+  bindMeshTextures(shader);
 }
 
-void Mesh::Draw(Shader shader) {
+void Mesh::bindMeshTextures(Shader& shader) const {
   unsigned int diffuseCount = 1;
   unsigned int specularCount = 1;
   unsigned int normalCount = 1;
   unsigned int heightCount = 1;
   for (unsigned int i = 0; i < textures.size(); i++) {
-    glActiveTexture(GL_TEXTURE0 + i);
-    std::string number;
-    std::string name = textures[i].type;
+    unsigned int number = 0;
+    const std::string& name = textures[i].type;
     if (name == "texture_diffuse")
-      number = std::to_string(diffuseCount++);
+      number = diffuseCount++;
     else if (name == "texture_specular")
-      number = std::to_string(specularCount++);
+      number = specularCount++;
     else if (name == "texture_normal")
-      number = std::to_string(normalCount++); // transfer unsigned int to stream
+      number = normalCount++;
     else if (name == "texture_height")
-      number = std::to_string(heightCount++); // transfer unsigned int to stream
-    shader.set_int(("material." + name + number).c_str(), i);
-    glBindTexture(GL_TEXTURE_2D, textures[i].id);
+      number = heightCount++;
+    // the uniform name only lives for this frame
+    FrameString uniform = "material.";
+    uniform += name.c_str();
+    if (number > 0) {
+      char digits[16];
+      snprintf(digits, sizeof(digits), "%u", number);
+      uniform += digits;
+    }
+    shader.set_int(uniform.c_str(), i);
+    gl_bind_texture(i, GL_TEXTURE_2D, gpu_name(textures[i].handle));
   }
-  glBindVertexArray(vao);
-  glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-  glBindVertexArray(0);
+}
+
+void Mesh::Draw(Shader shader, const glm::mat4& model) {
+  Draw(shader, MeshDraw(), model);
+}
+
+void Mesh::Draw(Shader shader, const MeshDraw& draw, const glm::mat4& model) {
+  unsigned int vao = gpu_name(vertex_array);
+  if (!vao) return;
+  bindTextures(shader, model, false);
+  gl_bind_vertex_array(vao);
+  if (draw.culled && draw.lod == 0) {
+    if (!draw.counts.empty()) {
+      glMultiDrawElements(
+        GL_TRIANGLES, draw.counts.data(), index_type, draw.offsets.data(), draw.counts.size());
+    }
+  } else {
+    const MeshLod& lod = lods[draw.lod];
+    glDrawElements(GL_TRIANGLES, lod.index_count, index_type, index_pointer(lod.index_offset));
+  }
+}
+
+void Mesh::recordDraw(CommandBuffer& commands, const MeshDraw& draw, const glm::mat4& model) const {
+  unsigned int vao = gpu_name(vertex_array);
+  if (!vao) return;
+  commands.push_constants(OBJECT_BLOCK_BINDING, objectConstants(model, false));
+  if (material >= 0) texture_arrays->record_bind(commands, material);
+  if (!textures.empty()) commands.bind_mesh_textures(this);
+  commands.bind_vertex_array(vao);
+  if (draw.culled && draw.lod == 0) {
+    if (!draw.counts.empty()) {
+      commands.multi_draw_elements(
+        index_type, draw.counts.data(), draw.offsets.data(), draw.counts.size());
+    }
+  } else {
+    const MeshLod& lod = lods[draw.lod];
+    commands.draw_elements(lod.index_count, index_type, index_pointer(lod.index_offset));
+  }
+}
+
+void Mesh::DrawInstanced(Shader shader, unsigned int count, const glm::mat4& model) {
+  unsigned int vao = gpu_name(vertex_array);
+  if (!vao) return;
+  bindTextures(shader, model, true);
+  gl_bind_vertex_array(vao);
+  glDrawElementsInstanced(
+    GL_TRIANGLES, lods[0].index_count, index_type, index_pointer(lods[0].index_offset), count);
+}
+
+void Mesh::setInstanceBuffer(unsigned int instance_vbo) {
+  gl_bind_vertex_array(gpu_name(vertex_array));
+  glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+  // a mat4 attribute takes one location per column
+  for (unsigned int column = 0; column < 4; column++) {
+    glEnableVertexAttribArray(4 + column);
+    glVertexAttribPointer(
+      4 + column,
+      4,
+      GL_FLOAT,
+      GL_FALSE,
+      sizeof(glm::mat4),
+      (void*)(column * sizeof(glm::vec4)));
+    glVertexAttribDivisor(4 + column, 1);
+  }
+  gl_bind_vertex_array(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+const void* Mesh::index_pointer(unsigned int index) const {
+  size_t index_size = index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+  return (const void*)(index * index_size);
+}
+
+void Mesh::cullMeshlets(
+  MeshDraw& draw,
+  const glm::mat4& mvp,
+  const glm::vec3& camera_pos,
+  bool cull_backfacing) const {
+  draw.culled = !meshlets.empty();
+  draw.counts.clear();
+  draw.offsets.clear();
+  draw.visible_triangles = 0;
+  if (!draw.culled) return;
+
+  glm::vec4 planes[6];
+  extract_frustum_planes(mvp, planes);
+  FrameVector<unsigned char> visible(meshlets.size());
+  cull_meshlets(
+    meshlet_bounds, meshlets.size(), planes, camera_pos, cull_backfacing, visible.data());
+
+  // meshlets are consecutive in the index buffer, so runs of visible ones merge into one draw
+  for (size_t i = 0; i < meshlets.size(); i++) {
+    if (!visible[i]) continue;
+    const Meshlet& meshlet = meshlets[i];
+    draw.visible_triangles += meshlet.index_count / 3;
+    if (i > 0 && visible[i - 1]) {
+      draw.counts.back() += meshlet.index_count;
+    } else {
+      draw.counts.push_back(meshlet.index_count);
+      draw.offsets.push_back(index_pointer(meshlet.index_offset));
+    }
+  }
+}
+
+void Mesh::selectLod(
+  MeshDraw& draw,
+  const glm::mat4& model_matrix,
+  float model_scale,
+  const glm::vec3& camera_pos,
+  float pixels_per_unit,
+  float max_error_pixels) const {
+  // nearest point of the bounding sphere, clamped so the camera inside it gets full detail
+  glm::vec3 world_center = glm::vec3(model_matrix * glm::vec4(center, 1.0f));
+  float distance = glm::length(world_center - camera_pos) - radius * model_scale;
+  float pixels = distance > 1e-4f ? model_scale * pixels_per_unit / distance : 1e30f;
+
+  // coarsest level within the budget, levels are sorted by increasing error
+  unsigned int wanted = 0;
+  while (wanted + 1 < lods.size() && lods[wanted + 1].error * pixels <= max_error_pixels)
+    wanted++;
+  if (wanted > draw.lod) {
+    // only coarsen once the level is well inside the budget, so meshes at the threshold
+    // distance do not flip between levels every frame
+    unsigned int coarser = draw.lod;
+    while (coarser + 1 <= wanted &&
+           lods[coarser + 1].error * pixels <= max_error_pixels * LOD_HYSTERESIS)
+      coarser++;
+    draw.lod = coarser;
+  } else {
+    draw.lod = wanted;
+  }
+}
+
+void Mesh::release() {
+  gpu_destroy(vertex_array);
+  gpu_destroy(vertex_buffer);
+  gpu_destroy(index_buffer);
+}
+
+unsigned int Mesh::triangleCount(const MeshDraw& draw) const {
+  return lods[draw.lod].index_count / 3;
+}
+
+unsigned int Mesh::visibleTriangleCount(const MeshDraw& draw) const {
+  return draw.culled && draw.lod == 0 ? draw.visible_triangles : triangleCount(draw);
 }
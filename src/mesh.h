@@ -1,33 +1,196 @@
 #pragma once
+#include <cstdint>
 #include <glm/glm.hpp>
 #include <string>
 #include <vector>
+#include "gpu_resources.h"
+#include "meshlet.h"
 #include "shader.h"
+#include "uniform_ring.h"
 #include <assimp/scene.h>
 
+class CommandBuffer;
+class TextureArrays;
+
 struct Vertex {
   glm::vec3 position;
   glm::vec3 normal;
   glm::vec2 texCoords;
 };
 
+// GPU-side vertex layouts a model can be uploaded in
+enum VertexFormat {
+  // 32 bytes, Vertex as-is
+  VERTEX_FORMAT_FULL = 0,
+  // 16 bytes, CompactVertex
+  VERTEX_FORMAT_COMPACT = 1,
+};
+
+// Quantized vertex: position as 16-bit unorm relative to the mesh bounds, normal
+// octahedron-encoded in 2x16-bit snorm, texture coordinates as half floats.
+struct CompactVertex {
+  uint16_t position[3];
+  uint16_t padding;
+  int16_t normal[2];
+  uint16_t texCoords[2];
+};
+
+// bytes per vertex of a format
+unsigned int vertex_size(VertexFormat format);
+// quantize vertices to VERTEX_FORMAT_COMPACT. position = pos_offset + unorm * pos_scale.
+void compact_vertices(
+  const Vertex* vertices,
+  unsigned int num_vertices,
+  const glm::vec3& pos_offset,
+  const glm::vec3& pos_scale,
+  CompactVertex* out);
+
+// One level of detail: a range of the shared index buffer. All levels index the same
+// vertices, coarser levels follow the finer ones.
+struct MeshLod {
+  unsigned int index_offset;
+  unsigned int index_count;
+  // geometric deviation from the full-detail mesh, in model units
+  float error;
+};
+
+// Mesh data living outside the Mesh (e.g. in a mapped mesh cache), uploaded as-is
+struct MeshBuffers {
+  // num_vertices vertices laid out in format
+  const void* vertex_data;
+  unsigned int num_vertices;
+  VertexFormat format;
+  // dequantization of compact positions
+  glm::vec3 pos_offset, pos_scale;
+  // num_indices indices of index_size (2 or 4) bytes each
+  const void* index_data;
+  unsigned int num_indices;
+  unsigned int index_size;
+  // num_lods ranges into the indices, finest first
+  const MeshLod* lods;
+  unsigned int num_lods;
+  // bounding sphere in model space
+  glm::vec3 center;
+  float radius;
+  // num_meshlets clusters of the finest level
+  const Meshlet* meshlets;
+  unsigned int num_meshlets;
+};
+
+// Level of detail and culling result of one placement of a mesh, chosen by selectLod and
+// cullMeshlets. Also what Draw submits for it in one frame, so that a frame can be drawn from
+// a copy while the next one is being prepared.
+struct MeshDraw {
+  unsigned int lod = 0;
+  // with culled set, the finest level is drawn as these index ranges of visible meshlets
+  bool culled = false;
+  std::vector<int> counts;
+  std::vector<const void*> offsets;
+  unsigned int visible_triangles = 0;
+};
+
 struct Texture {
-  unsigned int id;
+  GpuHandle handle;
   std::string type;
   std::string path; // need this because we want to compare strings to see if we are trying to load the same texture.
 };
 
+// Copies of a Mesh share its GPU objects, release() on any of them deletes them for all. What
+// differs between placements of a mesh is kept in a MeshDraw per placement.
 class Mesh {
 public:
-  unsigned int vao;
+  GpuHandle vertex_array;
   std::vector<Vertex> vertices;
   std::vector<unsigned int> indices;
   std::vector<Texture> textures;
-  Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures);
-  void Draw(Shader shader);
+  unsigned int vertex_count;
+  unsigned int index_count;
+  // GL_UNSIGNED_SHORT when every index fits 16 bits, GL_UNSIGNED_INT otherwise
+  unsigned int index_type;
+  VertexFormat format;
+  // dequantization of compact positions, identity for full vertices
+  glm::vec3 pos_offset, pos_scale;
+  // node of the owning Model this mesh is attached to
+  int node = 0;
+  // levels of detail, finest first
+  std::vector<MeshLod> lods;
+  // bounding sphere in model space
+  glm::vec3 center;
+  float radius;
+  // clusters of the finest level, culled by cullMeshlets
+  std::vector<Meshlet> meshlets;
+  // index into texture_arrays of the maps to draw with, -1 to bind textures instead
+  int material = -1;
+  TextureArrays* texture_arrays = nullptr;
+  // lods empty means a single level covering all indices
+  Mesh(
+    std::vector<Vertex> vertices,
+    std::vector<unsigned int> indices,
+    std::vector<Texture> textures,
+    VertexFormat format = VERTEX_FORMAT_FULL,
+    std::vector<MeshLod> lods = std::vector<MeshLod>(),
+    std::vector<Meshlet> meshlets = std::vector<Meshlet>());
+  // upload straight from caller-owned memory, no CPU-side copy is kept
+  Mesh(const MeshBuffers& buffers, std::vector<Texture> textures);
+  // draw the finest level with the model matrix model, pushed to the uniform ring with the
+  // other per-draw constants
+  void Draw(Shader shader, const glm::mat4& model);
+  // draw the level and the visible meshlets of draw
+  void Draw(Shader shader, const MeshDraw& draw, const glm::mat4& model);
+  // record what Draw(shader, draw, model) would issue, without touching GL. Safe on any thread
+  // as long as nothing changes the mesh meanwhile.
+  void recordDraw(CommandBuffer& commands, const MeshDraw& draw, const glm::mat4& model) const;
+  // bind the textures of a mesh not drawing from texture arrays and point the material
+  // samplers of shader at them
+  void bindMeshTextures(Shader& shader) const;
+  // draw the finest level count times, per-instance model matrices coming from the buffer
+  // set with setInstanceBuffer. model places the mesh relative to the instance matrices.
+  void DrawInstanced(Shader shader, unsigned int count, const glm::mat4& model);
+  // source vertex attributes 4-7 (one mat4 per instance) from an instance buffer
+  void setInstanceBuffer(unsigned int instance_vbo);
+  // set draw.lod to the coarsest level whose error projects to at most max_error_pixels.
+  // model_matrix must be a uniform scale of model_scale, pixels_per_unit is the screen
+  // size of one world unit at distance 1.
+  void selectLod(
+    MeshDraw& draw,
+    const glm::mat4& model_matrix,
+    float model_scale,
+    const glm::vec3& camera_pos,
+    float pixels_per_unit,
+    float max_error_pixels) const;
+  // cull the meshlets of the finest level against the frustum of mvp and, with
+  // cull_backfacing, against camera_pos in model space. Draw then only submits the visible
+  // ones of draw; coarser levels and meshes without meshlets are drawn whole. Clearing
+  // draw.culled draws every meshlet again.
+  void cullMeshlets(
+    MeshDraw& draw,
+    const glm::mat4& mvp,
+    const glm::vec3& camera_pos,
+    bool cull_backfacing) const;
+  // delete the vertex array and buffers, every copy draws nothing afterwards. The textures
+  // belong to the Model.
+  void release();
+  // triangles of the level of draw, and of those the ones surviving meshlet culling
+  unsigned int triangleCount(const MeshDraw& draw) const;
+  unsigned int visibleTriangleCount(const MeshDraw& draw) const;
 private:
-  unsigned int vbo, ebo;
-  void setupMesh();
+  GpuHandle vertex_buffer, index_buffer;
+  MeshletBounds meshlet_bounds;
+  void setupMesh(const MeshBuffers& buffers);
+  // bind the textures and push the per-draw constants
+  void bindTextures(Shader& shader, const glm::mat4& model, bool instanced);
+  ObjectConstants objectConstants(const glm::mat4& model, bool instanced) const;
+  // byte offset of an index in the element buffer, as glDrawElements expects it
+  const void* index_pointer(unsigned int index) const;
 };
 
+// whether a mesh with this many vertices can use 16-bit indices
+bool fits_short_indices(unsigned int num_vertices);
+// bounding sphere of the vertex positions (center of the box, farthest vertex)
+void compute_bounds(
+  const Vertex* vertices,
+  unsigned int num_vertices,
+  glm::vec3& center,
+  float& radius);
+
 
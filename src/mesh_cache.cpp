@@ -0,0 +1,353 @@
+#include "mesh_cache.h"
+
+#include "file_map.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// On-disk layout, all offsets are in bytes from the start of the file:
+//   CacheHeader
+//   CacheTexture[num_textures]   texture table, strings live in the string blob
+//   CacheNode[num_nodes]         node hierarchy, parent-before-child
+//   CacheMesh[num_meshes]        submesh table
+//   (vertices are stored in the model's VertexFormat)
+//   uint32_t[num_texture_refs]   per-mesh indices into the texture table
+//   CacheLod[num_lods]           per-mesh level of detail ranges
+//   Meshlet[num_meshlets]        per-mesh clusters of the finest level
+//   char[strings_size]           string blob
+//   vertex and index data, 16 byte aligned per mesh
+// Every table starts 8 byte aligned so it can be read in place out of the mapping.
+static const char CACHE_MAGIC[4] = { 'M', 'S', 'H', 'C' };
+
+struct CacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t source_mtime;
+  uint64_t source_size;
+  uint32_t vertex_format;
+  uint32_t num_textures;
+  uint32_t num_nodes;
+  uint32_t num_meshes;
+  uint32_t num_texture_refs;
+  uint32_t num_lods;
+  uint32_t num_meshlets;
+  uint32_t strings_size;
+};
+
+struct CacheTexture {
+  uint32_t type_offset, type_length;
+  uint32_t path_offset, path_length;
+};
+
+struct CacheNode {
+  int32_t parent;
+  // column major
+  float transform[16];
+};
+
+struct CacheMesh {
+  uint64_t vertex_offset;
+  uint64_t index_offset;
+  uint32_t num_vertices;
+  uint32_t num_indices;
+  // 2 or 4 bytes per index
+  uint32_t index_size;
+  uint32_t first_texture_ref;
+  uint32_t num_texture_refs;
+  float pos_offset[3];
+  float pos_scale[3];
+  uint32_t first_lod;
+  uint32_t num_lods;
+  float center[3];
+  float radius;
+  uint32_t first_meshlet;
+  uint32_t num_meshlets;
+  uint32_t node;
+};
+
+struct CacheLod {
+  uint32_t index_offset;
+  uint32_t index_count;
+  float error;
+};
+
+static uint64_t align8(uint64_t offset) {
+  return (offset + 7) & ~(uint64_t)7;
+}
+
+static uint64_t align16(uint64_t offset) {
+  return (offset + 15) & ~(uint64_t)15;
+}
+
+// file offsets of the tables following the header, and the end of the string blob
+struct CacheTables {
+  uint64_t textures, nodes, meshes, refs, lods, meshlets, strings, end;
+};
+
+static CacheTables cache_tables(const CacheHeader& header) {
+  CacheTables t;
+  t.textures = align8(sizeof(CacheHeader));
+  t.nodes = align8(t.textures + (uint64_t)header.num_textures * sizeof(CacheTexture));
+  t.meshes = align8(t.nodes + (uint64_t)header.num_nodes * sizeof(CacheNode));
+  t.refs = align8(t.meshes + (uint64_t)header.num_meshes * sizeof(CacheMesh));
+  t.lods = align8(t.refs + (uint64_t)header.num_texture_refs * sizeof(uint32_t));
+  t.meshlets = align8(t.lods + (uint64_t)header.num_lods * sizeof(CacheLod));
+  t.strings = align8(t.meshlets + (uint64_t)header.num_meshlets * sizeof(Meshlet));
+  t.end = t.strings + header.strings_size;
+  return t;
+}
+
+std::string mesh_cache_path(const std::string& source_path) {
+  return source_path + ".meshcache";
+}
+
+bool mesh_cache_load(const std::string& source_path, Model& model) {
+  uint64_t source_mtime, source_size;
+  if (!file_stat(source_path, &source_mtime, &source_size)) return false;
+
+  MappedFile file(mesh_cache_path(source_path));
+  if (!file.is_open() || file.size() < sizeof(CacheHeader)) return false;
+  const unsigned char* base = file.data();
+  const CacheHeader* header = (const CacheHeader*)base;
+  if (
+    memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+    header->version != MESH_CACHE_VERSION || header->source_mtime != source_mtime ||
+    header->source_size != source_size || header->vertex_format != model.vertex_format) {
+    return false;
+  }
+  unsigned int stride = vertex_size(model.vertex_format);
+
+  CacheTables tables = cache_tables(*header);
+  if (tables.end > file.size()) return false;
+
+  const CacheTexture* textures = (const CacheTexture*)(base + tables.textures);
+  const CacheNode* nodes = (const CacheNode*)(base + tables.nodes);
+  const CacheMesh* meshes = (const CacheMesh*)(base + tables.meshes);
+  const uint32_t* refs = (const uint32_t*)(base + tables.refs);
+  const CacheLod* lods = (const CacheLod*)(base + tables.lods);
+  const Meshlet* meshlets = (const Meshlet*)(base + tables.meshlets);
+  const char* strings = (const char*)(base + tables.strings);
+
+  // validate everything before touching GL so a corrupt cache falls back cleanly
+  for (uint32_t i = 0; i < header->num_textures; i++) {
+    const CacheTexture& t = textures[i];
+    if (
+      (uint64_t)t.type_offset + t.type_length > header->strings_size ||
+      (uint64_t)t.path_offset + t.path_length > header->strings_size) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < header->num_nodes; i++) {
+    if (nodes[i].parent >= (int32_t)i) return false;
+  }
+  for (uint32_t i = 0; i < header->num_meshes; i++) {
+    const CacheMesh& m = meshes[i];
+    if (
+      m.node >= header->num_nodes ||
+      m.vertex_offset + (uint64_t)m.num_vertices * stride > file.size() ||
+      (m.index_size != sizeof(uint16_t) && m.index_size != sizeof(uint32_t)) ||
+      m.index_offset + (uint64_t)m.num_indices * m.index_size > file.size() ||
+      (uint64_t)m.first_texture_ref + m.num_texture_refs > header->num_texture_refs ||
+      m.num_lods == 0 || (uint64_t)m.first_lod + m.num_lods > header->num_lods ||
+      (uint64_t)m.first_meshlet + m.num_meshlets > header->num_meshlets) {
+      return false;
+    }
+    for (uint32_t j = 0; j < m.num_lods; j++) {
+      const CacheLod& lod = lods[m.first_lod + j];
+      if ((uint64_t)lod.index_offset + lod.index_count > m.num_indices) return false;
+    }
+    for (uint32_t j = 0; j < m.num_meshlets; j++) {
+      const Meshlet& meshlet = meshlets[m.first_meshlet + j];
+      if ((uint64_t)meshlet.index_offset + meshlet.index_count > m.num_indices) return false;
+    }
+  }
+  for (uint32_t i = 0; i < header->num_texture_refs; i++) {
+    if (refs[i] >= header->num_textures) return false;
+  }
+
+  // textures go through their own cooked cache
+  std::vector<Texture> loaded;
+  for (uint32_t i = 0; i < header->num_textures; i++) {
+    Texture texture;
+    texture.type = std::string(strings + textures[i].type_offset, textures[i].type_length);
+    texture.path = std::string(strings + textures[i].path_offset, textures[i].path_length);
+    unsigned int id = TextureFromFile(texture.path.c_str(), model.directory, texture.type);
+    texture.handle = gpu_adopt(GPU_TEXTURE, id, texture.path);
+    loaded.push_back(texture);
+  }
+  model.textures_loaded.insert(model.textures_loaded.end(), loaded.begin(), loaded.end());
+
+  for (uint32_t i = 0; i < header->num_nodes; i++) {
+    glm::mat4 transform;
+    memcpy(&transform[0][0], nodes[i].transform, sizeof(nodes[i].transform));
+    model.node_parents.push_back(nodes[i].parent < 0 ? -1 : nodes[i].parent);
+    model.node_transforms.push_back(transform);
+  }
+
+  model.meshes.reserve(model.meshes.size() + header->num_meshes);
+  for (uint32_t i = 0; i < header->num_meshes; i++) {
+    const CacheMesh& m = meshes[i];
+    std::vector<Texture> mesh_textures;
+    for (uint32_t j = 0; j < m.num_texture_refs; j++) {
+      mesh_textures.push_back(loaded[refs[m.first_texture_ref + j]]);
+    }
+    std::vector<MeshLod> mesh_lods;
+    for (uint32_t j = 0; j < m.num_lods; j++) {
+      const CacheLod& lod = lods[m.first_lod + j];
+      MeshLod mesh_lod = { lod.index_offset, lod.index_count, lod.error };
+      mesh_lods.push_back(mesh_lod);
+    }
+    MeshBuffers buffers;
+    buffers.vertex_data = base + m.vertex_offset;
+    buffers.num_vertices = m.num_vertices;
+    buffers.format = model.vertex_format;
+    buffers.pos_offset = glm::vec3(m.pos_offset[0], m.pos_offset[1], m.pos_offset[2]);
+    buffers.pos_scale = glm::vec3(m.pos_scale[0], m.pos_scale[1], m.pos_scale[2]);
+    buffers.index_data = base + m.index_offset;
+    buffers.num_indices = m.num_indices;
+    buffers.index_size = m.index_size;
+    buffers.lods = mesh_lods.data();
+    buffers.num_lods = mesh_lods.size();
+    buffers.center = glm::vec3(m.center[0], m.center[1], m.center[2]);
+    buffers.radius = m.radius;
+    buffers.meshlets = meshlets + m.first_meshlet;
+    buffers.num_meshlets = m.num_meshlets;
+    model.meshes.push_back(Mesh(buffers, mesh_textures));
+    model.meshes.back().node = m.node;
+  }
+  return true;
+}
+
+bool mesh_cache_write(const std::string& source_path, const Model& model) {
+  CacheHeader header;
+  memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  header.version = MESH_CACHE_VERSION;
+  header.vertex_format = model.vertex_format;
+  unsigned int stride = vertex_size(model.vertex_format);
+  if (!file_stat(source_path, &header.source_mtime, &header.source_size)) return false;
+
+  // texture table and string blob
+  std::vector<CacheTexture> textures;
+  std::string strings;
+  for (const Texture& texture : model.textures_loaded) {
+    CacheTexture t;
+    t.type_offset = strings.size();
+    t.type_length = texture.type.size();
+    strings += texture.type;
+    t.path_offset = strings.size();
+    t.path_length = texture.path.size();
+    strings += texture.path;
+    textures.push_back(t);
+  }
+
+  std::vector<CacheNode> nodes;
+  for (unsigned int i = 0; i < model.node_parents.size(); i++) {
+    CacheNode n;
+    n.parent = model.node_parents[i];
+    memcpy(n.transform, &model.node_transforms[i][0][0], sizeof(n.transform));
+    nodes.push_back(n);
+  }
+
+  // submesh table, references resolved against textures_loaded
+  std::vector<CacheMesh> meshes;
+  std::vector<uint32_t> refs;
+  std::vector<CacheLod> lods;
+  std::vector<Meshlet> meshlets;
+  for (const Mesh& mesh : model.meshes) {
+    CacheMesh m;
+    m.num_vertices = mesh.vertices.size();
+    m.num_indices = mesh.indices.size();
+    m.index_size = fits_short_indices(m.num_vertices) ? sizeof(uint16_t) : sizeof(uint32_t);
+    for (int axis = 0; axis < 3; axis++) {
+      m.pos_offset[axis] = mesh.pos_offset[axis];
+      m.pos_scale[axis] = mesh.pos_scale[axis];
+      m.center[axis] = mesh.center[axis];
+    }
+    m.radius = mesh.radius;
+    m.first_lod = lods.size();
+    m.num_lods = mesh.lods.size();
+    for (const MeshLod& lod : mesh.lods) {
+      CacheLod l = { lod.index_offset, lod.index_count, lod.error };
+      lods.push_back(l);
+    }
+    m.first_meshlet = meshlets.size();
+    m.num_meshlets = mesh.meshlets.size();
+    m.node = mesh.node;
+    meshlets.insert(meshlets.end(), mesh.meshlets.begin(), mesh.meshlets.end());
+    m.first_texture_ref = refs.size();
+    m.num_texture_refs = 0;
+    for (const Texture& texture : mesh.textures) {
+      for (uint32_t i = 0; i < model.textures_loaded.size(); i++) {
+        if (
+          model.textures_loaded[i].path == texture.path &&
+          model.textures_loaded[i].type == texture.type) {
+          refs.push_back(i);
+          m.num_texture_refs++;
+          break;
+        }
+      }
+    }
+    meshes.push_back(m);
+  }
+
+  header.num_textures = textures.size();
+  header.num_nodes = nodes.size();
+  header.num_meshes = meshes.size();
+  header.num_texture_refs = refs.size();
+  header.num_lods = lods.size();
+  header.num_meshlets = meshlets.size();
+  header.strings_size = strings.size();
+
+  // lay out the bulk data after the tables
+  CacheTables tables = cache_tables(header);
+  uint64_t offset = tables.end;
+  for (CacheMesh& m : meshes) {
+    m.vertex_offset = align16(offset);
+    m.index_offset = align16(m.vertex_offset + (uint64_t)m.num_vertices * stride);
+    offset = m.index_offset + (uint64_t)m.num_indices * m.index_size;
+  }
+
+  std::vector<FileChunk> chunks = {
+    { &header, sizeof(header), 0 },
+    { textures.data(), textures.size() * sizeof(CacheTexture), tables.textures },
+    { nodes.data(), nodes.size() * sizeof(CacheNode), tables.nodes },
+    { meshes.data(), meshes.size() * sizeof(CacheMesh), tables.meshes },
+    { refs.data(), refs.size() * sizeof(uint32_t), tables.refs },
+    { lods.data(), lods.size() * sizeof(CacheLod), tables.lods },
+    { meshlets.data(), meshlets.size() * sizeof(Meshlet), tables.meshlets },
+    { strings.data(), strings.size(), tables.strings },
+  };
+  // converted vertices and indices have to live until the file is written
+  std::vector<std::vector<CompactVertex>> compact(meshes.size());
+  std::vector<std::vector<uint16_t>> short_indices(meshes.size());
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    const Mesh& mesh = model.meshes[i];
+    const void* vertex_data = mesh.vertices.data();
+    if (model.vertex_format == VERTEX_FORMAT_COMPACT) {
+      compact[i].resize(mesh.vertices.size());
+      compact_vertices(
+        mesh.vertices.data(),
+        mesh.vertices.size(),
+        mesh.pos_offset,
+        mesh.pos_scale,
+        compact[i].data());
+      vertex_data = compact[i].data();
+    }
+    chunks.push_back({ vertex_data, mesh.vertices.size() * stride, meshes[i].vertex_offset });
+    const void* index_data = mesh.indices.data();
+    if (meshes[i].index_size == sizeof(uint16_t)) {
+      short_indices[i].assign(mesh.indices.begin(), mesh.indices.end());
+      index_data = short_indices[i].data();
+    }
+    uint64_t index_bytes = (uint64_t)mesh.indices.size() * meshes[i].index_size;
+    chunks.push_back({ index_data, index_bytes, meshes[i].index_offset });
+  }
+  std::string cache_path = mesh_cache_path(source_path);
+  if (!write_file_atomically(cache_path, chunks)) {
+    std::cout << "Failed to write mesh cache: " << cache_path << std::endl;
+    return false;
+  }
+  return true;
+}
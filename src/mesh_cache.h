@@ -0,0 +1,20 @@
+#pragma once
+
+#include "model.h"
+
+#include <string>
+
+// Cooked model cache. The first load of a model goes through Assimp and writes
+// <source>.meshcache next to it; later loads map that file and upload the vertex
+// and index buffers straight out of the mapping.
+// Bump the version whenever the file layout changes so stale caches are re-cooked.
+#define MESH_CACHE_VERSION 7
+
+// path of the cache file belonging to a model source file
+std::string mesh_cache_path(const std::string& source_path);
+// fill model from the cache of source_path. Returns false if the cache is missing,
+// stale (source mtime/size changed), cooked for another vertex format than
+// model.vertex_format, or corrupt, leaving model untouched.
+bool mesh_cache_load(const std::string& source_path, Model& model);
+// cook the meshes and texture references of a loaded model to the cache of source_path
+bool mesh_cache_write(const std::string& source_path, const Model& model);
@@ -0,0 +1,267 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Forsyth's scoring constants
+#define CACHE_SIZE 32
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRI_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+static float vertex_score(int cache_position, unsigned int remaining) {
+  // vertices no triangle needs anymore are worthless
+  if (remaining == 0) return -1.0f;
+  float score = 0.0f;
+  if (cache_position >= 0) {
+    if (cache_position < 3) {
+      // the last triangle's vertices get a fixed score, so the next triangle does not
+      // just pick the same edge and strip along
+      score = LAST_TRI_SCORE;
+    } else {
+      float scaler = 1.0f / (CACHE_SIZE - 3);
+      score = std::pow(1.0f - (cache_position - 3) * scaler, CACHE_DECAY_POWER);
+    }
+  }
+  // favour vertices with few triangles left so they get retired
+  score += VALENCE_BOOST_SCALE * std::pow((float)remaining, -VALENCE_BOOST_POWER);
+  return score;
+}
+
+void optimize_vertex_cache(unsigned int* indices, size_t index_count, size_t vertex_count) {
+  size_t triangle_count = index_count / 3;
+  if (triangle_count == 0) return;
+
+  // vertex -> triangle adjacency, compressed rows
+  std::vector<unsigned int> offsets(vertex_count + 1, 0);
+  for (size_t i = 0; i < index_count; i++) offsets[indices[i] + 1]++;
+  for (size_t v = 0; v < vertex_count; v++) offsets[v + 1] += offsets[v];
+  std::vector<unsigned int> adjacency(index_count);
+  std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+  for (size_t i = 0; i < index_count; i++) adjacency[fill[indices[i]]++] = i / 3;
+
+  std::vector<unsigned int> remaining(vertex_count);
+  std::vector<int> cache_position(vertex_count, -1);
+  std::vector<float> score(vertex_count);
+  for (size_t v = 0; v < vertex_count; v++) {
+    remaining[v] = offsets[v + 1] - offsets[v];
+    score[v] = vertex_score(-1, remaining[v]);
+  }
+  std::vector<bool> emitted(triangle_count, false);
+
+  std::vector<unsigned int> output;
+  output.reserve(index_count);
+  // simulated LRU cache, briefly holds up to 3 extra entries before trimming
+  std::vector<unsigned int> cache, next_cache;
+  size_t scan = 0;
+  int best = -1;
+  for (size_t emitted_count = 0; emitted_count < triangle_count; emitted_count++) {
+    if (best < 0) {
+      // nothing in the cache is usable, fall back to the first unemitted triangle
+      while (emitted[scan]) scan++;
+      best = scan;
+    }
+
+    const unsigned int* tri = indices + best * 3;
+    output.insert(output.end(), tri, tri + 3);
+    emitted[best] = true;
+
+    // move the triangle's vertices to the front of the LRU cache
+    next_cache.assign(tri, tri + 3);
+    for (unsigned int v : cache) {
+      if (v != tri[0] && v != tri[1] && v != tri[2]) next_cache.push_back(v);
+    }
+    for (int k = 0; k < 3; k++) {
+      // retire the triangle from its vertices' adjacency
+      unsigned int v = tri[k];
+      unsigned int* begin = adjacency.data() + offsets[v];
+      unsigned int* end = begin + remaining[v];
+      unsigned int* it = std::find(begin, end, (unsigned int)best);
+      if (it != end) {
+        std::swap(*it, *(end - 1));
+        remaining[v]--;
+      }
+    }
+
+    // rescore vertices in the cache and their triangles, remember the best one
+    for (size_t i = 0; i < next_cache.size(); i++) {
+      unsigned int v = next_cache[i];
+      cache_position[v] = i < CACHE_SIZE ? (int)i : -1;
+      score[v] = vertex_score(cache_position[v], remaining[v]);
+    }
+    for (size_t i = CACHE_SIZE; i < next_cache.size(); i++) cache_position[next_cache[i]] = -1;
+    if (next_cache.size() > CACHE_SIZE) next_cache.resize(CACHE_SIZE);
+
+    best = -1;
+    float best_score = -1.0f;
+    for (unsigned int v : next_cache) {
+      for (unsigned int i = 0; i < remaining[v]; i++) {
+        unsigned int t = adjacency[offsets[v] + i];
+        const unsigned int* other = indices + t * 3;
+        float s = score[other[0]] + score[other[1]] + score[other[2]];
+        if (s > best_score) {
+          best_score = s;
+          best = t;
+        }
+      }
+    }
+    cache.swap(next_cache);
+  }
+  std::copy(output.begin(), output.end(), indices);
+}
+
+// simulate a FIFO cache, returns the number of vertex transforms
+static size_t simulate_cache(
+  const unsigned int* indices,
+  size_t index_count,
+  size_t vertex_count,
+  unsigned int cache_size,
+  std::vector<unsigned int>* misses_per_triangle) {
+  std::vector<size_t> timestamp(vertex_count, 0);
+  size_t time = cache_size + 1;
+  size_t misses = 0;
+  for (size_t i = 0; i < index_count; i += 3) {
+    unsigned int triangle_misses = 0;
+    for (int k = 0; k < 3; k++) {
+      unsigned int v = indices[i + k];
+      if (time - timestamp[v] > cache_size) {
+        timestamp[v] = time++;
+        triangle_misses++;
+      }
+    }
+    misses += triangle_misses;
+    if (misses_per_triangle) misses_per_triangle->push_back(triangle_misses);
+  }
+  return misses;
+}
+
+float compute_acmr(
+  const unsigned int* indices, size_t index_count, size_t vertex_count, unsigned int cache_size) {
+  if (index_count < 3) return 0.0f;
+  size_t misses = simulate_cache(indices, index_count, vertex_count, cache_size, nullptr);
+  return (float)misses / (index_count / 3);
+}
+
+float compute_atvr(
+  const unsigned int* indices, size_t index_count, size_t vertex_count, unsigned int cache_size) {
+  if (vertex_count == 0) return 0.0f;
+  size_t misses = simulate_cache(indices, index_count, vertex_count, cache_size, nullptr);
+  return (float)misses / vertex_count;
+}
+
+#define OVERDRAW_CACHE_SIZE 16
+// soft clusters shorter than this are not worth splitting off
+#define MIN_CLUSTER_TRIANGLES 32
+
+void optimize_overdraw(
+  unsigned int* indices,
+  size_t index_count,
+  const Vertex* vertices,
+  size_t vertex_count,
+  float threshold) {
+  size_t triangle_count = index_count / 3;
+  if (triangle_count == 0) return;
+
+  // hard boundaries: triangles where all three vertices miss, i.e. the cache restarted
+  std::vector<unsigned int> misses;
+  simulate_cache(indices, index_count, vertex_count, OVERDRAW_CACHE_SIZE, &misses);
+  std::vector<size_t> hard;
+  for (size_t t = 0; t < triangle_count; t++) {
+    if (t == 0 || misses[t] == 3) hard.push_back(t);
+  }
+  hard.push_back(triangle_count);
+
+  // soft boundaries: split a hard cluster once its running ACMR gets within threshold of
+  // the cluster's ACMR, which bounds the cache penalty of drawing clusters out of order
+  std::vector<size_t> clusters;
+  for (size_t h = 0; h + 1 < hard.size(); h++) {
+    size_t begin = hard[h], end = hard[h + 1];
+    size_t cluster_misses = 0;
+    for (size_t t = begin; t < end; t++) cluster_misses += misses[t];
+    float cluster_acmr = (float)cluster_misses / (end - begin);
+
+    clusters.push_back(begin);
+    size_t start = begin, running = 0;
+    for (size_t t = begin; t < end; t++) {
+      running += misses[t];
+      size_t count = t + 1 - start;
+      if (
+        count >= MIN_CLUSTER_TRIANGLES && t + 1 < end &&
+        (float)running / count <= cluster_acmr * threshold) {
+        clusters.push_back(t + 1);
+        start = t + 1;
+        running = 0;
+      }
+    }
+  }
+  clusters.push_back(triangle_count);
+
+  // mesh centroid, weighted by area
+  glm::vec3 mesh_centroid(0.0f);
+  float mesh_area = 0.0f;
+  for (size_t t = 0; t < triangle_count; t++) {
+    const glm::vec3& a = vertices[indices[t * 3]].position;
+    const glm::vec3& b = vertices[indices[t * 3 + 1]].position;
+    const glm::vec3& c = vertices[indices[t * 3 + 2]].position;
+    float area = glm::length(glm::cross(b - a, c - a));
+    mesh_centroid += (a + b + c) * (area / 3.0f);
+    mesh_area += area;
+  }
+  if (mesh_area > 0.0f) mesh_centroid /= mesh_area;
+
+  // sort key: how much a cluster faces away from the center of the mesh
+  struct Cluster {
+    size_t begin, end;
+    float key;
+  };
+  std::vector<Cluster> sorted;
+  for (size_t i = 0; i + 1 < clusters.size(); i++) {
+    Cluster cluster = { clusters[i], clusters[i + 1], 0.0f };
+    glm::vec3 centroid(0.0f), normal(0.0f);
+    float area_sum = 0.0f;
+    for (size_t t = cluster.begin; t < cluster.end; t++) {
+      const glm::vec3& a = vertices[indices[t * 3]].position;
+      const glm::vec3& b = vertices[indices[t * 3 + 1]].position;
+      const glm::vec3& c = vertices[indices[t * 3 + 2]].position;
+      glm::vec3 n = glm::cross(b - a, c - a);
+      float area = glm::length(n);
+      centroid += (a + b + c) * (area / 3.0f);
+      normal += n;
+      area_sum += area;
+    }
+    if (area_sum > 0.0f) centroid /= area_sum;
+    float normal_length = glm::length(normal);
+    if (normal_length > 0.0f) normal /= normal_length;
+    cluster.key = glm::dot(centroid - mesh_centroid, normal);
+    sorted.push_back(cluster);
+  }
+  std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) {
+    return a.key > b.key;
+  });
+
+  std::vector<unsigned int> output;
+  output.reserve(index_count);
+  for (const Cluster& cluster : sorted) {
+    output.insert(output.end(), indices + cluster.begin * 3, indices + cluster.end * 3);
+  }
+  std::copy(output.begin(), output.end(), indices);
+}
+
+void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+  const unsigned int unused = ~0u;
+  std::vector<unsigned int> remap(vertices.size(), unused);
+  std::vector<Vertex> reordered;
+  reordered.reserve(vertices.size());
+  for (unsigned int& index : indices) {
+    if (remap[index] == unused) {
+      remap[index] = reordered.size();
+      reordered.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+  // vertices no triangle references are dropped
+  vertices.swap(reordered);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <cstddef>
+#include <vector>
+
+// Load-time optimizations of indexed triangle lists. All of them keep the set of
+// triangles intact and only change the order of triangles or vertices.
+
+// Reorder triangles for the post-transform vertex cache (Forsyth's linear-speed
+// vertex cache optimization).
+void optimize_vertex_cache(unsigned int* indices, size_t index_count, size_t vertex_count);
+
+// Reorder clusters of a cache-optimized index buffer so outward facing clusters tend to
+// be drawn first, reducing overdraw (Sander et al., "Fast triangle reordering").
+// threshold bounds how much ACMR may degrade when splitting into clusters, e.g. 1.05.
+void optimize_overdraw(
+  unsigned int* indices,
+  size_t index_count,
+  const Vertex* vertices,
+  size_t vertex_count,
+  float threshold);
+
+// Reorder vertices in order of first use so vertex fetch walks memory linearly.
+// Remaps indices accordingly.
+void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+
+// Average cache miss ratio (transformed vertices per triangle) for a FIFO cache
+float compute_acmr(
+  const unsigned int* indices, size_t index_count, size_t vertex_count, unsigned int cache_size);
+// Average transformed-to-vertex ratio, 1.0 is optimal
+float compute_atvr(
+  const unsigned int* indices, size_t index_count, size_t vertex_count, unsigned int cache_size);
@@ -0,0 +1,266 @@
+#include "mesh_simplifier.h"
+
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <unordered_map>
+#include <vector>
+
+// levels stop once they get this small or stop shrinking
+#define MIN_LOD_TRIANGLES 64
+#define MIN_LOD_REDUCTION 0.8f
+
+// symmetric 4x4 matrix of a sum of squared plane distances
+struct Quadric {
+  double a00, a01, a02, a03;
+  double a11, a12, a13;
+  double a22, a23;
+  double a33;
+};
+
+static void quadric_add_plane(Quadric& q, double a, double b, double c, double d) {
+  q.a00 += a * a;
+  q.a01 += a * b;
+  q.a02 += a * c;
+  q.a03 += a * d;
+  q.a11 += b * b;
+  q.a12 += b * c;
+  q.a13 += b * d;
+  q.a22 += c * c;
+  q.a23 += c * d;
+  q.a33 += d * d;
+}
+
+static void quadric_add(Quadric& q, const Quadric& r) {
+  q.a00 += r.a00;
+  q.a01 += r.a01;
+  q.a02 += r.a02;
+  q.a03 += r.a03;
+  q.a11 += r.a11;
+  q.a12 += r.a12;
+  q.a13 += r.a13;
+  q.a22 += r.a22;
+  q.a23 += r.a23;
+  q.a33 += r.a33;
+}
+
+static double quadric_error(const Quadric& q, const glm::vec3& p) {
+  double x = p.x, y = p.y, z = p.z;
+  double e = q.a00 * x * x + 2 * q.a01 * x * y + 2 * q.a02 * x * z + 2 * q.a03 * x +
+             q.a11 * y * y + 2 * q.a12 * y * z + 2 * q.a13 * y + q.a22 * z * z +
+             2 * q.a23 * z + q.a33;
+  return e > 0.0 ? e : 0.0;
+}
+
+struct Collapse {
+  unsigned int from, to;
+  double error;
+};
+
+// hash of an exact position, used to find seams
+struct PositionHash {
+  size_t operator()(const glm::vec3& p) const {
+    unsigned int h[3];
+    memcpy(h, &p, sizeof(h));
+    return (h[0] * 73856093u) ^ (h[1] * 19349663u) ^ (h[2] * 83492791u);
+  }
+};
+
+struct PositionEqual {
+  bool operator()(const glm::vec3& a, const glm::vec3& b) const {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+  }
+};
+
+size_t simplify_mesh(
+  unsigned int* destination,
+  const unsigned int* indices,
+  size_t index_count,
+  const Vertex* vertices,
+  size_t vertex_count,
+  size_t target_index_count,
+  float* result_error) {
+  std::vector<unsigned int> result(indices, indices + index_count);
+  double max_error = 0.0;
+
+  // lock seam vertices: a position referenced through more than one vertex
+  std::vector<bool> locked(vertex_count, false);
+  std::unordered_map<glm::vec3, unsigned int, PositionHash, PositionEqual> first_at;
+  for (size_t v = 0; v < vertex_count; v++) {
+    auto it = first_at.find(vertices[v].position);
+    if (it == first_at.end()) {
+      first_at[vertices[v].position] = v;
+    } else {
+      locked[v] = true;
+      locked[it->second] = true;
+    }
+  }
+
+  // lock border vertices: endpoints of edges used by a single triangle
+  std::unordered_map<unsigned long long, int> edge_use;
+  for (size_t i = 0; i < index_count; i += 3) {
+    for (int k = 0; k < 3; k++) {
+      unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+      unsigned long long key = ((unsigned long long)std::min(a, b) << 32) | std::max(a, b);
+      edge_use[key]++;
+    }
+  }
+  for (const auto& edge : edge_use) {
+    if (edge.second == 1) {
+      locked[edge.first >> 32] = true;
+      locked[edge.first & 0xffffffffu] = true;
+    }
+  }
+
+  // per-vertex quadrics from the planes of the adjacent triangles
+  std::vector<Quadric> quadrics(vertex_count);
+  memset(quadrics.data(), 0, quadrics.size() * sizeof(Quadric));
+  for (size_t i = 0; i < index_count; i += 3) {
+    const glm::vec3& p0 = vertices[result[i]].position;
+    const glm::vec3& p1 = vertices[result[i + 1]].position;
+    const glm::vec3& p2 = vertices[result[i + 2]].position;
+    glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+    float length = glm::length(n);
+    if (length == 0.0f) continue;
+    n /= length;
+    double d = -glm::dot(n, p0);
+    for (int k = 0; k < 3; k++) quadric_add_plane(quadrics[result[i + k]], n.x, n.y, n.z, d);
+  }
+
+  std::vector<unsigned int> adjacency_offsets(vertex_count + 1);
+  std::vector<unsigned int> adjacency;
+  std::vector<unsigned int> remap(vertex_count);
+  std::vector<bool> touched(vertex_count);
+  std::vector<Collapse> collapses;
+
+  while (result.size() > target_index_count) {
+    // vertex -> triangle adjacency of the current result
+    std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0);
+    for (unsigned int v : result) adjacency_offsets[v + 1]++;
+    for (size_t v = 0; v < vertex_count; v++) adjacency_offsets[v + 1] += adjacency_offsets[v];
+    adjacency.resize(result.size());
+    std::vector<unsigned int> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+    for (size_t i = 0; i < result.size(); i++) adjacency[fill[result[i]]++] = i / 3;
+
+    // candidate collapses along every edge, in both directions
+    collapses.clear();
+    for (size_t i = 0; i < result.size(); i += 3) {
+      for (int k = 0; k < 3; k++) {
+        unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+        for (int dir = 0; dir < 2; dir++) {
+          unsigned int from = dir ? b : a, to = dir ? a : b;
+          if (locked[from]) continue;
+          Quadric q = quadrics[from];
+          quadric_add(q, quadrics[to]);
+          Collapse collapse = { from, to, quadric_error(q, vertices[to].position) };
+          collapses.push_back(collapse);
+        }
+      }
+    }
+    if (collapses.empty()) break;
+    std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) {
+      return x.error < y.error;
+    });
+
+    // apply the cheapest independent collapses of this pass
+    for (size_t v = 0; v < vertex_count; v++) remap[v] = v;
+    std::fill(touched.begin(), touched.end(), false);
+    size_t triangles = result.size() / 3;
+    size_t target_triangles = target_index_count / 3;
+    // cap the pass so errors are re-evaluated as the mesh changes
+    size_t pass_limit = std::max<size_t>((triangles - target_triangles) / 2, 1);
+    size_t removed = 0;
+    for (const Collapse& collapse : collapses) {
+      if (removed >= pass_limit) break;
+      if (touched[collapse.from] || touched[collapse.to]) continue;
+
+      // reject collapses that would flip a triangle around from
+      bool flips = false;
+      unsigned int shared = 0;
+      for (unsigned int j = adjacency_offsets[collapse.from];
+           j < adjacency_offsets[collapse.from + 1] && !flips;
+           j++) {
+        const unsigned int* tri = result.data() + adjacency[j] * 3;
+        if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) {
+          shared++;
+          continue;
+        }
+        glm::vec3 p[3], q[3];
+        for (int k = 0; k < 3; k++) {
+          p[k] = vertices[tri[k]].position;
+          q[k] = tri[k] == collapse.from ? vertices[collapse.to].position : p[k];
+        }
+        glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+        if (glm::dot(before, after) <= 0.0f) flips = true;
+      }
+      if (flips || shared == 0) continue;
+
+      remap[collapse.from] = collapse.to;
+      quadric_add(quadrics[collapse.to], quadrics[collapse.from]);
+      max_error = std::max(max_error, collapse.error);
+      // neighbours of both ends change, keep them out of this pass
+      for (unsigned int end : { collapse.from, collapse.to }) {
+        for (unsigned int j = adjacency_offsets[end]; j < adjacency_offsets[end + 1]; j++) {
+          const unsigned int* tri = result.data() + adjacency[j] * 3;
+          touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+        }
+      }
+      removed += shared;
+    }
+    if (removed == 0) break;
+
+    // drop the triangles that became degenerate
+    size_t write = 0;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      unsigned int a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+      if (a == b || b == c || a == c) continue;
+      result[write++] = a;
+      result[write++] = b;
+      result[write++] = c;
+    }
+    result.resize(write);
+  }
+
+  std::copy(result.begin(), result.end(), destination);
+  if (result_error) *result_error = (float)std::sqrt(max_error);
+  return result.size();
+}
+
+void build_lod_chain(
+  const std::vector<Vertex>& vertices,
+  std::vector<unsigned int>& indices,
+  std::vector<MeshLod>& lods,
+  unsigned int max_lods) {
+  lods.clear();
+  MeshLod lod = { 0, (unsigned int)indices.size(), 0.0f };
+  lods.push_back(lod);
+
+  std::vector<unsigned int> source, simplified;
+  while (lods.size() < max_lods && lod.index_count / 3 > MIN_LOD_TRIANGLES) {
+    source.assign(
+      indices.begin() + lod.index_offset, indices.begin() + lod.index_offset + lod.index_count);
+    simplified.resize(source.size());
+    size_t target = (source.size() / 6) * 3;
+    float error = 0.0f;
+    size_t count = simplify_mesh(
+      simplified.data(),
+      source.data(),
+      source.size(),
+      vertices.data(),
+      vertices.size(),
+      target,
+      &error);
+    if (count == 0 || count > source.size() * MIN_LOD_REDUCTION) break;
+    optimize_vertex_cache(simplified.data(), count, vertices.size());
+
+    // each level is simplified from the previous one, so deviations add up
+    MeshLod next = { (unsigned int)indices.size(), (unsigned int)count, lod.error + error };
+    indices.insert(indices.end(), simplified.begin(), simplified.begin() + count);
+    lods.push_back(next);
+    lod = next;
+  }
+}
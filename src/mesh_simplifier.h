@@ -0,0 +1,33 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <cstddef>
+#include <vector>
+
+// Quadric error metric simplification (Garland & Heckbert) by edge collapse.
+// Vertices are collapsed onto one of their neighbours and never moved, so the result
+// indexes the same vertex buffer as the input. Vertices on open borders and on attribute
+// seams (several vertices sharing a position) are locked to keep the mesh watertight.
+//
+// Writes at most index_count indices to destination and returns how many were written,
+// stopping once target_index_count is reached or nothing else can be collapsed.
+// result_error receives the largest collapse error as a distance in model units.
+size_t simplify_mesh(
+  unsigned int* destination,
+  const unsigned int* indices,
+  size_t index_count,
+  const Vertex* vertices,
+  size_t vertex_count,
+  size_t target_index_count,
+  float* result_error);
+
+// Build a level of detail chain in a single index buffer. indices holds the full-detail
+// triangles on entry; up to max_lods - 1 coarser levels are appended to it, each simplified
+// from the previous one to about half its triangles and reordered for the vertex cache.
+// lods receives the range and accumulated error of every level, finest first.
+void build_lod_chain(
+  const std::vector<Vertex>& vertices,
+  std::vector<unsigned int>& indices,
+  std::vector<MeshLod>& lods,
+  unsigned int max_lods);
@@ -0,0 +1,223 @@
+#include "meshlet.h"
+
+#include "job_system.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// below this many meshlets one thread culls faster than several
+#define PARALLEL_CULL_MESHLETS 1024
+// groups of 4 meshlets a job culls at least
+#define CULL_GROUPS_PER_JOB 64
+
+// meshlets hold few vertices, a linear scan beats a hash set
+static bool contains(const unsigned int* set, unsigned int size, unsigned int v) {
+  for (unsigned int i = 0; i < size; i++)
+    if (set[i] == v) return true;
+  return false;
+}
+
+static Meshlet finish_meshlet(
+  const Vertex* vertices,
+  const unsigned int* indices,
+  unsigned int index_offset,
+  unsigned int index_count,
+  const unsigned int* unique,
+  unsigned int num_unique) {
+  Meshlet meshlet;
+  meshlet.index_offset = index_offset;
+  meshlet.index_count = index_count;
+
+  // sphere around the center of the box
+  glm::vec3 lo = vertices[unique[0]].position, hi = lo;
+  for (unsigned int i = 1; i < num_unique; i++) {
+    lo = glm::min(lo, vertices[unique[i]].position);
+    hi = glm::max(hi, vertices[unique[i]].position);
+  }
+  meshlet.center = (lo + hi) * 0.5f;
+  meshlet.radius = 0.0f;
+  for (unsigned int i = 0; i < num_unique; i++) {
+    meshlet.radius =
+      std::fmax(meshlet.radius, glm::length(vertices[unique[i]].position - meshlet.center));
+  }
+
+  // cone around the average face normal
+  std::vector<glm::vec3> normals;
+  glm::vec3 axis(0.0f);
+  for (unsigned int i = index_offset; i < index_offset + index_count; i += 3) {
+    const glm::vec3& p0 = vertices[indices[i]].position;
+    const glm::vec3& p1 = vertices[indices[i + 1]].position;
+    const glm::vec3& p2 = vertices[indices[i + 2]].position;
+    glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+    float length = glm::length(n);
+    if (length == 0.0f) continue;
+    normals.push_back(n / length);
+    axis += normals.back();
+  }
+  float axis_length = glm::length(axis);
+  meshlet.cone_axis = axis_length > 0.0f ? axis / axis_length : glm::vec3(0.0f, 0.0f, 1.0f);
+  meshlet.cone_cutoff = 1.0f;
+  if (axis_length > 0.0f) {
+    float min_dot = 1.0f;
+    for (const glm::vec3& n : normals) min_dot = std::fmin(min_dot, glm::dot(n, meshlet.cone_axis));
+    // a spread of 90 degrees or more faces every direction
+    if (min_dot > 0.0f) meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+  }
+  return meshlet;
+}
+
+void build_meshlets(
+  const Vertex* vertices,
+  const unsigned int* indices,
+  unsigned int index_offset,
+  unsigned int index_count,
+  std::vector<Meshlet>& meshlets) {
+  unsigned int unique[MESHLET_MAX_VERTICES];
+  unsigned int num_unique = 0;
+  unsigned int start = index_offset;
+  unsigned int end = index_offset + index_count;
+  for (unsigned int i = index_offset; i < end; i += 3) {
+    unsigned int added = 0;
+    for (int k = 0; k < 3; k++) {
+      unsigned int v = indices[i + k];
+      if (!contains(unique, num_unique, v) && !contains(indices + i, k, v)) added++;
+    }
+    // close the current meshlet when the triangle does not fit
+    if (num_unique + added > MESHLET_MAX_VERTICES || (i - start) / 3 >= MESHLET_MAX_TRIANGLES) {
+      meshlets.push_back(finish_meshlet(vertices, indices, start, i - start, unique, num_unique));
+      start = i;
+      num_unique = 0;
+    }
+    for (int k = 0; k < 3; k++) {
+      unsigned int v = indices[i + k];
+      if (!contains(unique, num_unique, v)) unique[num_unique++] = v;
+    }
+  }
+  if (end > start)
+    meshlets.push_back(finish_meshlet(vertices, indices, start, end - start, unique, num_unique));
+}
+
+void MeshletBounds::assign(const Meshlet* meshlets, size_t count) {
+  // padding is an empty sphere far outside every frustum
+  size_t padded = (count + 3) & ~(size_t)3;
+  center_x.assign(padded, 1e30f);
+  center_y.assign(padded, 1e30f);
+  center_z.assign(padded, 1e30f);
+  radius.assign(padded, 0.0f);
+  axis_x.assign(padded, 0.0f);
+  axis_y.assign(padded, 0.0f);
+  axis_z.assign(padded, 1.0f);
+  cutoff.assign(padded, 1.0f);
+  for (size_t i = 0; i < count; i++) {
+    center_x[i] = meshlets[i].center.x;
+    center_y[i] = meshlets[i].center.y;
+    center_z[i] = meshlets[i].center.z;
+    radius[i] = meshlets[i].radius;
+    axis_x[i] = meshlets[i].cone_axis.x;
+    axis_y[i] = meshlets[i].cone_axis.y;
+    axis_z[i] = meshlets[i].cone_axis.z;
+    cutoff[i] = meshlets[i].cone_cutoff;
+  }
+}
+
+void extract_frustum_planes(const glm::mat4& mvp, glm::vec4 planes[6]) {
+  // rows of the matrix, glm is column major
+  glm::vec4 row[4];
+  for (int r = 0; r < 4; r++) row[r] = glm::vec4(mvp[0][r], mvp[1][r], mvp[2][r], mvp[3][r]);
+  for (int axis = 0; axis < 3; axis++) {
+    planes[axis * 2] = row[3] + row[axis];
+    planes[axis * 2 + 1] = row[3] - row[axis];
+  }
+  for (int i = 0; i < 6; i++) planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+// cull the groups of 4 meshlets in [begin, end), returns how many meshlets are visible
+static size_t cull_groups(
+  const MeshletBounds& bounds,
+  size_t count,
+  const glm::vec4 planes[6],
+  const glm::vec3& camera_pos,
+  bool cull_backfacing,
+  unsigned char* visible,
+  size_t begin,
+  size_t end) {
+  size_t num_visible = 0;
+  for (size_t group = begin; group < end; group++) {
+    size_t i = group * 4;
+#ifdef __SSE2__
+    __m128 cx = _mm_loadu_ps(&bounds.center_x[i]);
+    __m128 cy = _mm_loadu_ps(&bounds.center_y[i]);
+    __m128 cz = _mm_loadu_ps(&bounds.center_z[i]);
+    __m128 r = _mm_loadu_ps(&bounds.radius[i]);
+    __m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), r);
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int p = 0; p < 6; p++) {
+      __m128 d = _mm_add_ps(
+        _mm_add_ps(
+          _mm_mul_ps(cx, _mm_set1_ps(planes[p].x)), _mm_mul_ps(cy, _mm_set1_ps(planes[p].y))),
+        _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(planes[p].z)), _mm_set1_ps(planes[p].w)));
+      inside = _mm_and_ps(inside, _mm_cmpgt_ps(d, neg_r));
+    }
+    if (cull_backfacing) {
+      // back-facing when the camera lies inside the negated cone around the sphere
+      __m128 dx = _mm_sub_ps(cx, _mm_set1_ps(camera_pos.x));
+      __m128 dy = _mm_sub_ps(cy, _mm_set1_ps(camera_pos.y));
+      __m128 dz = _mm_sub_ps(cz, _mm_set1_ps(camera_pos.z));
+      __m128 length = _mm_sqrt_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+      __m128 along = _mm_add_ps(
+        _mm_add_ps(
+          _mm_mul_ps(dx, _mm_loadu_ps(&bounds.axis_x[i])),
+          _mm_mul_ps(dy, _mm_loadu_ps(&bounds.axis_y[i]))),
+        _mm_mul_ps(dz, _mm_loadu_ps(&bounds.axis_z[i])));
+      __m128 limit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&bounds.cutoff[i]), length), r);
+      inside = _mm_andnot_ps(_mm_cmpge_ps(along, limit), inside);
+    }
+    int mask = _mm_movemask_ps(inside);
+    for (int k = 0; k < 4 && i + k < count; k++) {
+      visible[i + k] = (mask >> k) & 1;
+      num_visible += visible[i + k];
+    }
+#else
+    for (size_t k = i; k < i + 4 && k < count; k++) {
+      glm::vec3 center(bounds.center_x[k], bounds.center_y[k], bounds.center_z[k]);
+      bool inside = true;
+      for (int p = 0; p < 6; p++)
+        inside = inside && glm::dot(glm::vec3(planes[p]), center) + planes[p].w > -bounds.radius[k];
+      if (inside && cull_backfacing) {
+        glm::vec3 axis(bounds.axis_x[k], bounds.axis_y[k], bounds.axis_z[k]);
+        glm::vec3 d = center - camera_pos;
+        inside = glm::dot(d, axis) < bounds.cutoff[k] * glm::length(d) + bounds.radius[k];
+      }
+      visible[k] = inside;
+      num_visible += inside;
+    }
+#endif // __SSE2__
+  }
+  return num_visible;
+}
+
+size_t cull_meshlets(
+  const MeshletBounds& bounds,
+  size_t count,
+  const glm::vec4 planes[6],
+  const glm::vec3& camera_pos,
+  bool cull_backfacing,
+  unsigned char* visible) {
+  size_t groups = (count + 3) / 4;
+  if (count < PARALLEL_CULL_MESHLETS)
+    return cull_groups(bounds, count, planes, camera_pos, cull_backfacing, visible, 0, groups);
+  // the big meshes are spread over the job system
+  std::atomic<size_t> num_visible(0);
+  parallel_for(0, groups, CULL_GROUPS_PER_JOB, [&](size_t first, size_t last) {
+    num_visible += cull_groups(
+      bounds, count, planes, camera_pos, cull_backfacing, visible, first, last);
+  });
+  return num_visible;
+}
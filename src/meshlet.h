@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <vector>
+
+struct Vertex;
+
+// cluster size limits, small enough that a cluster covers a local patch of a mesh
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+// A cluster of triangles: a contiguous range of the index buffer with its bounds
+struct Meshlet {
+  unsigned int index_offset;
+  unsigned int index_count;
+  // bounding sphere in model space
+  glm::vec3 center;
+  float radius;
+  // normal cone: every triangle faces within acos of the spread around axis.
+  // cutoff is the sine of the spread, 1 when the cluster can never be back-facing.
+  glm::vec3 cone_axis;
+  float cone_cutoff;
+};
+
+// Split the index range [index_offset, index_offset + index_count) into meshlets in triangle
+// order, so vertex cache optimized indices give spatially coherent clusters.
+void build_meshlets(
+  const Vertex* vertices,
+  const unsigned int* indices,
+  unsigned int index_offset,
+  unsigned int index_count,
+  std::vector<Meshlet>& meshlets);
+
+// Meshlet bounds as structure of arrays padded to a multiple of 4, for culling 4 at a time
+struct MeshletBounds {
+  std::vector<float> center_x, center_y, center_z, radius;
+  std::vector<float> axis_x, axis_y, axis_z, cutoff;
+  void assign(const Meshlet* meshlets, size_t count);
+};
+
+// planes of the view frustum of a model-view-projection matrix, pointing inwards and
+// normalized so they give distances in model space
+void extract_frustum_planes(const glm::mat4& mvp, glm::vec4 planes[6]);
+
+// visible[i] = 1 for the meshlets that intersect the frustum and, with cull_backfacing,
+// have at least one triangle facing camera_pos (in model space), 0 otherwise.
+// Returns the number of visible meshlets.
+size_t cull_meshlets(
+  const MeshletBounds& bounds,
+  size_t count,
+  const glm::vec4 planes[6],
+  const glm::vec3& camera_pos,
+  bool cull_backfacing,
+  unsigned char* visible);
@@ -1,6 +1,10 @@
 #include "model.h"
 
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
 #include "stb_image.h"
+#include "texture_cache.h"
 
 // clang-format off
 #include <glad/glad.h>
@@ -11,33 +15,215 @@
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 #include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+// uniform scale of a node transform, meshes are only ever scaled uniformly
+static float matrix_scale(const glm::mat4& m) {
+  return glm::length(glm::vec3(m[0]));
+}
+
+// path of an image a model refers to relative to its directory
+static std::string texture_path(const char* path, const std::string& directory) {
+  std::string filename = std::string(path);
+  filename = directory + '/' + filename;
+  std::replace(filename.begin(), filename.end(), '\\', '/');
+  return filename;
+}
+
+glm::mat4 placement_matrix(const glm::vec3& pos, float scale) {
+  return glm::scale(glm::translate(glm::mat4(1.0f), pos), glm::vec3(scale, scale, scale));
+}
 
 // Model class
-void Model::Draw(Shader shader) {
+void Model::Draw(Shader shader, const TransformHierarchy& transforms, int placement_node) {
   for (int i = 0; i < this->meshes.size(); i++) {
-    meshes[i].Draw(shader);
+    meshes[i].Draw(shader, meshTransform(transforms, placement_node, meshes[i]));
+  }
+}
+
+glm::mat4 Model::placement() const {
+  return placement_matrix(pos, scale);
+}
+
+int Model::addToHierarchy(TransformHierarchy& transforms, const glm::mat4& placement) const {
+  int placement_node = transforms.add_node(-1, placement);
+  for (unsigned int i = 0; i < node_parents.size(); i++) {
+    int parent = node_parents[i] >= 0 ? placement_node + 1 + node_parents[i] : placement_node;
+    transforms.add_node(parent, node_transforms[i]);
+  }
+  return placement_node;
+}
+
+std::vector<glm::mat4> Model::nodeMatrices() const {
+  std::vector<glm::mat4> matrices(node_transforms.size());
+  for (unsigned int i = 0; i < node_transforms.size(); i++) {
+    int parent = node_parents[i];
+    matrices[i] = parent >= 0 ? matrices[parent] * node_transforms[i] : node_transforms[i];
+  }
+  return matrices;
+}
+
+void Model::updateLod(
+  const TransformHierarchy& transforms,
+  int placement_node,
+  std::vector<MeshDraw>& draws,
+  const glm::vec3& camera_pos,
+  float pixels_per_unit,
+  float max_error_pixels) const {
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    const glm::mat4& world = meshTransform(transforms, placement_node, meshes[i]);
+    meshes[i].selectLod(
+      draws[i], world, matrix_scale(world), camera_pos, pixels_per_unit, max_error_pixels);
+  }
+}
+
+void Model::cullMeshlets(
+  const TransformHierarchy& transforms,
+  int placement_node,
+  std::vector<MeshDraw>& draws,
+  const glm::mat4& view_projection,
+  const glm::vec3& camera_pos,
+  bool cull_backfacing) const {
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    const glm::mat4& world = meshTransform(transforms, placement_node, meshes[i]);
+    // culling runs in the space of the mesh
+    glm::vec3 local_camera = glm::vec3(glm::inverse(world) * glm::vec4(camera_pos, 1.0f));
+    meshes[i].cullMeshlets(draws[i], view_projection * world, local_camera, cull_backfacing);
   }
 }
 
+void Model::resetCulling(std::vector<MeshDraw>& draws) const {
+  for (MeshDraw& draw : draws) draw.culled = false;
+}
+
+void Model::release() {
+  for (Mesh& mesh : meshes) mesh.release();
+  for (const Texture& texture : textures_loaded) gpu_destroy(texture.handle);
+}
+
+unsigned int Model::triangleCount() const {
+  unsigned int triangles = 0;
+  for (const Mesh& mesh : meshes) triangles += mesh.lods[0].index_count / 3;
+  return triangles;
+}
+
+unsigned int Model::triangleCount(const std::vector<MeshDraw>& draws) const {
+  unsigned int triangles = 0;
+  for (unsigned int i = 0; i < meshes.size(); i++) triangles += meshes[i].triangleCount(draws[i]);
+  return triangles;
+}
+
+unsigned int Model::visibleTriangleCount(const std::vector<MeshDraw>& draws) const {
+  unsigned int triangles = 0;
+  for (unsigned int i = 0; i < meshes.size(); i++)
+    triangles += meshes[i].visibleTriangleCount(draws[i]);
+  return triangles;
+}
+
 void Model::loadModel(std::string path) {
+  double start = glfwGetTime();
+  directory = path.substr(0, path.find_last_of("/\\"));
+  // warm path: upload straight from the cooked cache
+  if (mesh_cache_load(path, *this)) {
+    std::cout << "Loaded from mesh cache in " << (glfwGetTime() - start) * 1000.0 << " ms, "
+              << texture_memory_used() / (1024 * 1024) << " MB of textures, "
+              << vertexMemory() / 1024 << " KB of vertices" << std::endl;
+    return;
+  }
+
+  // cold path: parse the source through assimp and cook the cache for next time
   Assimp::Importer importer;
   const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
   if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
     std::cout << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
     return;
   }
-  directory = path.substr(0, path.find_last_of("/\\"));
-  processNode(scene->mRootNode, scene);
+  // meshes referenced by several nodes are added once per node, this is the least there are
+  meshes.reserve(scene->mNumMeshes);
+  processNode(scene->mRootNode, scene, -1);
   std::cout << "Done processing node." << std::endl;
+  mesh_cache_write(path, *this);
+  std::cout << "Loaded through assimp in " << (glfwGetTime() - start) * 1000.0 << " ms, "
+            << texture_memory_used() / (1024 * 1024) << " MB of textures, "
+            << vertexMemory() / 1024 << " KB of vertices" << std::endl;
+}
+
+void Model::bounds(glm::vec3& center, float& radius) const {
+  // mesh spheres moved into model space
+  std::vector<glm::mat4> matrices = nodeMatrices();
+  std::vector<glm::vec3> centers;
+  std::vector<float> radii;
+  for (const Mesh& mesh : meshes) {
+    const glm::mat4& m = matrices[mesh.node];
+    centers.push_back(glm::vec3(m * glm::vec4(mesh.center, 1.0f)));
+    radii.push_back(mesh.radius * matrix_scale(m));
+  }
+
+  glm::vec3 lo(0.0f), hi(0.0f);
+  if (!meshes.empty()) lo = hi = centers[0];
+  for (unsigned int i = 0; i < centers.size(); i++) {
+    lo = glm::min(lo, centers[i] - glm::vec3(radii[i]));
+    hi = glm::max(hi, centers[i] + glm::vec3(radii[i]));
+  }
+  center = (lo + hi) * 0.5f;
+  radius = 0.0f;
+  for (unsigned int i = 0; i < centers.size(); i++)
+    radius = std::fmax(radius, glm::length(centers[i] - center) + radii[i]);
+}
+
+size_t Model::vertexMemory() const {
+  size_t bytes = 0;
+  for (const Mesh& mesh : meshes) bytes += (size_t)mesh.vertex_count * vertex_size(mesh.format);
+  return bytes;
 }
 
-void Model::processNode(aiNode* node, const aiScene* scene) {
+void Model::useTextureArrays(TextureArrays& arrays) {
+  for (Mesh& mesh : meshes) {
+    // the shaders only read the first map of each kind
+    std::string diffuse, specular;
+    for (const Texture& texture : mesh.textures) {
+      if (texture.type == "texture_diffuse" && diffuse.empty())
+        diffuse = texture_path(texture.path.c_str(), directory);
+      else if (texture.type == "texture_specular" && specular.empty())
+        specular = texture_path(texture.path.c_str(), directory);
+    }
+    if (diffuse.empty()) continue;
+    mesh.material = arrays.add_material(diffuse, specular);
+    if (mesh.material < 0) continue;
+    mesh.texture_arrays = &arrays;
+    mesh.textures.clear();
+  }
+  // drop the textures no mesh binds anymore, the arrays hold a copy
+  std::vector<Texture> kept;
+  for (const Texture& texture : textures_loaded) {
+    bool used = false;
+    for (const Mesh& mesh : meshes) {
+      for (const Texture& other : mesh.textures) used = used || other.handle == texture.handle;
+    }
+    if (used)
+      kept.push_back(texture);
+    else
+      gpu_destroy(texture.handle);
+  }
+  textures_loaded.swap(kept);
+}
+
+void Model::processNode(aiNode* node, const aiScene* scene, int parent) {
+  // keep the node transform, assimp matrices are row major
+  const aiMatrix4x4& t = node->mTransformation;
+  glm::mat4 transform(
+    t.a1, t.b1, t.c1, t.d1, t.a2, t.b2, t.c2, t.d2, t.a3, t.b3, t.c3, t.d3, t.a4, t.b4, t.c4, t.d4);
+  int index = node_parents.size();
+  node_parents.push_back(parent);
+  node_transforms.push_back(transform);
   for (unsigned int i = 0; i < node->mNumMeshes; i++) {
     aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
     meshes.push_back(processMesh(mesh, scene));
+    meshes.back().node = index;
   }
+  // depth first, so nodes stay parent-before-child with contiguous subtrees
   for (unsigned int i = 0; i < node->mNumChildren; i++) {
-    processNode(node->mChildren[i], scene);
+    processNode(node->mChildren[i], scene, index);
   }
 }
 
@@ -79,6 +265,30 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene) {
     }
   }
 
+  // reorder for the post-transform cache and against overdraw, then lay out the
+  // vertices in the order they are fetched
+  float acmr_before = compute_acmr(indices.data(), indices.size(), vertices.size(), 16);
+  float atvr_before = compute_atvr(indices.data(), indices.size(), vertices.size(), 16);
+  optimize_vertex_cache(indices.data(), indices.size(), vertices.size());
+  optimize_overdraw(indices.data(), indices.size(), vertices.data(), vertices.size(), 1.05f);
+  optimize_vertex_fetch(vertices, indices);
+  std::cout << "Mesh " << meshes.size() << " (" << indices.size() / 3
+            << " triangles): ACMR " << acmr_before << " -> "
+            << compute_acmr(indices.data(), indices.size(), vertices.size(), 16) << ", ATVR "
+            << atvr_before << " -> "
+            << compute_atvr(indices.data(), indices.size(), vertices.size(), 16) << std::endl;
+
+  // coarser levels go after the full-detail triangles in the same index buffer
+  std::vector<MeshLod> lods;
+  build_lod_chain(vertices, indices, lods, MAX_LODS);
+  std::cout << "  " << lods.size() << " LODs:";
+  for (const MeshLod& lod : lods) std::cout << " " << lod.index_count / 3;
+  std::cout << " triangles, error " << lods.back().error << std::endl;
+
+  // clusters of the full-detail level for culling
+  std::vector<Meshlet> meshlets;
+  build_meshlets(vertices.data(), indices.data(), 0, lods[0].index_count, meshlets);
+
   // process material
   if (mesh->mMaterialIndex >= 0) {
     aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
@@ -89,14 +299,21 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene) {
       loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
     textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
   }
-  return Mesh(vertices, indices, textures);
+  return Mesh(vertices, indices, textures, vertex_format, lods, meshlets);
 }
 
-unsigned int TextureFromFile(const char* path, const std::string& directory) {
-  std::string filename = std::string(path);
-  filename = directory + '/' + filename;
-  std::replace(filename.begin(), filename.end(), '\\', '/');
-  unsigned int texture_id;
+unsigned int
+  TextureFromFile(const char* path, const std::string& directory, const std::string& type) {
+  std::string filename = texture_path(path, directory);
+  // prefer the cooked mip chain, cooking it if it is missing or stale
+  unsigned int texture_id = texture_cache_load(filename, type);
+  if (texture_id) return texture_id;
+  if (texture_cache_cook(filename, type)) {
+    texture_id = texture_cache_load(filename, type);
+    if (texture_id) return texture_id;
+  }
+
+  // fall back to decoding and generating mips at runtime
   glGenTextures(1, &texture_id);
   int width, height, channels;
   unsigned char* data = stbi_load(filename.c_str(), &width, &height, &channels, 0);
@@ -111,6 +328,8 @@ unsigned int TextureFromFile(const char* path, const std::string& directory) {
     glBindTexture(GL_TEXTURE_2D, texture_id);
     glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
     glGenerateMipmap(GL_TEXTURE_2D);
+    // a full mip chain adds a third on top of the base level
+    texture_memory_add((size_t)width * height * channels * 4 / 3);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -141,9 +360,10 @@ std::vector<Texture>
     }
     if (!skip) {
       Texture texture;
-      texture.id = TextureFromFile(str.C_Str(), directory);
       texture.type = typeName;
       texture.path = str.C_Str();
+      unsigned int id = TextureFromFile(str.C_Str(), directory, typeName);
+      texture.handle = gpu_adopt(GPU_TEXTURE, id, texture.path);
       textures.push_back(texture);
       textures_loaded.push_back(texture);
     }
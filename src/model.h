@@ -2,6 +2,8 @@
 
 #include "mesh.h"
 #include "shader.h"
+#include "texture_arrays.h"
+#include "transform_hierarchy.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
@@ -10,23 +12,98 @@
 #include <iostream>
 #include <vector>
 
+// load an image relative to directory as a mipmapped GL texture, cooking it on first use.
+// type is the Texture::type the image is used as and decides how its mips are filtered.
+unsigned int
+  TextureFromFile(const char* path, const std::string& directory, const std::string& type);
+
+// levels of detail generated per mesh, including the full-detail one
+#define MAX_LODS 4
+
+// translate(pos) * scale(scale), the placement the nodes of a model hang below
+glm::mat4 placement_matrix(const glm::vec3& pos, float scale);
+
 class Model {
 public:
+  // placement in the scene, the model's nodes hang below translate(pos) * scale(scale)
   glm::vec3 pos;
+  float scale = 1.0f;
+  // layout the meshes are uploaded in
+  VertexFormat vertex_format = VERTEX_FORMAT_FULL;
   std::vector<Texture> textures_loaded;
   std::vector<Mesh> meshes;
+  // node hierarchy of the source file, parent-before-child, indexed by Mesh::node
+  std::vector<int> node_parents;
+  std::vector<glm::mat4> node_transforms;
   std::string directory;
   Model() {
   }
-  Model(const char* path, glm::vec3 pos = glm::vec3(0.f, 0.f, 0.f)) : pos(pos) {
+  Model(
+    const char* path,
+    glm::vec3 pos = glm::vec3(0.f, 0.f, 0.f),
+    VertexFormat vertex_format = VERTEX_FORMAT_FULL) :
+      pos(pos),
+      vertex_format(vertex_format) {
     std::cout << "Actual path: " << path << std::endl;
     loadModel(path);
   }
-  void Draw(Shader shader);
+  // Placements in a TransformHierarchy are named by their placement node, the nodes of the
+  // model follow it. The model itself is shared by all of its placements.
+
+  // draw every mesh at full detail with its world matrix from transforms
+  void Draw(Shader shader, const TransformHierarchy& transforms, int placement_node);
+  glm::mat4 placement() const;
+  // append a placement node and the node hierarchy below it to transforms, returns the
+  // placement node
+  int addToHierarchy(TransformHierarchy& transforms, const glm::mat4& placement) const;
+  // world matrix of one of the meshes, as of the last transforms.update()
+  const glm::mat4& meshTransform(
+    const TransformHierarchy& transforms,
+    int placement_node,
+    const Mesh& mesh) const {
+    return transforms.world(placement_node + 1 + mesh.node);
+  }
+  // matrix of every node relative to the model, placement excluded
+  std::vector<glm::mat4> nodeMatrices() const;
+  // select the level of detail of every mesh of a placement into draws, one per mesh, see
+  // Mesh::selectLod
+  void updateLod(
+    const TransformHierarchy& transforms,
+    int placement_node,
+    std::vector<MeshDraw>& draws,
+    const glm::vec3& camera_pos,
+    float pixels_per_unit,
+    float max_error_pixels) const;
+  // cull the meshlets of every mesh of a placement into draws, see Mesh::cullMeshlets.
+  // camera_pos in world space.
+  void cullMeshlets(
+    const TransformHierarchy& transforms,
+    int placement_node,
+    std::vector<MeshDraw>& draws,
+    const glm::mat4& view_projection,
+    const glm::vec3& camera_pos,
+    bool cull_backfacing) const;
+  void resetCulling(std::vector<MeshDraw>& draws) const;
+  // delete the GPU objects of the meshes and textures. Copies share them, so releasing any
+  // copy leaves the others drawing nothing and releasing them too does nothing.
+  void release();
+  // triangles at full detail
+  unsigned int triangleCount() const;
+  // triangles of the levels of detail of draws, and of those the ones left after culling
+  unsigned int triangleCount(const std::vector<MeshDraw>& draws) const;
+  unsigned int visibleTriangleCount(const std::vector<MeshDraw>& draws) const;
+  // bounding sphere around the bounding spheres of all meshes, in model space with node
+  // transforms applied
+  void bounds(glm::vec3& center, float& radius) const;
+  // bytes of vertex buffers uploaded for all meshes
+  size_t vertexMemory() const;
+  // register the diffuse and specular maps of every mesh with arrays and draw the meshes
+  // from them; their own textures are deleted. Before arrays.build() and before copying.
+  void useTextureArrays(TextureArrays& arrays);
 
 private:
   void loadModel(std::string path);
-  void processNode(aiNode* node, const aiScene* scene);
+  void processNode(aiNode* node, const aiScene* scene, int parent);
   Mesh processMesh(aiMesh* mesh, const aiScene* scene);
   std::vector<Texture>
     loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName);
@@ -0,0 +1,62 @@
+#include "model_instances.h"
+
+#include "meshlet.h"
+
+// clang-format off
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+// clang-format on
+
+#include <algorithm>
+#include <cmath>
+
+ModelInstances::ModelInstances(const Model& model) : model(model) {
+  instance_buffer = gpu_create(GPU_BUFFER, "instance transforms");
+  // the mesh VAOs are shared by every copy of the model, so they all read this buffer
+  for (Mesh& mesh : this->model.meshes) mesh.setInstanceBuffer(gpu_name(instance_buffer));
+  this->model.bounds(center, radius);
+  node_matrices = this->model.nodeMatrices();
+}
+
+void ModelInstances::cull(
+  const glm::mat4& view_projection,
+  std::vector<glm::mat4>& visible) const {
+  glm::vec4 planes[6];
+  extract_frustum_planes(view_projection, planes);
+  visible.clear();
+  for (const glm::mat4& transform : transforms) {
+    // uniform scale, the length of any basis vector
+    glm::vec3 world_center = glm::vec3(transform * glm::vec4(center, 1.0f));
+    float world_radius = radius * glm::length(glm::vec3(transform[0]));
+    bool inside = true;
+    for (int p = 0; p < 6 && inside; p++)
+      inside = glm::dot(glm::vec3(planes[p]), world_center) + planes[p].w > -world_radius;
+    if (inside) visible.push_back(transform);
+  }
+}
+
+void ModelInstances::upload(const std::vector<glm::mat4>& visible) {
+  visible_count = visible.size();
+
+  glBindBuffer(GL_ARRAY_BUFFER, gpu_name(instance_buffer));
+  size_t bytes = visible.size() * sizeof(glm::mat4);
+  // grow geometrically so a growing scene does not reallocate every frame. Never leave it
+  // empty, plain draws of the shared VAOs still fetch the first instance.
+  if (bytes > capacity || capacity == 0) capacity = std::max(bytes * 2, sizeof(glm::mat4));
+  // respecifying orphans last frame's storage, so the driver does not wait for its draws
+  glBufferData(GL_ARRAY_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+  if (bytes > 0) glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, visible.data());
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ModelInstances::release() {
+  model.release();
+  gpu_destroy(instance_buffer);
+}
+
+void ModelInstances::Draw(Shader shader) {
+  if (visible_count == 0) return;
+  for (Mesh& mesh : model.meshes) {
+    mesh.DrawInstanced(shader, visible_count, node_matrices[mesh.node]);
+  }
+}
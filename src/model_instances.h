@@ -0,0 +1,40 @@
+#pragma once
+
+#include "model.h"
+#include "shader.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Many placements of one model, drawn with a single instanced draw per mesh.
+// Per-instance placements are streamed to vertex attributes 4-7, shaders multiply them with
+// the node matrix in the model uniform when the instanced uniform is set.
+class ModelInstances {
+public:
+  Model model;
+  // placement of every instance, translation and uniform scale only
+  std::vector<glm::mat4> transforms;
+  explicit ModelInstances(const Model& model);
+  // the transforms of the instances whose bounds intersect the frustum of view_projection.
+  // Touches no GL state.
+  void cull(const glm::mat4& view_projection, std::vector<glm::mat4>& visible) const;
+  // upload the transforms to draw, growing the instance buffer when needed
+  void upload(const std::vector<glm::mat4>& visible);
+  // draw the instances of the last upload at full detail
+  void Draw(Shader shader);
+  // delete the instance buffer and the GPU objects of the model, see Model::release
+  void release();
+  unsigned int visibleCount() const {
+    return visible_count;
+  }
+
+private:
+  GpuHandle instance_buffer;
+  size_t capacity = 0;
+  unsigned int visible_count = 0;
+  // matrix of every node of the model, relative to the instance transform
+  std::vector<glm::mat4> node_matrices;
+  // bounding sphere of the whole model in model space
+  glm::vec3 center;
+  float radius;
+};
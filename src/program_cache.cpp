@@ -0,0 +1,142 @@
+#include "program_cache.h"
+
+#include "file_map.h"
+
+#include <glad/glad.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// On-disk layout:
+//   ProgramHeader
+//   binary_length bytes of driver-specific program binary
+static const char CACHE_MAGIC[4] = { 'P', 'R', 'G', 'C' };
+
+struct ProgramHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t source_hash;
+  uint64_t driver_hash;
+  uint32_t binary_format;
+  uint32_t binary_length;
+  // seconds it took to build the program from source, for the startup report
+  double compile_time;
+};
+
+// startup statistics
+static unsigned int num_cached = 0, num_compiled = 0, num_rejected = 0;
+static double cached_time = 0.0, compiled_time = 0.0, saved_time = 0.0;
+
+static uint64_t driver_hash() {
+  static uint64_t hash = 0;
+  if (hash == 0) {
+    const GLenum names[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    hash = program_cache_hash("");
+    for (GLenum name : names) {
+      const char* value = (const char*)glGetString(name);
+      hash = program_cache_hash(value ? value : "", hash);
+      hash = program_cache_hash("\n", hash);
+    }
+  }
+  return hash;
+}
+
+bool program_cache_available() {
+  if (!GLAD_GL_ARB_get_program_binary) return false;
+  // the extension may be exposed without a single binary format to save in
+  GLint num_formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+  return num_formats > 0;
+}
+
+uint64_t program_cache_hash(const std::string& data, uint64_t hash) {
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+std::string program_cache_path(const std::string& vertex_path, uint64_t identity) {
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%08x.progbin", (unsigned int)(identity ^ (identity >> 32)));
+  return vertex_path + suffix;
+}
+
+bool program_cache_load(const std::string& cache_path, uint64_t source_hash, unsigned int program) {
+  MappedFile file(cache_path);
+  if (!file.is_open() || file.size() < sizeof(ProgramHeader)) return false;
+  const ProgramHeader* header = (const ProgramHeader*)file.data();
+  if (
+    memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+    header->version != PROGRAM_CACHE_VERSION || header->source_hash != source_hash ||
+    header->driver_hash != driver_hash() ||
+    sizeof(ProgramHeader) + header->binary_length > file.size()) {
+    return false;
+  }
+
+  glProgramBinary(
+    program, header->binary_format, file.data() + sizeof(ProgramHeader), header->binary_length);
+  // drivers reject binaries of other builds even when the version string did not change
+  GLint success;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (!success) {
+    num_rejected++;
+    return false;
+  }
+  saved_time += header->compile_time;
+  return true;
+}
+
+bool program_cache_write(
+  const std::string& cache_path,
+  uint64_t source_hash,
+  unsigned int program,
+  double compile_time) {
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) return false;
+  std::vector<unsigned char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(program, length, &length, &format, binary.data());
+
+  ProgramHeader header;
+  memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  header.version = PROGRAM_CACHE_VERSION;
+  header.source_hash = source_hash;
+  header.driver_hash = driver_hash();
+  header.binary_format = format;
+  header.binary_length = length;
+  header.compile_time = compile_time;
+
+  std::vector<FileChunk> chunks = {
+    { &header, sizeof(header), 0 },
+    { binary.data(), (uint64_t)length, 0 },
+  };
+  return write_file_atomically(cache_path, chunks);
+}
+
+void program_cache_count(bool from_cache, double seconds) {
+  if (from_cache) {
+    num_cached++;
+    cached_time += seconds;
+  } else {
+    num_compiled++;
+    compiled_time += seconds;
+  }
+}
+
+void program_cache_report() {
+  std::cout << "Shader programs: " << num_cached << " from cache in " << cached_time * 1000.0
+            << " ms, " << num_compiled << " compiled in " << compiled_time * 1000.0 << " ms";
+  if (num_cached > 0) {
+    std::cout << ", saved " << (saved_time - cached_time) * 1000.0 << " ms";
+  }
+  if (num_rejected > 0) {
+    std::cout << ", " << num_rejected << " binaries rejected by the driver";
+  }
+  if (!program_cache_available()) std::cout << " (no program binary support)";
+  std::cout << std::endl;
+}
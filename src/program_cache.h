@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Linked program cache. Programs are saved with glGetProgramBinary after their first link and
+// restored with glProgramBinary on later launches, skipping compilation. Each file records a
+// hash of the sources it was built from and of the GL vendor/renderer/version strings; a
+// mismatch on either, or the driver rejecting the binary, falls back to compiling from source.
+// Bump the version whenever the file layout changes so stale caches are rebuilt.
+#define PROGRAM_CACHE_VERSION 1
+
+// whether the driver can save and restore program binaries
+bool program_cache_available();
+// FNV-1a over data, chained through hash
+uint64_t program_cache_hash(const std::string& data, uint64_t hash = 14695981039346656037ull);
+// path of the cache file of a program, identity tells apart programs sharing a vertex shader
+std::string program_cache_path(const std::string& vertex_path, uint64_t identity);
+// restore program from the cache at cache_path. Returns false, leaving program unlinked, if
+// the cache is missing, built from other sources or by another driver, or rejected.
+bool program_cache_load(const std::string& cache_path, uint64_t source_hash, unsigned int program);
+// save a linked program that was created with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+// compile_time is how long building it from source took, in seconds.
+bool program_cache_write(
+  const std::string& cache_path,
+  uint64_t source_hash,
+  unsigned int program,
+  double compile_time);
+
+// account for a program built in seconds, restored from the cache or compiled
+void program_cache_count(bool from_cache, double seconds);
+// print how many programs came from the cache and the compile time that saved
+void program_cache_report();
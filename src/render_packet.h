@@ -0,0 +1,45 @@
+#pragma once
+#include "command_buffer.h"
+#include "mesh.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// one mesh of the scene as it is drawn in a frame
+struct MeshDrawItem {
+  Mesh* mesh;
+  glm::mat4 model;
+  MeshDraw draw;
+  // sort key, the texture array bucket of the mesh and the position it was gathered at
+  int bucket;
+  unsigned int order;
+};
+
+// Everything the GL thread needs to submit a frame, prepared without touching GL. Two of them
+// alternate: one is built for the next frame while the other is drawn.
+struct RenderPacket {
+  glm::mat4 projection, view;
+  glm::vec3 camera_pos;
+  // meshes to draw, the first num_items are in use. Items are reused between frames so their
+  // draw ranges keep their allocations.
+  std::vector<MeshDrawItem> items;
+  size_t num_items = 0;
+  // with command recording, the draws of the items in order, a buffer per chunk of consecutive
+  // items. The first num_command_buffers are in use, none without recording.
+  std::vector<CommandBuffer> commands;
+  size_t num_command_buffers = 0;
+  // wall time of recording them
+  double record_time = 0;
+  // visible placements of every entry of Scene::instanced_objects
+  std::vector<std::vector<glm::mat4>> instances;
+  // simulation steps taken while building this packet, and with CPU animation the light
+  // positions after the last two of them, older first, when there were that many
+  unsigned int simulation_steps = 0;
+  bool gpu_animation = false;
+  std::vector<glm::vec4> light_steps[2];
+  float simulation_alpha = 0;
+  // CPU seconds spent on the simulation steps
+  double simulation_time = 0;
+  unsigned int triangles_submitted = 0;
+  unsigned int triangles_drawn = 0;
+};
@@ -1,12 +1,19 @@
 #include "renderer.h"
 
+#include "frame_arena.h"
+#include "gl_state.h"
+#include "gpu_resources.h"
+#include "job_system.h"
 #include "light.h"
+#include "light_buffers.h"
 #include "mesh.h"
 #include "stb_image.h"
+#include "uniform_ring.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
 #include <iostream>
 #include <stdlib.h>
 #include <time.h>
@@ -16,8 +23,44 @@
 #endif
 
 #define USE_DEFERRED_SHADING
+// rebuild shaders when their sources change on disk
+#define SHADER_HOT_RELOAD
 
-#define NR_LIGHTS 100 // also update in deferred_light.fs
+// raise to 10k+ to compare animating the lights on the CPU and on the GPU (key G)
+#define NR_LIGHTS 100
+
+// replace sponza by a grid of nanosuits to measure how level of detail scales
+// #define NANOSUIT_FIELD
+#define NANOSUIT_FIELD_SIZE 20
+#define NANOSUIT_FIELD_SPACING 1.0f
+
+// mesh draws recorded per command buffer, each buffer is a job
+#define COMMAND_CHUNK_ITEMS 256
+
+// abort at the first heap allocation after HEAP_CHECK_WARMUP_FRAMES frames. Toggling options
+// compiles variants and grows buffers, so only for runs that leave them alone.
+// #define ASSERT_NO_HEAP_ALLOCATIONS
+#define HEAP_CHECK_WARMUP_FRAMES 100
+
+// replace sponza by 1 to 10k nanosuits, each count drawn instanced and then as separate
+// objects for BENCHMARK_STEP_TIME seconds
+// #define INSTANCING_BENCHMARK
+#define BENCHMARK_STEP_TIME 3.0f
+static const unsigned int BENCHMARK_COUNTS[] = { 1, 10, 100, 1000, 10000 };
+#define BENCHMARK_STEPS (2 * sizeof(BENCHMARK_COUNTS) / sizeof(BENCHMARK_COUNTS[0]))
+
+// world units per unit of the loaded models
+#define MODEL_SCALE 0.02f
+
+// largest geometric error of a level of detail, in pixels on screen
+#define LOD_ERROR_PIXELS 1.0f
+// seconds between frame statistics reports
+#define STATS_INTERVAL 2.0f
+
+// the simulation advances in steps of fixed length, independent of the frame rate
+#define SIMULATION_STEP (1.0f / 60.0f)
+// steps caught up with per frame at most, slower frames make the simulation fall behind
+#define MAX_SIMULATION_STEPS 5
 
 #define FORWARD_VERTEX_SHADER_PATH "shaders/forward_model.vs"
 #define FORWARD_FRAGMENT_SHADER_PATH "shaders/forward_model.fs"
@@ -25,6 +68,12 @@
 #define DEFERRED_GEOMETRY_FRAGMENT_SHADER_PATH "shaders/deferred_geometry.fs"
 #define DEFERRED_LIGHT_VERTEX_SHADER_PATH "shaders/deferred_light.vs"
 #define DEFERRED_LIGHT_FRAGMENT_SHADER_PATH "shaders/deferred_light.fs"
+// options of the shader variants, bits of their flags
+#define VARIANT_SPECULAR 1
+#define VARIANT_COMPACT_GBUFFER 2
+#define VARIANT_BINDLESS 4
+// fewest lights a lighting variant is compiled for, see light_count_bucket
+#define MIN_LIGHT_BUCKET 16
 
 #ifdef __APPLE__ // apple retina displays behave strangely
 #define _WINDOW_WIDTH 640
@@ -66,6 +115,26 @@ const static float quad_vertices[] = {
   1.0f,  1.0f, 0.0f, 1.0f, 1.0f, 1.0f,  -1.0f, 0.0f, 1.0f, 0.0f,
 };
 
+// position of instance i of count on a square grid centered on the origin
+static glm::vec3 field_position(unsigned int i, unsigned int count, float spacing) {
+  unsigned int side = (unsigned int)std::ceil(std::sqrt((float)count));
+  float half = (side - 1) * 0.5f;
+  return glm::vec3(i % side - half, 0, i / side - half) * spacing;
+}
+
+// light count a lighting variant is compiled for: the next power of two, so that a changing
+// light count only ever needs a handful of variants
+static unsigned int light_count_bucket(unsigned int count) {
+  unsigned int bucket = MIN_LIGHT_BUCKET;
+  while (bucket < count) bucket *= 2;
+  return bucket;
+}
+
+// texture array bucket of a mesh, -1 for meshes binding their own textures
+static int material_bucket(const Mesh& mesh) {
+  return mesh.material >= 0 ? mesh.texture_arrays->bucket(mesh.material) : -1;
+}
+
 Renderer* Renderer::instance = nullptr;
 Renderer* callback_handler = nullptr;
 
@@ -88,10 +157,17 @@ Renderer* Renderer::get_instance() {
   return instance;
 }
 
+void Renderer::destroy() {
+  delete instance;
+  instance = nullptr;
+  callback_handler = nullptr;
+}
+
 Renderer::Renderer() {
   callback_handler = this;
   srand(time(NULL));
   glfwInit();
+  startup_start = glfwGetTime();
   // make sure the opengl version is 3.3
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -112,6 +188,11 @@ Renderer::Renderer() {
     std::cout << "Failed to initialize GLAD" << std::endl;
     exit(1);
   }
+  shader_compiler_init();
+  uniform_ring_init();
+#ifdef SHADER_HOT_RELOAD
+  shader_hot_reload_init();
+#endif // SHADER_HOT_RELOAD
 
   int frameBufferWidth, frameBufferHeight;
   glfwGetFramebufferSize(window, &frameBufferWidth, &frameBufferHeight);
@@ -119,27 +200,57 @@ Renderer::Renderer() {
   WINDOW_WIDTH = frameBufferWidth;
 
   // use Z-buffer
-  glEnable(GL_DEPTH_TEST);
+  gl_set_enabled(GL_DEPTH_TEST, true);
 
   // compile and initialize shaders
-  forward_shader = new Shader(FORWARD_VERTEX_SHADER_PATH, FORWARD_FRAGMENT_SHADER_PATH);
+  forward_variants = new ShaderVariants(
+    FORWARD_VERTEX_SHADER_PATH,
+    FORWARD_FRAGMENT_SHADER_PATH,
+    { "SPECULAR", "COMPACT_GBUFFER", "BINDLESS" });
+  texture_arrays = new TextureArrays();
 
 #ifdef USE_DEFERRED_SHADING
   init_deferred_engine();
 #endif // USE_DEFERRED_SHADING
+  select_variants(NR_LIGHTS);
+  // issue every compile before loading the model, the driver works on them meanwhile
+  PointLight::setupLight();
 
   // initialize scene
   scene = Scene();
   // load model here
   char actual_path[PATH_MAX + 1];
+#if defined(INSTANCING_BENCHMARK)
+  char* ptr = realpath("res/models/nanosuit/nanosuit.obj", actual_path);
+  Model model = Model(actual_path, glm::vec3(0, 0, 0), VERTEX_FORMAT_COMPACT);
+  model.useTextureArrays(*texture_arrays);
+  benchmark_model = scene.add_model(model);
+  scene.instanced_objects.push_back(ModelInstances(model));
+  start_benchmark_step(0, glfwGetTime());
+#elif defined(NANOSUIT_FIELD)
+  char* ptr = realpath("res/models/nanosuit/nanosuit.obj", actual_path);
+  Model model = Model(actual_path, glm::vec3(0, 0, 0), VERTEX_FORMAT_COMPACT);
+  model.useTextureArrays(*texture_arrays);
+
+  // the objects share the model but select their level of detail separately
+  unsigned int model_index = scene.add_model(model);
+  unsigned int count = NANOSUIT_FIELD_SIZE * NANOSUIT_FIELD_SIZE;
+  for (unsigned int i = 0; i < count; i++) {
+    scene.add_object(model_index, field_position(i, count, NANOSUIT_FIELD_SPACING), MODEL_SCALE);
+  }
+#else
   char* ptr = realpath("res/models/sponza/sponza.obj", actual_path);
-  Model model = Model(actual_path, glm::vec3(0, 0, 0));
+  // sponza is large enough that halving its vertex fetch bandwidth pays off
+  Model model = Model(actual_path, glm::vec3(0, 0, 0), VERTEX_FORMAT_COMPACT);
+  model.useTextureArrays(*texture_arrays);
 
   // load models to the scene
+  unsigned int model_index = scene.add_model(model);
   for (int i = 0; i < 1; i++) {
-    model.pos = glm::vec3(0, 0, -1.0f * i);
-    scene.objects.push_back(model);
+    scene.add_object(model_index, glm::vec3(0, 0, -1.0f * i), MODEL_SCALE);
   }
+#endif // INSTANCING_BENCHMARK
+  texture_arrays->build();
 
   // load lights to the scene
   for (int i = 0; i < NR_LIGHTS; i++) {
@@ -148,14 +259,18 @@ Renderer::Renderer() {
       RAND_DIST(LIGHT_POS_MIN.y, LIGHT_POS_MAX.y),
       RAND_DIST(LIGHT_POS_MIN.z, LIGHT_POS_MAX.z));
     glm::vec3 color(RAND_DIST(0.5f, 1.0f), RAND_DIST(0.5f, 1.0f), RAND_DIST(0.5f, 1.0f));
-    PointLight light = PointLight(
+    scene.add_light(
       pos,
       color,
       1.0f,
       RAND_DIST(0, 1) > 0.5 ? LIGHT_DIR_UP : LIGHT_DIR_DOWN,
-      RAND_DIST(0.1f, 2.0f));
-    scene.point_lights.push_back(light);
+      RAND_DIST(0.1f, 2.0f),
+      LIGHT_POS_MIN.y,
+      LIGHT_POS_MAX.y);
   }
+  light_buffers = new LightBuffers();
+  light_buffers->init(scene);
+  worker = new WorkerThread();
 
   // register the callback functions
   glfwSetFramebufferSizeCallback(window, resize_callback);
@@ -165,6 +280,9 @@ Renderer::Renderer() {
   // capture mouse
   glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
+  // loading bound textures and buffers without the state cache
+  gl_state_invalidate();
+
   // initialize viewing parameters
   camera_pos = DEFAULT_CAMERA_POS;
   camera_dir = DEFAULT_CAMERA_DIR;
@@ -174,37 +292,45 @@ Renderer::Renderer() {
 }
 
 void Renderer::init_deferred_engine() {
-  deferred_geometry_shader =
-    new Shader(DEFERRED_GEOMETRY_VERTEX_SHADER_PATH, DEFERRED_GEOMETRY_FRAGMENT_SHADER_PATH);
-  deferred_light_shader =
-    new Shader(DEFERRED_LIGHT_VERTEX_SHADER_PATH, DEFERRED_LIGHT_FRAGMENT_SHADER_PATH);
-
-  glGenFramebuffers(1, &gBuffer);
-  glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
+  deferred_geometry_variants = new ShaderVariants(
+    DEFERRED_GEOMETRY_VERTEX_SHADER_PATH,
+    DEFERRED_GEOMETRY_FRAGMENT_SHADER_PATH,
+    { "SPECULAR", "COMPACT_GBUFFER", "BINDLESS" });
+  deferred_light_variants = new ShaderVariants(
+    DEFERRED_LIGHT_VERTEX_SHADER_PATH,
+    DEFERRED_LIGHT_FRAGMENT_SHADER_PATH,
+    { "SPECULAR", "COMPACT_GBUFFER" },
+    "MAX_LIGHTS");
+  geometry_timer = new GpuTimer("Geometry pass");
+
+  gBuffer = gpu_create(GPU_FRAMEBUFFER, "g-buffer");
+  gl_bind_framebuffer(GL_FRAMEBUFFER, gpu_name(gBuffer));
   // add attachments to the g-buffer
   // - position color buffer
-  glGenTextures(1, &gPosition);
-  glBindTexture(GL_TEXTURE_2D, gPosition);
+  gPosition = gpu_create(GPU_TEXTURE, "g-buffer position");
+  gl_edit_texture(GL_TEXTURE_2D, gpu_name(gPosition));
   glTexImage2D(
     GL_TEXTURE_2D, 0, GL_RGB16F, WINDOW_WIDTH, WINDOW_HEIGHT, 0, GL_RGB, GL_FLOAT, nullptr);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gPosition, 0);
+  glFramebufferTexture2D(
+    GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gpu_name(gPosition), 0);
   // - normal color buffer
-  glGenTextures(1, &gNormal);
-  glBindTexture(GL_TEXTURE_2D, gNormal);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, WINDOW_WIDTH, WINDOW_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
+  gNormal = gpu_create(GPU_TEXTURE, "g-buffer normal");
+  allocate_normal_buffer();
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gNormal, 0);
+  glFramebufferTexture2D(
+    GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gpu_name(gNormal), 0);
   // - color + specular buffer
-  glGenTextures(1, &gColorSpec);
-  glBindTexture(GL_TEXTURE_2D, gColorSpec);
+  gColorSpec = gpu_create(GPU_TEXTURE, "g-buffer color and specular");
+  gl_edit_texture(GL_TEXTURE_2D, gpu_name(gColorSpec));
   glTexImage2D(
     GL_TEXTURE_2D, 0, GL_RGBA, WINDOW_WIDTH, WINDOW_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gColorSpec, 0);
+  glFramebufferTexture2D(
+    GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gpu_name(gColorSpec), 0);
 
   // tell opengl which color buffers to draw into
   unsigned int attachments[3] = { GL_COLOR_ATTACHMENT0,
@@ -212,75 +338,318 @@ void Renderer::init_deferred_engine() {
                                   GL_COLOR_ATTACHMENT2 };
   glDrawBuffers(3, attachments);
 
-  glGenRenderbuffers(1, &rbo_depth);
-  glBindRenderbuffer(GL_RENDERBUFFER, rbo_depth);
+  rbo_depth = gpu_create(GPU_RENDERBUFFER, "g-buffer depth");
+  glBindRenderbuffer(GL_RENDERBUFFER, gpu_name(rbo_depth));
   glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, WINDOW_WIDTH, WINDOW_HEIGHT);
-  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rbo_depth);
+  glFramebufferRenderbuffer(
+    GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, gpu_name(rbo_depth));
   // check if framebuffer is complete
   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
     std::cout << "Incomplete framebuffer" << std::endl;
   }
   // release the g-buffer after initialization
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+
+  // full screen quad for the lighting pass. Made here rather than on first use, the registry
+  // must not change while the worker resolves handles.
+  quad_vao = gpu_create(GPU_VERTEX_ARRAY, "quad");
+  quad_vbo = gpu_create(GPU_BUFFER, "quad vertices");
+  gl_bind_vertex_array(gpu_name(quad_vao));
+  glBindBuffer(GL_ARRAY_BUFFER, gpu_name(quad_vbo));
+  glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), &quad_vertices, GL_STATIC_DRAW);
+  // vec3 pos, vec2 texture coord
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+}
 
-  // map texture IDs
-  deferred_light_shader->use();
-  deferred_light_shader->set_int("gPosition", 0);
-  deferred_light_shader->set_int("gNormal", 1);
-  deferred_light_shader->set_int("gColorSpec", 2);
+void Renderer::allocate_normal_buffer() {
+  gl_edit_texture(GL_TEXTURE_2D, gpu_name(gNormal));
+  // compact normals are octahedron-encoded to two channels
+  if (use_compact_gbuffer) {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, WINDOW_WIDTH, WINDOW_HEIGHT, 0, GL_RG, GL_FLOAT, NULL);
+  } else {
+    glTexImage2D(
+      GL_TEXTURE_2D, 0, GL_RGB16F, WINDOW_WIDTH, WINDOW_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
+  }
+}
+
+void Renderer::select_variants(unsigned int num_lights) {
+  unsigned int flags = (use_specular ? VARIANT_SPECULAR : 0) |
+    (use_compact_gbuffer ? VARIANT_COMPACT_GBUFFER : 0) |
+    (texture_arrays->bindless() ? VARIANT_BINDLESS : 0);
+  // each program only gets the options it reads, so no two variants are the same program
+  forward_shader = forward_variants->get(flags & (VARIANT_SPECULAR | VARIANT_BINDLESS));
+#ifdef USE_DEFERRED_SHADING
+  deferred_geometry_shader =
+    deferred_geometry_variants->get(flags & (VARIANT_COMPACT_GBUFFER | VARIANT_BINDLESS));
+  unsigned int bucket = light_count_bucket(num_lights);
+  unsigned int light_flags = flags & (VARIANT_SPECULAR | VARIANT_COMPACT_GBUFFER);
+  deferred_light_shader = deferred_light_variants->get(light_flags, bucket);
+  GpuTimer*& timer = lighting_timers[deferred_light_shader];
+  if (!timer) {
+    timer =
+      new GpuTimer("Lighting pass (" + deferred_light_variants->name(light_flags, bucket) + ")");
+  }
+  lighting_timer = timer;
+#endif // USE_DEFERRED_SHADING
 }
 
 Renderer::~Renderer() {
-  delete forward_shader;
-  delete deferred_geometry_shader;
-  delete deferred_light_shader;
+  delete worker;
+  delete forward_variants;
+  delete deferred_geometry_variants;
+  delete deferred_light_variants;
+  delete geometry_timer;
+  for (auto& timer : lighting_timers) delete timer.second;
+  delete light_buffers;
+  delete texture_arrays;
+  PointLight::release();
+  // copies of a model share their objects, releasing each copy deletes them once
+  for (Model& model : scene.models) model.release();
+  for (ModelInstances& instances : scene.instanced_objects) instances.release();
+  gpu_destroy(gBuffer);
+  gpu_destroy(gPosition);
+  gpu_destroy(gNormal);
+  gpu_destroy(gColorSpec);
+  gpu_destroy(rbo_depth);
+  gpu_destroy(quad_vao);
+  gpu_destroy(quad_vbo);
+  gpu_resources_shutdown();
+  uniform_ring_destroy();
   // clean all of the GLFW's resources
   glfwTerminate();
 }
 
+#ifdef ASSERT_NO_HEAP_ALLOCATIONS
+static void forbid_heap_allocation(size_t size) {
+  // printing may allocate too
+  set_heap_allocation_hook(nullptr);
+  std::cout << "Heap allocation of " << size << " bytes in the render loop" << std::endl;
+  abort();
+}
+#endif // ASSERT_NO_HEAP_ALLOCATIONS
+
 void Renderer::loop() {
+#ifdef ASSERT_NO_HEAP_ALLOCATIONS
+  unsigned int frames_rendered = 0;
+#endif // ASSERT_NO_HEAP_ALLOCATIONS
   while (!glfwWindowShouldClose(window)) {
     // calculate frametime
     float t = glfwGetTime();
     dt = t - t_prev;
     t_prev = t;
+    // the worker is idle, transient memory of the last frame can be reused
+    frame_arena_new_frame();
 
-    // process input
+    // process input, the worker is idle so the scene and the camera may change
     handle_keyboard();
+    poll_shaders();
 
     // clear color buffer and depth buffer
     glClearColor(0, 0, 0, 1);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // apply transformations and draw
-    render();
-
-    // move lights
-    update();
+    if (use_pipeline) {
+      // the worker prepares the next frame while this thread submits the one prepared last
+      RenderPacket& next = packets[1 - submit_index];
+      worker->run([this, &next] { build_packet(next); });
+      submit_packet(packets[submit_index]);
+      worker->wait();
+      submit_index = 1 - submit_index;
+    } else {
+      build_packet(packets[submit_index]);
+      submit_packet(packets[submit_index]);
+    }
+    frame_cpu_time += glfwGetTime() - t;
+
+    // report frame time and drawn triangles
+    stats_frames++;
+    if (t - stats_start >= STATS_INTERVAL) {
+      // CPU time of every thread of the process, over the time that passed
+      std::clock_t cpu = std::clock();
+      double cores = (double)(cpu - stats_cpu_start) / CLOCKS_PER_SEC / (t - stats_start);
+      std::cout << "Frame time " << (t - stats_start) * 1000.0f / stats_frames << " ms, "
+                << triangles_submitted << " triangles submitted, " << triangles_drawn
+                << " visible (LOD " << (use_lod ? "on" : "off") << ", meshlet culling "
+                << (use_meshlet_culling ? "on" : "off") << ")" << std::endl;
+      std::cout << "CPU frame time (" << (use_pipeline ? "pipelined" : "serial") << "): "
+                << frame_cpu_time * 1000.0f / stats_frames << " ms, " << cores
+                << " cores busy" << std::endl;
+      std::cout << "Light update (" << (light_buffers->gpu_animation() ? "GPU" : "CPU")
+                << " animation, " << light_buffers->count() << " lights): "
+                << light_update_time * 1000.0f / stats_frames << " ms CPU, "
+                << light_upload_bytes / 1024.0f / stats_frames << " KB uploaded per frame"
+                << std::endl;
+      std::cout << "Draw submission (" << (use_command_buffers ? "recorded" : "direct")
+                << "): " << item_submit_time * 1000.0 / stats_frames << " ms on the GL thread, "
+                << record_time * 1000.0 / stats_frames << " ms recording, "
+                << (double)num_commands / stats_frames << " commands in "
+                << command_bytes / 1024.0 / stats_frames << " KB per frame" << std::endl;
+      uniform_ring_report(stats_frames);
+      gl_state_report(stats_frames);
+      frame_arena_report(stats_frames);
+      gpu_resources_report();
+      stats_start = t;
+      stats_cpu_start = cpu;
+      stats_frames = 0;
+      frame_cpu_time = 0;
+      light_update_time = 0;
+      light_upload_bytes = 0;
+      record_time = item_submit_time = 0;
+      command_bytes = 0;
+      num_commands = 0;
+    }
+#ifdef INSTANCING_BENCHMARK
+    update_benchmark(t);
+#endif // INSTANCING_BENCHMARK
 
     // check and call events and swap the buffers
     glfwSwapBuffers(window);
     glfwPollEvents();
+
+    if (!first_frame_done) {
+      first_frame_done = true;
+      std::cout << "Time to first frame: " << (glfwGetTime() - startup_start) * 1000.0 << " ms"
+                << std::endl;
+      shader_compile_report();
+    }
+#ifdef ASSERT_NO_HEAP_ALLOCATIONS
+    if (++frames_rendered == HEAP_CHECK_WARMUP_FRAMES)
+      set_heap_allocation_hook(forbid_heap_allocation);
+#endif // ASSERT_NO_HEAP_ALLOCATIONS
   }
+  set_heap_allocation_hook(nullptr);
 }
 
-void Renderer::render() {
-  glm::mat4 projection = glm::mat4(1.0f);
-  projection =
+void Renderer::build_packet(RenderPacket& packet) {
+  // move lights in as many fixed steps as fit the elapsed time
+  double start = glfwGetTime();
+  simulation_time += dt;
+  unsigned int steps = std::min(
+    (unsigned int)(simulation_time / SIMULATION_STEP), (unsigned int)MAX_SIMULATION_STEPS);
+  packet.gpu_animation = light_buffers->gpu_animation();
+  for (unsigned int i = 0; i < steps; i++) {
+    // with GPU animation the steps are taken by light_buffers on submission
+    if (packet.gpu_animation) continue;
+    update();
+    // frames interpolate between the last two steps, older ones are never seen
+    if (i + 2 >= steps) LightBuffers::gather_positions(scene, packet.light_steps[i + 2 - steps]);
+  }
+  simulation_time -= steps * SIMULATION_STEP;
+  if (steps == MAX_SIMULATION_STEPS)
+    simulation_time = std::fmod(simulation_time, SIMULATION_STEP);
+  packet.simulation_steps = steps;
+  // the frame shows the state this far from the previous step to the last one
+  packet.simulation_alpha = simulation_time / SIMULATION_STEP;
+  packet.simulation_time = glfwGetTime() - start;
+
+  packet.projection =
     glm::perspective(glm::radians(fov), (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
+  packet.view = glm::lookAt(camera_pos, camera_pos + camera_dir, WORLD_SPACE_UP);
+  packet.camera_pos = camera_pos;
+  gather_draws(packet);
+}
+
+void Renderer::gather_draws(RenderPacket& packet) {
+  glm::mat4 view_projection = packet.projection * packet.view;
+  // bring world matrices of moved objects up to date
+  scene.hierarchy.update();
+  packet.triangles_submitted = 0;
+  packet.triangles_drawn = 0;
+
+  packet.num_items = 0;
+  for (unsigned int i = 0; i < scene.renderables.index.size(); i++) {
+    Model& object = scene.models[scene.renderables.model[i]];
+    // the selected levels of detail persist between frames
+    const std::vector<MeshDraw>& draws = scene.renderables.draws[i];
+    int node = scene.transforms.node[scene.transforms.index.row(scene.renderables.index.entity(i))];
+    prepare_draw(i, node, view_projection);
+    for (unsigned int j = 0; j < object.meshes.size(); j++) {
+      Mesh& mesh = object.meshes[j];
+      if (packet.num_items == packet.items.size()) packet.items.push_back(MeshDrawItem());
+      MeshDrawItem& item = packet.items[packet.num_items];
+      item.mesh = &mesh;
+      item.bucket = material_bucket(mesh);
+      item.order = packet.num_items++;
+      item.model = object.meshTransform(scene.hierarchy, node, mesh);
+      // assignment keeps the allocations of the item
+      item.draw = draws[j];
+    }
+    packet.triangles_submitted += object.triangleCount(draws);
+    packet.triangles_drawn += object.visibleTriangleCount(draws);
+  }
+  // meshes drawing from the same texture arrays go together, their arrays are bound once.
+  // Ties keep the gathering order; std::stable_sort would allocate a buffer every frame.
+  std::sort(
+    packet.items.begin(),
+    packet.items.begin() + packet.num_items,
+    [](const MeshDrawItem& a, const MeshDrawItem& b) {
+      return a.bucket != b.bucket ? a.bucket < b.bucket : a.order < b.order;
+    });
+
+  packet.num_command_buffers = 0;
+  packet.record_time = 0;
+  if (use_command_buffers) record_commands(packet);
+
+  packet.instances.resize(scene.instanced_objects.size());
+  for (unsigned int i = 0; i < scene.instanced_objects.size(); i++) {
+    const ModelInstances& instances = scene.instanced_objects[i];
+    packet.instances[i].clear();
+    instances.cull(view_projection, packet.instances[i]);
+    unsigned int triangles = packet.instances[i].size() * instances.model.triangleCount();
+    packet.triangles_submitted += triangles;
+    packet.triangles_drawn += triangles;
+  }
+}
 
-  glm::mat4 view = glm::mat4(1.0f);
-  view = glm::lookAt(camera_pos, camera_pos + camera_dir, WORLD_SPACE_UP);
+void Renderer::submit_packet(const RenderPacket& packet) {
+  // apply the simulation steps to the lights on the GPU
+  double start = glfwGetTime();
+  unsigned int steps = packet.simulation_steps;
+  for (unsigned int i = 0; i < steps; i++) {
+    if (packet.gpu_animation)
+      light_buffers->animate_step(SIMULATION_STEP);
+    else if (i + 2 >= steps)
+      light_buffers->upload_step(packet.light_steps[i + 2 - steps]);
+    else
+      continue;
+    light_upload_bytes += light_buffers->uploaded_bytes();
+  }
+  light_update_time += packet.simulation_time + glfwGetTime() - start;
+  triangles_submitted = packet.triangles_submitted;
+  triangles_drawn = packet.triangles_drawn;
+  record_time += packet.record_time;
+  select_variants(light_buffers->count());
+
+  // constants every pass of the frame reads
+  uniform_ring_begin_frame();
+  FrameConstants frame;
+  frame.projection = packet.projection;
+  frame.view = packet.view;
+  frame.view_pos = glm::vec4(packet.camera_pos, 1.0f);
+  uniform_ring_push(FRAME_BLOCK_BINDING, frame);
+  LightingConstants lighting;
+  lighting.num_lights = light_buffers->count();
+  lighting.light_linear = LIGHT_ATTENUATION_LINEAR;
+  lighting.light_quadratic = LIGHT_ATTENUATION_QUADRATIC;
+  lighting.light_alpha = packet.simulation_alpha;
+  uniform_ring_push(LIGHTING_BLOCK_BINDING, lighting);
 
 #ifdef USE_DEFERRED_SHADING
   // perform deferred rendering
-  render_geometry(projection, view);
+  geometry_timer->begin();
+  render_geometry(packet);
+  geometry_timer->end();
+  lighting_timer->begin();
   render_lighting();
   render_quad();
+  lighting_timer->end();
 
   // copy depth information from gbuffer to default framebuffer
-  glBindFramebuffer(GL_READ_FRAMEBUFFER, gBuffer);
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  gl_bind_framebuffer(GL_READ_FRAMEBUFFER, gpu_name(gBuffer));
+  gl_bind_framebuffer(GL_DRAW_FRAMEBUFFER, 0);
   glBlitFramebuffer(
     0,
     0,
@@ -292,116 +661,162 @@ void Renderer::render() {
     WINDOW_HEIGHT,
     GL_DEPTH_BUFFER_BIT,
     GL_NEAREST);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
 #else  // forward shading
   forward_shader->use();
-  // set uniforms
-  forward_shader->set_mat4("projection", projection);
-  forward_shader->set_mat4("view", view);
-  forward_shader->set_vec3("view_pos", camera_pos);
-  forward_shader->set_vec3("light_pos", camera_pos);
+  texture_arrays->bind_table(*forward_shader);
 
   // render all of the objects
-  for (unsigned int i = 0; i < scene.objects.size(); i++) {
-    Model object = scene.objects[i];
-    glm::mat4 model = glm::mat4(1.0f);
-    model = glm::translate(model, object.pos);
-    model = glm::scale(model, glm::vec3(0.1f, 0.1f, 0.1f));
-    forward_shader->set_mat4("model", model);
-    object.Draw(*forward_shader);
-  }
+  render_items(*forward_shader, packet);
+  render_instances(*forward_shader, packet);
 #endif // USE_DEFERRED_SHADING
 
   // render all of the light source using forward shading
   // the shader is bound with the lighting class.
   if (render_light_cubes) {
-    for (unsigned int i = 0; i < scene.point_lights.size(); i++) {
-      scene.point_lights[i].draw(projection, view);
-    }
+    PointLight::draw(
+      light_buffers->previous_position_buffer(),
+      light_buffers->position_buffer(),
+      light_buffers->attribute_buffer(),
+      light_buffers->count());
   }
+  uniform_ring_end_frame();
 }
 
-void Renderer::render_geometry(const glm::mat4& projection, const glm::mat4& view) {
+void Renderer::render_geometry(const RenderPacket& packet) {
   // geometry pass
-  glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
+  gl_bind_framebuffer(GL_FRAMEBUFFER, gpu_name(gBuffer));
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   deferred_geometry_shader->use();
-  deferred_geometry_shader->set_mat4("projection", projection);
-  deferred_geometry_shader->set_mat4("view", view);
-  for (unsigned int i = 0; i < scene.objects.size(); i++) {
-    Model* object = &scene.objects[i];
-    glm::mat4 model = glm::mat4(1.0f);
-    model = glm::translate(model, object->pos);
-    model = glm::scale(model, glm::vec3(0.02f, 0.02f, 0.02f));
-    deferred_geometry_shader->set_mat4("model", model);
-    object->Draw(*deferred_geometry_shader);
+  texture_arrays->bind_table(*deferred_geometry_shader);
+  render_items(*deferred_geometry_shader, packet);
+  render_instances(*deferred_geometry_shader, packet);
+}
+
+void Renderer::record_commands(RenderPacket& packet) {
+  double start = glfwGetTime();
+  size_t chunks = (packet.num_items + COMMAND_CHUNK_ITEMS - 1) / COMMAND_CHUNK_ITEMS;
+  if (packet.commands.size() < chunks) packet.commands.resize(chunks);
+  // every chunk has a buffer of its own, so jobs never share one and the order is kept
+  parallel_for(0, chunks, 1, [&packet](size_t first, size_t last) {
+    for (size_t chunk = first; chunk < last; chunk++) {
+      CommandBuffer& commands = packet.commands[chunk];
+      commands.reset();
+      size_t end = std::min(packet.num_items, (chunk + 1) * COMMAND_CHUNK_ITEMS);
+      for (size_t i = chunk * COMMAND_CHUNK_ITEMS; i < end; i++) {
+        const MeshDrawItem& item = packet.items[i];
+        item.mesh->recordDraw(commands, item.draw, item.model);
+      }
+    }
+  });
+  packet.num_command_buffers = chunks;
+  packet.record_time = glfwGetTime() - start;
+}
+
+void Renderer::render_items(Shader& shader, const RenderPacket& packet) {
+  double start = glfwGetTime();
+  if (packet.num_command_buffers > 0) {
+    for (size_t i = 0; i < packet.num_command_buffers; i++) {
+      const CommandBuffer& commands = packet.commands[i];
+      commands.execute(shader);
+      num_commands += commands.command_count();
+      command_bytes += commands.byte_size();
+    }
+  } else {
+    for (size_t i = 0; i < packet.num_items; i++) {
+      const MeshDrawItem& item = packet.items[i];
+      item.mesh->Draw(shader, item.draw, item.model);
+    }
+  }
+  item_submit_time += glfwGetTime() - start;
+}
+
+void Renderer::prepare_draw(unsigned int row, int node, const glm::mat4& view_projection) {
+  const Model& object = scene.models[scene.renderables.model[row]];
+  std::vector<MeshDraw>& draws = scene.renderables.draws[row];
+  // screen size in pixels of one world unit at distance 1
+  float pixels_per_unit = WINDOW_HEIGHT / (2.0f * std::tan(glm::radians(fov) * 0.5f));
+  // a negative budget keeps every mesh at full detail
+  float max_error = use_lod ? LOD_ERROR_PIXELS : -1.0f;
+  object.updateLod(scene.hierarchy, node, draws, camera_pos, pixels_per_unit, max_error);
+  if (use_meshlet_culling)
+    object.cullMeshlets(scene.hierarchy, node, draws, view_projection, camera_pos, true);
+  else
+    object.resetCulling(draws);
+}
+
+void Renderer::render_instances(Shader& shader, const RenderPacket& packet) {
+  for (unsigned int i = 0; i < packet.instances.size(); i++) {
+    ModelInstances& instances = scene.instanced_objects[i];
+    instances.upload(packet.instances[i]);
+    instances.Draw(shader);
+  }
+}
+
+void Renderer::start_benchmark_step(unsigned int step, float t) {
+  // even steps draw the count instanced, odd steps as separate objects
+  unsigned int count = BENCHMARK_COUNTS[step / 2];
+  bool instanced = step % 2 == 0;
+  ModelInstances& instances = scene.instanced_objects[0];
+  instances.transforms.clear();
+  scene.clear_objects();
+  for (unsigned int i = 0; i < count; i++) {
+    glm::vec3 pos = field_position(i, count, NANOSUIT_FIELD_SPACING);
+    if (instanced)
+      instances.transforms.push_back(placement_matrix(pos, MODEL_SCALE));
+    else
+      scene.add_object(benchmark_model, pos, MODEL_SCALE);
+  }
+  benchmark_step = step;
+  benchmark_start = t;
+  benchmark_frames = 0;
+}
+
+void Renderer::update_benchmark(float t) {
+  if (benchmark_step >= BENCHMARK_STEPS) return;
+  benchmark_frames++;
+  if (t - benchmark_start < BENCHMARK_STEP_TIME) return;
+  std::cout << "Benchmark: " << BENCHMARK_COUNTS[benchmark_step / 2] << " nanosuits "
+            << (benchmark_step % 2 == 0 ? "instanced" : "as objects") << ": "
+            << (t - benchmark_start) * 1000.0f / benchmark_frames << " ms per frame" << std::endl;
+  if (benchmark_step + 1 < BENCHMARK_STEPS) {
+    start_benchmark_step(benchmark_step + 1, t);
+    // the packet waiting to be submitted points into the objects that were just replaced,
+    // draw the new ones instead. Its simulation steps still have to be applied.
+    gather_draws(packets[submit_index]);
+  } else {
+    benchmark_step = BENCHMARK_STEPS;
   }
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void Renderer::render_lighting() {
   // lighting pass
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   deferred_light_shader->use();
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, gPosition);
-  glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, gNormal);
-  glActiveTexture(GL_TEXTURE2);
-  glBindTexture(GL_TEXTURE_2D, gColorSpec);
-
-  for (unsigned int i = 0; i < scene.point_lights.size(); i++) {
-    const PointLight& light = scene.point_lights[i];
-    const float constant = 1.0;
-    const float linear = 0.7;
-    const float quadratic = 1.8;
-    const float max_brightness = std::fmaxf(std::fmax(light.color.x, light.color.y), light.color.z);
-    float radius =
-      (-linear +
-       std::sqrt(linear * linear - 4 * quadratic * (constant - (256.0f / 5.0f) * max_brightness))) /
-      (2.0f * quadratic);
-    // set light uniforms
-    deferred_light_shader->set_vec3("lights[" + std::to_string(i) + "].position", light.pos);
-    deferred_light_shader->set_vec3("lights[" + std::to_string(i) + "].color", light.color);
-    deferred_light_shader->set_float("lights[" + std::to_string(i) + "].linear", linear);
-    deferred_light_shader->set_float("lights[" + std::to_string(i) + "].quadratic", quadratic);
-    deferred_light_shader->set_float("lights[" + std::to_string(i) + "].radius", radius);
-  }
-  deferred_light_shader->set_vec3("view_pos", camera_pos);
+  // map texture IDs, the variant may have changed since the last frame
+  deferred_light_shader->set_int("gPosition", 0);
+  deferred_light_shader->set_int("gNormal", 1);
+  deferred_light_shader->set_int("gColorSpec", 2);
+  deferred_light_shader->set_int("light_previous_positions", 3);
+  deferred_light_shader->set_int("light_positions", 4);
+  deferred_light_shader->set_int("light_attributes", 5);
+  // the g-buffer textures stay bound from the last frame unless something else took their units
+  gl_bind_texture(0, GL_TEXTURE_2D, gpu_name(gPosition));
+  gl_bind_texture(1, GL_TEXTURE_2D, gpu_name(gNormal));
+  gl_bind_texture(2, GL_TEXTURE_2D, gpu_name(gColorSpec));
+
+  light_buffers->bind_textures(3);
 }
 
 void Renderer::render_quad() {
-  if (vao == 0) {
-    // setup plane VAO
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), &quad_vertices, GL_STATIC_DRAW);
-    // vec3 pos, vec2 texture coord
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-  }
-  glBindVertexArray(vao);
+  gl_bind_vertex_array(gpu_name(quad_vao));
   glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-  glBindVertexArray(0);
 }
 
 void Renderer::update() {
-  for (PointLight& light : scene.point_lights) {
-    light.pos.y += light.dir * light.speed * dt;
-    if (light.pos.y > LIGHT_POS_MAX.y) {
-      light.pos.y = LIGHT_POS_MAX.y;
-      light.dir = LIGHT_DIR_DOWN;
-    } else if (light.pos.y < LIGHT_POS_MIN.y) {
-      light.pos.y = LIGHT_POS_MIN.y;
-      light.dir = LIGHT_DIR_UP;
-    }
-  }
+  scene.update_animators(SIMULATION_STEP);
 }
 
 void Renderer::_resize(int width, int height) {
@@ -462,4 +877,59 @@ void Renderer::handle_keyboard(void) {
       last_light_toggle = t;
     }
   }
+  if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS) {
+    float t = glfwGetTime();
+    if (t - last_animation_toggle > 0.5) {
+      light_buffers->set_gpu_animation(!light_buffers->gpu_animation(), scene);
+      last_animation_toggle = t;
+    }
+  }
+  if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS) {
+    float t = glfwGetTime();
+    if (t - last_pipeline_toggle > 0.5) {
+      use_pipeline = !use_pipeline;
+      // a packet only applies its simulation steps once, and in serial mode the one next in
+      // line has been submitted already
+      packets[submit_index].simulation_steps = 0;
+      last_pipeline_toggle = t;
+    }
+  }
+  if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
+    float t = glfwGetTime();
+    if (t - last_command_toggle > 0.5) {
+      use_command_buffers = !use_command_buffers;
+      last_command_toggle = t;
+    }
+  }
+  if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS) {
+    float t = glfwGetTime();
+    if (t - last_lod_toggle > 0.5) {
+      use_lod = !use_lod;
+      last_lod_toggle = t;
+    }
+  }
+  if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
+    float t = glfwGetTime();
+    if (t - last_culling_toggle > 0.5) {
+      use_meshlet_culling = !use_meshlet_culling;
+      last_culling_toggle = t;
+    }
+  }
+  if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS) {
+    float t = glfwGetTime();
+    if (t - last_specular_toggle > 0.5) {
+      use_specular = !use_specular;
+      last_specular_toggle = t;
+    }
+  }
+#ifdef USE_DEFERRED_SHADING
+  if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS) {
+    float t = glfwGetTime();
+    if (t - last_gbuffer_toggle > 0.5) {
+      use_compact_gbuffer = !use_compact_gbuffer;
+      allocate_normal_buffer();
+      last_gbuffer_toggle = t;
+    }
+  }
+#endif // USE_DEFERRED_SHADING
 }
\ No newline at end of file
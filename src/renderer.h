@@ -10,13 +10,23 @@
 #include "shader.h"
 #include "mesh.h"
 #include "scene.h"
+#include "gpu_timer.h"
+#include "light_buffers.h"
+#include "render_packet.h"
+#include "texture_arrays.h"
+#include "worker_thread.h"
 
+#include <cstddef>
+#include <ctime>
+#include <map>
 #include <string>
 
 class Renderer {
 protected:
 public:
   static Renderer* get_instance();
+  // delete the instance, releasing its GL objects and reporting the ones that leaked
+  static void destroy();
   // Render loop. Will block until exit condition
   void loop(void);
   // GLFW callbacks
@@ -31,45 +41,134 @@ private:
   Renderer();
   // Clean up GLFW allocation
   ~Renderer(void);
-  // Rendering pipeline
-  void render(void);
+  // Rendering pipeline. build_packet runs the simulation and prepares a frame without GL
+  // calls, on the worker thread when pipelined; submit_packet draws it on this thread.
+  void build_packet(RenderPacket& packet);
+  void submit_packet(const RenderPacket& packet);
+  // fill the draws of packet from the scene, seen from its camera. Also rebuilds a packet in
+  // flight after the scene changed, without taking its simulation steps again.
+  void gather_draws(RenderPacket& packet);
   // Handle keyboard input
   void handle_keyboard(void);
   // deferred shading
   void init_deferred_engine(void);
-  void render_geometry(const glm::mat4& projection, const glm::mat4& view);
+  // (re)specify gNormal in the layout use_compact_gbuffer asks for
+  void allocate_normal_buffer(void);
+  void render_geometry(const RenderPacket& packet);
   void render_lighting();
   void render_quad();
-  // move objects
+  // record the draws of the items of packet into its command buffers, in parallel
+  void record_commands(RenderPacket& packet);
+  // draw the meshes of packet with shader, already bound, replaying the recorded commands if
+  // there are any
+  void render_items(Shader& shader, const RenderPacket& packet);
+  // draw the visible instances of scene.instanced_objects with shader, already bound
+  void render_instances(Shader& shader, const RenderPacket& packet);
+  // instancing benchmark, see INSTANCING_BENCHMARK
+  void start_benchmark_step(unsigned int step, float t);
+  void update_benchmark(float t);
+  // pick the levels of detail and cull the meshlets of the renderable in row of
+  // scene.renderables, placed at hierarchy node
+  void prepare_draw(unsigned int row, int node, const glm::mat4& view_projection);
+  // advance the simulation by one SIMULATION_STEP
   void update();
+  // point the shaders below at the cheapest variants for the current settings and light
+  // count, compiling them on first use
+  void select_variants(unsigned int num_lights);
 
   // Camera position/direction in world-space
   glm::vec3 camera_pos, camera_dir;
   float dt;
   float t_prev = 0;
+  // time not yet simulated, less than a step
+  float simulation_time = 0;
   // Rotational position
   float pitch, yaw;
   // Field of view (degrees)
   float fov;
   // Render window
   GLFWwindow* window;
-  // Shaders
+  // Shaders, the variants of the current frame
   Shader* forward_shader;
-  Shader* deferred_geometry_shader;
-  Shader* deferred_light_shader;
+  Shader* deferred_geometry_shader = nullptr;
+  Shader* deferred_light_shader = nullptr;
+  ShaderVariants* forward_variants;
+  ShaderVariants* deferred_geometry_variants = nullptr;
+  ShaderVariants* deferred_light_variants = nullptr;
+  // whether the variants add specular highlights
+  bool use_specular = true;
+  float last_specular_toggle = 0;
+  // whether the g-buffer stores normals in two channels instead of three
+  bool use_compact_gbuffer = false;
+  float last_gbuffer_toggle = 0;
 
-  // IDs for deferred shading
-  unsigned int gBuffer;
-  unsigned int gPosition, gNormal, gColorSpec;
-  // ID for depth buffer
-  unsigned int rbo_depth;
-  // IDs for quad
-  unsigned int vao = 0;
-  unsigned int vbo;
+  // material maps of every model, drawn without rebinding textures per mesh
+  TextureArrays* texture_arrays;
+
+  // GPU time of the deferred passes, the lighting pass per variant
+  GpuTimer* geometry_timer = nullptr;
+  GpuTimer* lighting_timer = nullptr;
+  std::map<Shader*, GpuTimer*> lighting_timers;
+
+  // objects for deferred shading
+  GpuHandle gBuffer;
+  GpuHandle gPosition, gNormal, gColorSpec;
+  // depth buffer
+  GpuHandle rbo_depth;
+  // full screen quad of the lighting pass
+  GpuHandle quad_vao, quad_vbo;
   // whether or not to draw light sources as cubes
   bool render_light_cubes = true;
   float last_light_toggle = 0;
+  // lights as seen by the GPU, and whether they are animated there
+  LightBuffers* light_buffers;
+  float last_animation_toggle = 0;
+  // whether distant meshes are drawn with coarser levels of detail
+  bool use_lod = true;
+  float last_lod_toggle = 0;
+  // whether meshlets outside the frustum or facing away are skipped
+  bool use_meshlet_culling = true;
+  float last_culling_toggle = 0;
+  // frame statistics
+  unsigned int triangles_submitted = 0;
+  unsigned int triangles_drawn = 0;
+  unsigned int stats_frames = 0;
+  float stats_start = 0;
+  // CPU seconds spent moving the lights and bytes of lights uploaded since stats_start
+  double light_update_time = 0;
+  size_t light_upload_bytes = 0;
+  // seconds this thread spent on frames until the buffer swap, and the process CPU time at
+  // stats_start
+  double frame_cpu_time = 0;
+  std::clock_t stats_cpu_start = 0;
+  // seconds spent recording the draws of the items and submitting them on this thread, and
+  // the commands replayed since stats_start
+  double record_time = 0;
+  double item_submit_time = 0;
+  size_t command_bytes = 0;
+  unsigned int num_commands = 0;
+  // glfw time the renderer started initializing at, reported once the first frame is shown
+  double startup_start = 0;
+  bool first_frame_done = false;
+
+  // Frame pipeline. While the worker builds packets[1 - submit_index], this thread only reads
+  // packets[submit_index] and GL objects the worker does not touch; input, the scene and the
+  // camera are only changed while the worker is idle.
+  WorkerThread* worker;
+  RenderPacket packets[2];
+  unsigned int submit_index = 0;
+  bool use_pipeline = true;
+  float last_pipeline_toggle = 0;
+  // whether packets record the draws of their items as commands, or the GL thread works
+  // them out itself
+  bool use_command_buffers = true;
+  float last_command_toggle = 0;
 
   // scene
   Scene scene;
+  // instancing benchmark state, the nanosuit in scene.models
+  unsigned int benchmark_model = 0;
+  unsigned int benchmark_step = 0;
+  float benchmark_start = 0;
+  unsigned int benchmark_frames = 0;
 };
\ No newline at end of file
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// slots per chunk of a ResourcePool
+#define RESOURCE_POOL_CHUNK_SIZE 256
+
+// Names a resource of a ResourcePool by its slot and the generation the slot had when the
+// resource was created. Destroying the resource moves the slot to the next generation, so
+// handles kept elsewhere stop resolving instead of reaching whatever reuses the slot. Plain
+// values, copying one does not copy or share ownership of anything.
+struct ResourceHandle {
+  uint32_t index = 0;
+  // 0 for the null handle, live slots start at 1
+  uint32_t generation = 0;
+  bool operator==(const ResourceHandle& other) const {
+    return index == other.index && generation == other.generation;
+  }
+  bool operator!=(const ResourceHandle& other) const {
+    return !(*this == other);
+  }
+};
+
+// Slots of T in fixed-size chunks that never move, reused through a free list. Growing adds a
+// chunk, so resources keep their address and churn does not fragment the heap.
+template <typename T> class ResourcePool {
+public:
+  ResourceHandle create(const T& value) {
+    if (free_slots.empty()) {
+      chunks.emplace_back(new Slot[RESOURCE_POOL_CHUNK_SIZE]);
+      uint32_t first = (chunks.size() - 1) * RESOURCE_POOL_CHUNK_SIZE;
+      // popped from the back, so lower slots are used first
+      for (uint32_t i = RESOURCE_POOL_CHUNK_SIZE; i > 0; i--) free_slots.push_back(first + i - 1);
+    }
+    ResourceHandle handle;
+    handle.index = free_slots.back();
+    free_slots.pop_back();
+    Slot& s = slot(handle.index);
+    s.value = value;
+    s.alive = true;
+    handle.generation = s.generation;
+    live++;
+    return handle;
+  }
+  // the resource of handle, nullptr when the handle is null or stale
+  T* get(ResourceHandle handle) {
+    if (handle.index >= chunks.size() * RESOURCE_POOL_CHUNK_SIZE) return nullptr;
+    Slot& s = slot(handle.index);
+    return s.alive && s.generation == handle.generation ? &s.value : nullptr;
+  }
+  // free the slot of a live handle, false for null and stale ones
+  bool destroy(ResourceHandle handle) {
+    if (!get(handle)) return false;
+    Slot& s = slot(handle.index);
+    s.value = T();
+    s.alive = false;
+    // generation 0 is the null handle
+    if (++s.generation == 0) s.generation = 1;
+    free_slots.push_back(handle.index);
+    live--;
+    return true;
+  }
+  // call f(handle, value) for every live resource
+  template <typename F> void for_each(const F& f) {
+    for (uint32_t i = 0; i < chunks.size() * RESOURCE_POOL_CHUNK_SIZE; i++) {
+      Slot& s = slot(i);
+      if (!s.alive) continue;
+      ResourceHandle handle;
+      handle.index = i;
+      handle.generation = s.generation;
+      f(handle, s.value);
+    }
+  }
+  size_t size() const {
+    return live;
+  }
+  size_t capacity() const {
+    return chunks.size() * RESOURCE_POOL_CHUNK_SIZE;
+  }
+
+private:
+  struct Slot {
+    T value;
+    uint32_t generation = 1;
+    bool alive = false;
+  };
+  std::vector<std::unique_ptr<Slot[]>> chunks;
+  std::vector<uint32_t> free_slots;
+  size_t live = 0;
+  Slot& slot(uint32_t index) {
+    return chunks[index / RESOURCE_POOL_CHUNK_SIZE][index % RESOURCE_POOL_CHUNK_SIZE];
+  }
+};
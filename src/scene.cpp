@@ -0,0 +1,145 @@
+#include "scene.h"
+
+#include "light_animation.h"
+
+void TransformComponents::add(Entity entity, int node) {
+  index.add(entity);
+  this->node.push_back(node);
+}
+
+void TransformComponents::remove(Entity entity) {
+  int row = index.remove(entity);
+  if (row < 0) return;
+  swap_remove(node, row);
+}
+
+void RenderableComponents::add(Entity entity, unsigned int model, unsigned int num_meshes) {
+  index.add(entity);
+  this->model.push_back(model);
+  draws.push_back(std::vector<MeshDraw>(num_meshes));
+}
+
+void RenderableComponents::remove(Entity entity) {
+  int row = index.remove(entity);
+  if (row < 0) return;
+  swap_remove(model, row);
+  swap_remove(draws, row);
+}
+
+void LightComponents::add(
+  Entity entity,
+  const glm::vec3& pos,
+  const glm::vec3& color,
+  float intensity) {
+  index.add(entity);
+  x.push_back(pos.x);
+  y.push_back(pos.y);
+  z.push_back(pos.z);
+  this->color.push_back(color);
+  this->intensity.push_back(intensity);
+}
+
+int LightComponents::remove(Entity entity) {
+  int row = index.remove(entity);
+  if (row < 0) return -1;
+  swap_remove(x, row);
+  swap_remove(y, row);
+  swap_remove(z, row);
+  swap_remove(color, row);
+  swap_remove(intensity, row);
+  return row;
+}
+
+void AnimatorComponents::add(
+  Entity entity,
+  float y,
+  float speed,
+  float dir,
+  float min_y,
+  float max_y,
+  unsigned int light) {
+  index.add(entity);
+  this->y.push_back(y);
+  this->speed.push_back(speed);
+  this->dir.push_back(dir);
+  this->min_y.push_back(min_y);
+  this->max_y.push_back(max_y);
+  this->light.push_back(light);
+}
+
+void AnimatorComponents::remove(Entity entity) {
+  int row = index.remove(entity);
+  if (row < 0) return;
+  swap_remove(y, row);
+  swap_remove(speed, row);
+  swap_remove(dir, row);
+  swap_remove(min_y, row);
+  swap_remove(max_y, row);
+  swap_remove(light, row);
+}
+
+unsigned int Scene::add_model(const Model& model) {
+  models.push_back(model);
+  return models.size() - 1;
+}
+
+Entity Scene::add_object(unsigned int model, const glm::vec3& pos, float scale) {
+  Entity entity = entities.create();
+  transforms.add(entity, models[model].addToHierarchy(hierarchy, placement_matrix(pos, scale)));
+  renderables.add(entity, model, models[model].meshes.size());
+  return entity;
+}
+
+void Scene::place_object(Entity object, const glm::vec3& pos, float scale) {
+  int row = transforms.index.row(object);
+  if (row < 0) return;
+  hierarchy.set_local(transforms.node[row], placement_matrix(pos, scale));
+}
+
+Entity Scene::add_light(
+  const glm::vec3& pos,
+  const glm::vec3& color,
+  float intensity,
+  float dir,
+  float speed,
+  float min_y,
+  float max_y) {
+  Entity entity = entities.create();
+  lights.add(entity, pos, color, intensity);
+  if (speed != 0.0f)
+    animators.add(entity, pos.y, speed, dir, min_y, max_y, lights.index.size() - 1);
+  return entity;
+}
+
+void Scene::destroy(Entity entity) {
+  if (!entities.alive(entity)) return;
+  // the hierarchy only grows, nodes of destroyed objects are reclaimed by clear_objects
+  transforms.remove(entity);
+  renderables.remove(entity);
+  animators.remove(entity);
+  int light = lights.remove(entity);
+  // the last light moved into the freed row, point its animator there
+  if (light >= 0 && light < (int)lights.index.size()) {
+    int animator = animators.index.row(lights.index.entity(light));
+    if (animator >= 0) animators.light[animator] = light;
+  }
+  entities.destroy(entity);
+}
+
+void Scene::clear_objects() {
+  while (renderables.index.size() > 0) destroy(renderables.index.entity(0));
+  hierarchy.clear();
+}
+
+void Scene::update_animators(float dt) {
+  size_t n = animators.index.size();
+  bounce_lights(
+    animators.y.data(),
+    animators.dir.data(),
+    animators.speed.data(),
+    animators.min_y.data(),
+    animators.max_y.data(),
+    n,
+    dt);
+  for (size_t i = 0; i < n; i++) lights.y[animators.light[i]] = animators.y[i];
+}
@@ -1,12 +1,106 @@
 #pragma once
+#include "entity.h"
 #include "light.h"
 #include "model.h"
+#include "model_instances.h"
 #include "shader.h"
+#include "transform_hierarchy.h"
 
+#include <glm/glm.hpp>
 #include <vector>
 
+// Scene storage as entities with components. Every component type keeps its data in
+// parallel arrays indexed by a dense row, so the per-frame systems iterate them linearly.
+
+// placement node of an entity in Scene::hierarchy, the nodes of its model follow it
+struct TransformComponents {
+  ComponentIndex index;
+  std::vector<int> node;
+  void add(Entity entity, int node);
+  void remove(Entity entity);
+};
+
+// model of Scene::models drawn at the world matrices of the entity's nodes, with the level of
+// detail and culling state of every mesh of this placement
+struct RenderableComponents {
+  ComponentIndex index;
+  std::vector<unsigned int> model;
+  // one per mesh of the model
+  std::vector<std::vector<MeshDraw>> draws;
+  void add(Entity entity, unsigned int model, unsigned int num_meshes);
+  void remove(Entity entity);
+};
+
+// point light, positions split per axis
+struct LightComponents {
+  ComponentIndex index;
+  std::vector<float> x, y, z;
+  std::vector<glm::vec3> color;
+  std::vector<float> intensity;
+  void add(Entity entity, const glm::vec3& pos, const glm::vec3& color, float intensity);
+  // returns the row that was removed, the last light moved into it
+  int remove(Entity entity);
+  glm::vec3 position(unsigned int row) const {
+    return glm::vec3(x[row], y[row], z[row]);
+  }
+};
+
+// moves the light of its entity up and down between min_y and max_y
+struct AnimatorComponents {
+  ComponentIndex index;
+  // animated height, copied to the light afterwards so the update runs on dense arrays
+  std::vector<float> y;
+  std::vector<float> speed;
+  // LIGHT_DIR_UP or LIGHT_DIR_DOWN
+  std::vector<float> dir;
+  std::vector<float> min_y, max_y;
+  // LightComponents row of the entity, kept up to date by Scene::destroy
+  std::vector<unsigned int> light;
+  void add(
+    Entity entity,
+    float y,
+    float speed,
+    float dir,
+    float min_y,
+    float max_y,
+    unsigned int light);
+  void remove(Entity entity);
+};
+
 class Scene {
 public:
-  std::vector<Model> objects;
-  std::vector<PointLight> point_lights;
-};
\ No newline at end of file
+  EntityPool entities;
+  TransformComponents transforms;
+  RenderableComponents renderables;
+  LightComponents lights;
+  AnimatorComponents animators;
+  // every loaded model once, objects refer to them by index. Only grows, so meshes keep
+  // their address.
+  std::vector<Model> models;
+  // world matrices of every transform node
+  TransformHierarchy hierarchy;
+  // repeated models drawn with instancing
+  std::vector<ModelInstances> instanced_objects;
+
+  // add model to the model table, returns its index
+  unsigned int add_model(const Model& model);
+  // entity drawing models[model] at pos and scale
+  Entity add_object(unsigned int model, const glm::vec3& pos, float scale);
+  // move an object, its world matrices follow on the next hierarchy.update()
+  void place_object(Entity object, const glm::vec3& pos, float scale);
+  // entity with a point light, bouncing vertically when speed is not zero
+  Entity add_light(
+    const glm::vec3& pos,
+    const glm::vec3& color,
+    float intensity,
+    float dir,
+    float speed,
+    float min_y,
+    float max_y);
+  // remove an entity and all of its components
+  void destroy(Entity entity);
+  // destroy every entity with a renderable and reset the hierarchy, the models stay loaded
+  void clear_objects();
+  // advance the animators by dt seconds
+  void update_animators(float dt);
+};
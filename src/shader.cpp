@@ -1,125 +1,550 @@
 #include "shader.h"
 
-#include <fstream>
+#include "file_watcher.h"
+#include "gl_state.h"
+#include "gpu_resources.h"
+#include "program_cache.h"
+#include "uniform_ring.h"
+
+// clang-format off
 #include <glad/glad.h>
+#include <GLFW/glfw3.h>
+// clang-format on
+
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <sstream>
 
-Shader::Shader(const char* vertex_path, const char* fragment_path) {
-  std::string vertex_source;
-  std::string fragment_source;
-  std::ifstream vertex_file;
-  std::ifstream fragment_file;
-
-  vertex_file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-  fragment_file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+// read a whole source file, empty on failure
+static std::string read_source(const char* path) {
+  std::ifstream file;
+  file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
   try {
-    // read source code from file into string
-    vertex_file.open(vertex_path);
-    fragment_file.open(fragment_path);
-    std::stringstream vertex_stream, fragment_stream;
-    vertex_stream << vertex_file.rdbuf();
-    fragment_stream << fragment_file.rdbuf();
-    vertex_file.close();
-    fragment_file.close();
-    vertex_source = vertex_stream.str();
-    fragment_source = fragment_stream.str();
+    file.open(path);
+    std::stringstream stream;
+    stream << file.rdbuf();
+    file.close();
+    return stream.str();
   } catch (std::ifstream::failure e) {
-    std::cout << "Failed to read shader sources" << std::endl;
+    std::cout << "Failed to read shader source " << path << std::endl;
   }
+  return std::string();
+}
+
+// read path, replacing #include "file" lines by the file, relative to the including one.
+// Every file read is appended to files, the ones of this stage so far; a file included a
+// second time is left out, so included files need no guards.
+static std::string preprocess(const std::string& path, std::vector<std::string>& files) {
+  files.push_back(path);
+  size_t slash = path.find_last_of("/\\");
+  std::string directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+  std::istringstream stream(read_source(path.c_str()));
+  std::string result, line;
+  unsigned int number = 0;
+  while (std::getline(stream, line)) {
+    number++;
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+      result += line + "\n";
+      continue;
+    }
+    size_t open = line.find('"', start);
+    size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+    if (close == std::string::npos) {
+      std::cout << "Malformed #include in " << path << ":" << number << std::endl;
+      result += "\n";
+      continue;
+    }
+    std::string included = directory + line.substr(open + 1, close - open - 1);
+    if (std::find(files.begin(), files.end(), included) != files.end()) {
+      result += "\n";
+      continue;
+    }
+    result += preprocess(included, files);
+    // back to the line numbers of this file
+    result += "#line " + std::to_string(number + 1) + "\n";
+  }
+  return result;
+}
+
+// insert defines after the #version line, which has to stay first
+static std::string
+  inject_defines(const std::string& source, const std::vector<std::string>& defines) {
+  if (defines.empty()) return source;
+  size_t body = 0;
+  if (source.compare(0, 8, "#version") == 0) {
+    body = source.find('\n');
+    body = body == std::string::npos ? source.size() : body + 1;
+  }
+  std::string result = source.substr(0, body);
+  for (const std::string& define : defines) result += "#define " + define + "\n";
+  // keep the line numbers of compile errors matching the file
+  if (body > 0) result += "#line 2\n";
+  return result + source.substr(body);
+}
 
+// A program whose compilation was issued but whose status was not queried yet. Querying
+// blocks until the driver is done, so that is left until the program is first used.
+struct PendingProgram {
+  shader_id_t program;
+  int vertex_shader, fragment_shader;
+  bool use_cache;
+  std::string cache_path;
+  uint64_t source_hash;
+  // seconds this thread spent on the program so far
+  double build_time;
+};
+
+// Everything a program is built from, kept to rebuild it when hot reloading
+struct ProgramSource {
+  std::string vertex_path;
+  // empty for vertex-only programs
+  std::string fragment_path;
+  std::vector<std::string> defines;
+  std::vector<std::string> feedback_varyings;
+};
+
+// A Shader whose sources are watched. rebuild is a program being built from changed sources
+// to replace the shader's, which it only does once it linked.
+struct WatchedProgram {
+  // registry entry of the program, pointed at the rebuilt one when it is swapped in. Also
+  // tells which Shader watches it.
+  GpuHandle* program;
+  ProgramSource source;
+  // the two stages and everything they include
+  std::vector<std::string> files;
+  shader_id_t rebuild;
+  // a file changed since rebuild started, or rebuild has to start
+  bool dirty;
+};
+
+static std::vector<PendingProgram> pending;
+// hot reloading, only set up by shader_hot_reload_init
+static FileWatcher* watcher = nullptr;
+static std::vector<WatchedProgram> watched;
+// whether the driver compiles on its own threads and can be asked if it is done
+static bool parallel_compile = false;
+static unsigned int num_programs = 0, num_waited = 0;
+static double issue_time = 0.0, wait_time = 0.0;
+
+// start compiling one stage, the status is checked by check_compile
+static int compile_stage(GLenum type, const std::string& source) {
+  const char* source_cstr = source.c_str();
+  int shader = glCreateShader(type);
+  glShaderSource(shader, 1, &source_cstr, NULL);
+  glCompileShader(shader);
+  return shader;
+}
+
+// stage_name is used in error messages
+static void check_compile(int shader, const char* stage_name) {
   int success;
   char log[512];
-  const char* vertex_source_cstr = vertex_source.c_str();
-  const char* fragment_source_cstr = fragment_source.c_str();
-
-  // compile our custom vertex shader
-  int vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertex_shader, 1, &vertex_source_cstr, NULL);
-  glCompileShader(vertex_shader);
-  glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
   if (!success) {
-    glGetShaderInfoLog(vertex_shader, sizeof(log), NULL, log);
-    std::cout << "Failed to compile vertex shader:\n" << log << std::endl;
+    glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+    std::cout << "Failed to compile " << stage_name << " shader:\n" << log << std::endl;
   }
+}
 
-  // compile our custom fragment shader
-  int fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragment_shader, 1, &fragment_source_cstr, NULL);
-  glCompileShader(fragment_shader);
-  glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
+static bool check_link(shader_id_t program) {
+  int success;
+  char log[512];
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
   if (!success) {
-    glGetShaderInfoLog(fragment_shader, sizeof(log), NULL, log);
-    std::cout << "Failed to compile fragment shader:\n" << log << std::endl;
+    glGetProgramInfoLog(program, sizeof(log), NULL, log);
+    std::cout << "Failed to link shaders:\n" << log << std::endl;
   }
+  return success;
+}
 
-  // link our custom shaders
-  shader_id = glCreateProgram();
-  glAttachShader(shader_id, vertex_shader);
-  glAttachShader(shader_id, fragment_shader);
-  glLinkProgram(shader_id);
-  glGetProgramiv(shader_id, GL_LINK_STATUS, &success);
-  if (!success) {
-    glGetShaderInfoLog(shader_id, sizeof(log), NULL, log);
-    std::cout << "Failed to link shaders:\n" << log << std::endl;
+// whether querying the status of a pending program would not block
+static bool compile_done(const PendingProgram& p) {
+  if (!parallel_compile) return false;
+  int done;
+  glGetProgramiv(p.program, GL_COMPLETION_STATUS_KHR, &done);
+  return done;
+}
+
+// check the status of a pending program, save it to the cache and forget it
+static void finish_program(unsigned int index) {
+  double start = glfwGetTime();
+  PendingProgram& p = pending[index];
+  check_compile(p.vertex_shader, "vertex");
+  if (p.fragment_shader) check_compile(p.fragment_shader, "fragment");
+  bool linked = check_link(p.program);
+  if (linked) uniform_ring_bind_blocks(p.program);
+  glDeleteShader(p.vertex_shader);
+  if (p.fragment_shader) glDeleteShader(p.fragment_shader);
+
+  double build_time = p.build_time + glfwGetTime() - start;
+  if (p.use_cache && linked) {
+    program_cache_write(p.cache_path, p.source_hash, p.program, build_time);
+  }
+  program_cache_count(false, build_time);
+  pending[index] = pending.back();
+  pending.pop_back();
+}
+
+static bool is_pending(shader_id_t program) {
+  for (const PendingProgram& p : pending) {
+    if (p.program == program) return true;
+  }
+  return false;
+}
+
+// stop compiling program if it is still pending, deleting its stages
+static void discard_pending(shader_id_t program) {
+  for (unsigned int i = 0; i < pending.size(); i++) {
+    if (pending[i].program != program) continue;
+    glDeleteShader(pending[i].vertex_shader);
+    if (pending[i].fragment_shader) glDeleteShader(pending[i].fragment_shader);
+    pending[i] = pending.back();
+    pending.pop_back();
+    return;
+  }
+}
+
+// delete a program the registry does not own, along with its stages if it is still pending
+static void discard_program(shader_id_t program) {
+  discard_pending(program);
+  glDeleteProgram(program);
+  // the name may come back for another program
+  gl_state_invalidate();
+}
+
+// finish program if it is still pending, waiting for the driver if needed
+static void finish_pending(shader_id_t program) {
+  for (unsigned int i = 0; i < pending.size(); i++) {
+    if (pending[i].program != program) continue;
+    double start = glfwGetTime();
+    bool waited = !compile_done(pending[i]);
+    finish_program(i);
+    if (waited) {
+      num_waited++;
+      wait_time += glfwGetTime() - start;
+    }
+    return;
+  }
+}
+
+// preprocess one stage from path and append the files it read to files, skipping those
+// another stage read already. Each stage includes what it needs on its own.
+static std::string preprocess_stage(const std::string& path, std::vector<std::string>& files) {
+  std::vector<std::string> stage_files;
+  std::string result = preprocess(path, stage_files);
+  for (const std::string& file : stage_files) {
+    if (std::find(files.begin(), files.end(), file) == files.end()) files.push_back(file);
+  }
+  return result;
+}
+
+// build a program from a vertex and an optional fragment shader, both stages compiled with
+// the defines of source, capturing its feedback varyings. Every file read is appended to
+// files. Goes through the program cache when the driver supports it. A program compiled from
+// source is left pending, see finish_pending.
+static shader_id_t build_program(const ProgramSource& source, std::vector<std::string>& files) {
+  double start = glfwGetTime();
+  num_programs++;
+  const std::vector<std::string>& defines = source.defines;
+  bool has_fragment = !source.fragment_path.empty();
+  std::string vertex_source = inject_defines(preprocess_stage(source.vertex_path, files), defines);
+  std::string fragment_source = has_fragment ?
+    inject_defines(preprocess_stage(source.fragment_path, files), defines) :
+    std::string();
+  std::vector<const char*> feedback_varyings;
+  for (const std::string& varying : source.feedback_varyings) {
+    feedback_varyings.push_back(varying.c_str());
+  }
+
+  // what tells this program apart from others built from the same vertex shader
+  std::string identity = source.fragment_path;
+  for (const std::string& define : defines) identity += "\n#define " + define;
+  for (const std::string& varying : source.feedback_varyings) identity += "\n" + varying;
+  uint64_t identity_hash = program_cache_hash(identity);
+  uint64_t source_hash = program_cache_hash(vertex_source, identity_hash);
+  source_hash = program_cache_hash(fragment_source, source_hash);
+  bool use_cache = program_cache_available();
+  std::string cache_path = program_cache_path(source.vertex_path, identity_hash);
+
+  if (use_cache) {
+    shader_id_t program = glCreateProgram();
+    if (program_cache_load(cache_path, source_hash, program)) {
+      uniform_ring_bind_blocks(program);
+      program_cache_count(true, glfwGetTime() - start);
+      issue_time += glfwGetTime() - start;
+      return program;
+    }
+    // missing, stale or rejected, compile from source in a fresh program
+    glDeleteProgram(program);
   }
 
-  glDeleteShader(vertex_shader);
-  glDeleteShader(fragment_shader);
+  PendingProgram p;
+  p.program = glCreateProgram();
+  p.vertex_shader = compile_stage(GL_VERTEX_SHADER, vertex_source);
+  glAttachShader(p.program, p.vertex_shader);
+  p.fragment_shader = 0;
+  if (has_fragment) {
+    p.fragment_shader = compile_stage(GL_FRAGMENT_SHADER, fragment_source);
+    glAttachShader(p.program, p.fragment_shader);
+  }
+  // the captured outputs have to be known before linking
+  if (!feedback_varyings.empty()) {
+    glTransformFeedbackVaryings(
+      p.program, feedback_varyings.size(), feedback_varyings.data(), GL_INTERLEAVED_ATTRIBS);
+  }
+  if (use_cache) glProgramParameteri(p.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  // without querying any status, linking does not wait for the compiles
+  glLinkProgram(p.program);
+  p.use_cache = use_cache;
+  p.cache_path = cache_path;
+  p.source_hash = source_hash;
+  p.build_time = glfwGetTime() - start;
+  issue_time += p.build_time;
+  pending.push_back(p);
+  return p.program;
+}
+
+void shader_compiler_init() {
+  parallel_compile = GLAD_GL_KHR_parallel_shader_compile;
+  // as many threads as the driver sees fit
+  if (parallel_compile) glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+}
+
+// start rebuilding the watched programs whose files changed, and swap in the rebuilt ones
+// that linked
+static void reload_changed() {
+  std::vector<std::string> changed = watcher->poll();
+  for (WatchedProgram& w : watched) {
+    for (const std::string& file : changed) {
+      if (std::find(w.files.begin(), w.files.end(), file) != w.files.end()) w.dirty = true;
+    }
+    if (w.rebuild == 0 && w.dirty) {
+      std::cout << "Reloading " << w.source.vertex_path << " " << w.source.fragment_path
+                << std::endl;
+      w.files.clear();
+      w.rebuild = build_program(w.source, w.files);
+      w.dirty = false;
+      // includes may have been added
+      for (const std::string& file : w.files) watcher->add(file);
+    }
+    if (w.rebuild == 0) continue;
+    // without parallel compilation there is no asking the driver whether it is done
+    if (!parallel_compile) finish_pending(w.rebuild);
+    if (is_pending(w.rebuild)) continue;
+
+    int linked;
+    glGetProgramiv(w.rebuild, GL_LINK_STATUS, &linked);
+    if (linked) {
+      gpu_replace(*w.program, w.rebuild);
+    } else {
+      std::cout << "Keeping the previous program of " << w.source.vertex_path << std::endl;
+      glDeleteProgram(w.rebuild);
+    }
+    w.rebuild = 0;
+  }
+}
+
+void shader_hot_reload_init() {
+  if (!watcher) watcher = new FileWatcher();
+}
+
+unsigned int poll_shaders() {
+  for (unsigned int i = 0; i < pending.size();) {
+    if (compile_done(pending[i])) {
+      finish_program(i);
+    } else {
+      i++;
+    }
+  }
+  if (watcher) reload_changed();
+  return pending.size();
+}
+
+void shader_compile_report() {
+  std::cout << "Shader compilation (" << (parallel_compile ? "parallel" : "serial")
+            << "): " << num_programs << " programs issued in " << issue_time * 1000.0 << " ms, "
+            << num_waited << " waited for on first use for " << wait_time * 1000.0 << " ms, "
+            << pending.size() << " still compiling" << std::endl;
+  program_cache_report();
+}
+
+Shader::Shader(const char* vertex_path, const char* fragment_path) {
+  ProgramSource source;
+  source.vertex_path = vertex_path;
+  source.fragment_path = fragment_path;
+  build(source);
+}
+
+Shader::Shader(
+  const char* vertex_path,
+  const char* fragment_path,
+  const std::vector<std::string>& defines) {
+  ProgramSource source;
+  source.vertex_path = vertex_path;
+  source.fragment_path = fragment_path;
+  source.defines = defines;
+  build(source);
+}
+
+Shader::Shader(const char* vertex_path, const std::vector<const char*>& feedback_varyings) {
+  ProgramSource source;
+  source.vertex_path = vertex_path;
+  source.feedback_varyings.assign(feedback_varyings.begin(), feedback_varyings.end());
+  build(source);
+}
+
+Shader::~Shader() {
+  unwatch();
+}
+
+void Shader::unwatch() {
+  // copies are not watched, only the Shader that was constructed
+  for (unsigned int i = 0; i < watched.size(); i++) {
+    if (watched[i].program != &program) continue;
+    if (watched[i].rebuild) discard_program(watched[i].rebuild);
+    watched[i] = watched.back();
+    watched.pop_back();
+    return;
+  }
+}
+
+void Shader::release() {
+  unwatch();
+  discard_pending(gpu_name(program));
+  gpu_destroy(program);
+}
+
+void Shader::build(const ProgramSource& source) {
+  std::vector<std::string> files;
+  shader_id_t id = build_program(source, files);
+  program = gpu_adopt(GPU_PROGRAM, id, source.vertex_path + " " + source.fragment_path);
+  if (!watcher) return;
+  WatchedProgram w;
+  w.program = &program;
+  w.source = source;
+  w.files = files;
+  w.rebuild = 0;
+  w.dirty = false;
+  for (const std::string& file : files) watcher->add(file);
+  watched.push_back(w);
+}
+
+bool Shader::ready() const {
+  shader_id_t id = gpu_name(program);
+  for (const PendingProgram& p : pending) {
+    if (p.program == id) return compile_done(p);
+  }
+  return true;
 }
 
 void Shader::use() {
-  glUseProgram(shader_id);
+  shader_id_t id = gpu_name(program);
+  if (!pending.empty()) finish_pending(id);
+  gl_use_program(id);
 }
 
 shader_id_t Shader::get_id(void) const {
-  return shader_id;
+  shader_id_t id = gpu_name(program);
+  if (!pending.empty()) finish_pending(id);
+  return id;
 }
 
-void Shader::set_int(const std::string& name, int value) const {
-  glUniform1i(glGetUniformLocation(shader_id, name.c_str()), value);
+void Shader::set_int(const char* name, int value) const {
+  glUniform1i(glGetUniformLocation(gpu_name(program), name), value);
 }
 
-void Shader::set_float(const std::string& name, float value) const {
-  glUniform1f(glGetUniformLocation(shader_id, name.c_str()), value);
+void Shader::set_float(const char* name, float value) const {
+  glUniform1f(glGetUniformLocation(gpu_name(program), name), value);
 }
 
-void Shader::set_bool(const std::string& name, bool value) const {
+void Shader::set_bool(const char* name, bool value) const {
   set_int(name, (int)value);
 }
 
-void Shader::set_vec2(const std::string& name, const glm::vec2& value) const {
-  glUniform2fv(glGetUniformLocation(shader_id, name.c_str()), 1, &value[0]);
+void Shader::set_vec2(const char* name, const glm::vec2& value) const {
+  glUniform2fv(glGetUniformLocation(gpu_name(program), name), 1, &value[0]);
+}
+
+void Shader::set_vec2(const char* name, float x, float y) const {
+  glUniform2f(glGetUniformLocation(gpu_name(program), name), x, y);
+}
+
+void Shader::set_vec3(const char* name, const glm::vec3& value) const {
+  glUniform3fv(glGetUniformLocation(gpu_name(program), name), 1, &value[0]);
+}
+
+void Shader::set_vec3(const char* name, float x, float y, float z) const {
+  glUniform3f(glGetUniformLocation(gpu_name(program), name), x, y, z);
 }
 
-void Shader::set_vec2(const std::string& name, float x, float y) const {
-  glUniform2f(glGetUniformLocation(shader_id, name.c_str()), x, y);
+void Shader::set_vec4(const char* name, const glm::vec4& value) const {
+  glUniform4fv(glGetUniformLocation(gpu_name(program), name), 1, &value[0]);
 }
 
-void Shader::set_vec3(const std::string& name, const glm::vec3& value) const {
-  glUniform3fv(glGetUniformLocation(shader_id, name.c_str()), 1, &value[0]);
+void Shader::set_vec4(const char* name, float x, float y, float z, float w) const {
+  glUniform4f(glGetUniformLocation(gpu_name(program), name), x, y, z, w);
 }
 
-void Shader::set_vec3(const std::string& name, float x, float y, float z) const {
-  glUniform3f(glGetUniformLocation(shader_id, name.c_str()), x, y, z);
+void Shader::set_mat2(const char* name, const glm::mat2& mat) const {
+  glUniformMatrix2fv(glGetUniformLocation(gpu_name(program), name), 1, GL_FALSE, &mat[0][0]);
 }
 
-void Shader::set_vec4(const std::string& name, const glm::vec4& value) const {
-  glUniform4fv(glGetUniformLocation(shader_id, name.c_str()), 1, &value[0]);
+void Shader::set_mat3(const char* name, const glm::mat3& mat) const {
+  glUniformMatrix3fv(glGetUniformLocation(gpu_name(program), name), 1, GL_FALSE, &mat[0][0]);
+}
+
+void Shader::set_mat4(const char* name, const glm::mat4& mat) const {
+  glUniformMatrix4fv(glGetUniformLocation(gpu_name(program), name), 1, GL_FALSE, &mat[0][0]);
+}
+ShaderVariants::ShaderVariants(
+  const char* vertex_path,
+  const char* fragment_path,
+  const std::vector<const char*>& options,
+  const char* count_name)
+    : vertex_path(vertex_path),
+      fragment_path(fragment_path),
+      options(options),
+      count_name(count_name) {
 }
 
-void Shader::set_vec4(const std::string& name, float x, float y, float z, float w) const {
-  glUniform4f(glGetUniformLocation(shader_id, name.c_str()), x, y, z, w);
+ShaderVariants::~ShaderVariants() {
+  for (auto& variant : variants) {
+    variant.second->release();
+    delete variant.second;
+  }
 }
 
-void Shader::set_mat2(const std::string& name, const glm::mat2& mat) const {
-  glUniformMatrix2fv(glGetUniformLocation(shader_id, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+Shader* ShaderVariants::get(unsigned int flags, unsigned int count) {
+  uint64_t key = (uint64_t)count << 32 | flags;
+  auto found = variants.find(key);
+  if (found != variants.end()) return found->second;
+
+  std::vector<std::string> defines;
+  for (unsigned int i = 0; i < options.size(); i++) {
+    if (flags & (1u << i)) defines.push_back(options[i]);
+  }
+  if (count_name) defines.push_back(std::string(count_name) + " " + std::to_string(count));
+  Shader* shader = new Shader(vertex_path.c_str(), fragment_path.c_str(), defines);
+  variants[key] = shader;
+  return shader;
 }
 
-void Shader::set_mat3(const std::string& name, const glm::mat3& mat) const {
-  glUniformMatrix3fv(glGetUniformLocation(shader_id, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+std::string ShaderVariants::name(unsigned int flags, unsigned int count) const {
+  std::string result;
+  for (unsigned int i = 0; i < options.size(); i++) {
+    if (!(flags & (1u << i))) continue;
+    if (!result.empty()) result += ", ";
+    result += options[i];
+  }
+  if (count_name) {
+    if (!result.empty()) result += ", ";
+    result += std::string(count_name) + " " + std::to_string(count);
+  }
+  return result.empty() ? "default" : result;
 }
 
-void Shader::set_mat4(const std::string& name, const glm::mat4& mat) const {
-  glUniformMatrix4fv(glGetUniformLocation(shader_id, name.c_str()), 1, GL_FALSE, &mat[0][0]);
-}
\ No newline at end of file
+size_t ShaderVariants::size() const {
+  return variants.size();
+}
@@ -1,36 +1,116 @@
 #pragma once
 
+#include "gpu_resources.h"
+
+#include <cstdint>
 #include <glm/glm.hpp>
+#include <map>
 #include <string>
+#include <vector>
 
 typedef unsigned int shader_id_t;
+struct ProgramSource;
+
+// Programs are compiled asynchronously: constructing a Shader only issues the compile and
+// link, and their status is first queried, blocking if the driver is not done, when the
+// program is used. With GL_KHR_parallel_shader_compile the driver compiles on its own threads
+// and finished programs can be picked up without blocking.
+
+// Sources may #include "file" relative to themselves. With hot reloading, every Shader
+// constructed afterwards has its source files watched; when one changes the program is
+// rebuilt the same way, and replaces the running one once it linked. A program that fails to
+// compile or link is reported and the previous one kept.
+
+// let the driver compile on multiple threads if it can, call once after loading GL
+void shader_compiler_init();
+// watch the sources of the shaders constructed from now on, see poll_shaders
+void shader_hot_reload_init();
+// pick up programs the driver finished without waiting for the others, returns how many are
+// still compiling. With hot reloading, also starts rebuilding programs whose sources changed
+// and swaps in the rebuilt ones that are done.
+unsigned int poll_shaders();
+// print programs issued, time spent waiting for them and the program cache statistics
+void shader_compile_report();
 
 class Shader {
 public:
   // initializes a shader from GLSL source files
   Shader(const char* vertex_path, const char* fragment_path);
+  // same with each of defines ("NAME" or "NAME value") #defined in both stages
+  Shader(
+    const char* vertex_path,
+    const char* fragment_path,
+    const std::vector<std::string>& defines);
+  // initializes a vertex-only program whose outputs named in feedback_varyings are captured,
+  // interleaved in that order, by transform feedback
+  Shader(const char* vertex_path, const std::vector<const char*>& feedback_varyings);
+  // stops watching the sources, the program itself is not deleted since copies may still use
+  // it, see release
+  ~Shader();
+  // delete the program. Copies share it through the registry, once it is released they use
+  // program 0 and set no uniforms.
+  void release();
 
-  // set as active shadser
+  // whether the program finished compiling, never blocks
+  bool ready(void) const;
+  // set as active shadser, waits for the program to finish compiling
   void use(void);
   // retrieve shader glfw id
   shader_id_t get_id(void) const;
   // assign a global variable of type int in shader
-  void set_int(const std::string& name, int value) const;
+  void set_int(const char* name, int value) const;
   // assign a global variable of type float in shader
-  void set_float(const std::string& name, float value) const;
+  void set_float(const char* name, float value) const;
   // assign a global variable of type bool in shader
-  void set_bool(const std::string& name, bool value) const;
+  void set_bool(const char* name, bool value) const;
   // assign a global vectors/matrices
-  void set_vec2(const std::string& name, const glm::vec2& value) const;
-  void set_vec2(const std::string& name, float x, float y) const;
-  void set_vec3(const std::string& name, const glm::vec3& value) const;
-  void set_vec3(const std::string& name, float x, float y, float z) const;
-  void set_vec4(const std::string& name, const glm::vec4& value) const;
-  void set_vec4(const std::string& name, float x, float y, float z, float w) const;
-  void set_mat2(const std::string& name, const glm::mat2& mat) const;
-  void set_mat3(const std::string& name, const glm::mat3& mat) const;
-  void set_mat4(const std::string& name, const glm::mat4& mat) const;
+  void set_vec2(const char* name, const glm::vec2& value) const;
+  void set_vec2(const char* name, float x, float y) const;
+  void set_vec3(const char* name, const glm::vec3& value) const;
+  void set_vec3(const char* name, float x, float y, float z) const;
+  void set_vec4(const char* name, const glm::vec4& value) const;
+  void set_vec4(const char* name, float x, float y, float z, float w) const;
+  void set_mat2(const char* name, const glm::mat2& mat) const;
+  void set_mat3(const char* name, const glm::mat3& mat) const;
+  void set_mat4(const char* name, const glm::mat4& mat) const;
 
 private:
-  shader_id_t shader_id = 0;
+  // build the program and, with hot reloading, watch its files
+  void build(const ProgramSource& source);
+  // stop watching the files, if this is the Shader watching them
+  void unwatch();
+
+  // the program is resolved through the registry on every use, so copies follow hot reloads
+  // and never reach a deleted program
+  GpuHandle program;
+};
+
+// Variants of one program specialized at compile time instead of branching at runtime.
+// options[i] is #defined in the variants whose flags have bit i set, and count_name, when
+// given, is #defined to the count a variant is asked for. Variants are compiled the first
+// time they are asked for and kept, every one of them is cached as its own program binary.
+class ShaderVariants {
+public:
+  ShaderVariants(
+    const char* vertex_path,
+    const char* fragment_path,
+    const std::vector<const char*>& options,
+    const char* count_name = nullptr);
+  ~ShaderVariants();
+
+  // the variant of flags and count, compiled on the first request
+  Shader* get(unsigned int flags, unsigned int count = 0);
+  // the defines of a variant for reports, e.g. "SPECULAR, MAX_LIGHTS 128"
+  std::string name(unsigned int flags, unsigned int count = 0) const;
+  // variants built so far
+  size_t size() const;
+
+private:
+  ShaderVariants(const ShaderVariants&) = delete;
+  ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+  std::string vertex_path, fragment_path;
+  std::vector<const char*> options;
+  const char* count_name;
+  std::map<uint64_t, Shader*> variants;
 };
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include "texture_arrays.h"
+
+#include "command_buffer.h"
+#include "gl_state.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <iostream>
+
+TextureArrays::TextureArrays() {
+  use_bindless = GLAD_GL_ARB_bindless_texture;
+}
+
+TextureArrays::~TextureArrays() {
+  for (uint64_t handle : handles) glMakeTextureHandleNonResidentARB(handle);
+  if (!arrays.empty()) glDeleteTextures(arrays.size(), arrays.data());
+  if (table_texture) glDeleteTextures(1, &table_texture);
+  if (table_vbo) glDeleteBuffers(1, &table_vbo);
+}
+
+int TextureArrays::add_map(const std::string& path, const std::string& type) {
+  std::string cache_path = texture_cache_path(path, type);
+  auto found = map_index.find(cache_path);
+  if (found != map_index.end()) return found->second;
+  Map map;
+  map.path = path;
+  map.type = type;
+  if (!texture_cache_format(path, type, map.format)) return -1;
+  maps.push_back(map);
+  map_index[cache_path] = maps.size() - 1;
+  return maps.size() - 1;
+}
+
+int TextureArrays::add_material(const std::string& diffuse_path, const std::string& specular_path) {
+  Material material;
+  material.diffuse = add_map(diffuse_path, "texture_diffuse");
+  material.specular = specular_path.empty() ? -1 : add_map(specular_path, "texture_specular");
+  if (material.diffuse < 0 || (material.specular < 0 && !specular_path.empty())) return -1;
+  std::pair<int, int> key(material.diffuse, material.specular);
+  auto found = material_index.find(key);
+  if (found != material_index.end()) return found->second;
+  materials.push_back(material);
+  material_index[key] = materials.size() - 1;
+  return materials.size() - 1;
+}
+
+void TextureArrays::build() {
+  // one array per format, layers in the order the maps were added
+  std::map<TextureFormat, int> array_of_format;
+  std::vector<unsigned int> layers;
+  for (Map& map : maps) {
+    auto found = array_of_format.find(map.format);
+    if (found == array_of_format.end()) {
+      found = array_of_format.insert(std::make_pair(map.format, (int)layers.size())).first;
+      layers.push_back(0);
+    }
+    map.array = found->second;
+    map.layer = layers[map.array]++;
+  }
+  arrays.resize(layers.size());
+  for (const Map& map : maps) {
+    if (map.layer == 0) {
+      arrays[map.array] = texture_cache_create_array(map.path, map.type, layers[map.array]);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[map.array]);
+    texture_cache_load_layer(map.path, map.type, map.layer);
+  }
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  // handles freeze the sampling state, so they are only taken once the arrays are complete
+  for (unsigned int i = 0; use_bindless && i < arrays.size(); i++) {
+    uint64_t handle = glGetTextureHandleARB(arrays[i]);
+    glMakeTextureHandleResidentARB(handle);
+    handles.push_back(handle);
+  }
+
+  std::vector<glm::uvec4> table(std::max<size_t>(materials.size(), 1) * 2, glm::uvec4(0));
+  std::map<std::pair<int, int>, int> buckets;
+  for (unsigned int i = 0; i < materials.size(); i++) {
+    Material& material = materials[i];
+    const Map& diffuse = maps[material.diffuse];
+    int specular_array = material.specular >= 0 ? maps[material.specular].array : -1;
+    table[2 * i].x = diffuse.layer;
+    table[2 * i].y = material.specular >= 0 ? maps[material.specular].layer : NO_LAYER;
+    if (use_bindless) {
+      uint64_t diffuse_handle = handles[diffuse.array];
+      uint64_t specular_handle = specular_array >= 0 ? handles[specular_array] : 0;
+      table[2 * i + 1] = glm::uvec4(
+        (uint32_t)diffuse_handle,
+        (uint32_t)(diffuse_handle >> 32),
+        (uint32_t)specular_handle,
+        (uint32_t)(specular_handle >> 32));
+      // every material is reachable from any draw
+      material.bucket = 0;
+    } else {
+      std::pair<int, int> key(diffuse.array, specular_array);
+      auto found = buckets.find(key);
+      if (found == buckets.end())
+        found = buckets.insert(std::make_pair(key, (int)buckets.size())).first;
+      material.bucket = found->second;
+    }
+  }
+
+  glGenBuffers(1, &table_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, table_vbo);
+  glBufferData(
+    GL_ARRAY_BUFFER, table.size() * sizeof(glm::uvec4), table.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glGenTextures(1, &table_texture);
+  glBindTexture(GL_TEXTURE_BUFFER, table_texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32UI, table_vbo);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+  std::cout << "Texture arrays: " << maps.size() << " maps of " << materials.size()
+            << " materials in " << arrays.size() << " arrays, "
+            << (use_bindless ? "bindless" : std::to_string(buckets.size()) + " buckets")
+            << std::endl;
+}
+
+void TextureArrays::bind_table(Shader& shader) {
+  gl_bind_texture(MATERIAL_TABLE_UNIT, GL_TEXTURE_BUFFER, table_texture);
+  shader.set_int("materials", MATERIAL_TABLE_UNIT);
+  shader.set_int("diffuse_array", DIFFUSE_ARRAY_UNIT);
+  shader.set_int("specular_array", SPECULAR_ARRAY_UNIT);
+}
+
+void TextureArrays::bind(int material) {
+  if (use_bindless) return;
+  const Material& m = materials[material];
+  gl_bind_texture(DIFFUSE_ARRAY_UNIT, GL_TEXTURE_2D_ARRAY, arrays[maps[m.diffuse].array]);
+  // without a specular map the shader does not sample, whatever is bound can stay
+  if (m.specular >= 0) {
+    gl_bind_texture(SPECULAR_ARRAY_UNIT, GL_TEXTURE_2D_ARRAY, arrays[maps[m.specular].array]);
+  }
+}
+
+void TextureArrays::record_bind(CommandBuffer& commands, int material) const {
+  if (use_bindless) return;
+  const Material& m = materials[material];
+  commands.bind_texture(DIFFUSE_ARRAY_UNIT, GL_TEXTURE_2D_ARRAY, arrays[maps[m.diffuse].array]);
+  if (m.specular >= 0) {
+    commands.bind_texture(
+      SPECULAR_ARRAY_UNIT, GL_TEXTURE_2D_ARRAY, arrays[maps[m.specular].array]);
+  }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "shader.h"
+#include "texture_cache.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// texture units of the material table and the arrays, above the ones meshes bind maps to
+#define MATERIAL_TABLE_UNIT 8
+#define DIFFUSE_ARRAY_UNIT 9
+#define SPECULAR_ARRAY_UNIT 10
+// layer of a material without a specular map, see shaders/material.glsl
+#define NO_LAYER 0xFFFFFFFFu
+
+class CommandBuffer;
+
+// Material maps packed into one GL_TEXTURE_2D_ARRAY per cooked TextureFormat, and a table of
+// the layers every material uses, read by shaders/material.glsl through the material index.
+// Draws whose materials share arrays need no texture binds in between; with
+// ARB_bindless_texture the table also holds the handles of the arrays and nothing is rebound.
+class TextureArrays {
+public:
+  // needs a current GL context
+  TextureArrays();
+  ~TextureArrays();
+
+  // register the maps of a material by the paths of their source images, specular_path may be
+  // empty. Returns the material index, -1 if a map has no valid cache. Materials with the
+  // same maps share an index. Takes effect with build().
+  int add_material(const std::string& diffuse_path, const std::string& specular_path);
+  // create the arrays, upload every layer and the material table
+  void build();
+  // whether shaders read the arrays through the handles in the table (BINDLESS variants)
+  bool bindless() const {
+    return use_bindless;
+  }
+  // materials of the same bucket are drawn from the same arrays
+  int bucket(int material) const {
+    return materials[material].bucket;
+  }
+  // bind the material table and point the samplers of shader at the table and the arrays
+  void bind_table(Shader& shader);
+  // bind the arrays of material, binds of arrays that still are bound are filtered out
+  void bind(int material);
+  // record the binds of bind(material), once build has run any thread may call this
+  void record_bind(CommandBuffer& commands, int material) const;
+  unsigned int material_count() const {
+    return materials.size();
+  }
+  unsigned int array_count() const {
+    return arrays.size();
+  }
+
+private:
+  TextureArrays(const TextureArrays&) = delete;
+  TextureArrays& operator=(const TextureArrays&) = delete;
+
+  struct Map {
+    std::string path, type;
+    TextureFormat format;
+    // set by build()
+    int array = -1;
+    unsigned int layer = 0;
+  };
+  struct Material {
+    // indices into maps, specular -1 if there is none
+    int diffuse, specular;
+    int bucket = -1;
+  };
+  // index of the map of path used as type, -1 if it has no valid cache
+  int add_map(const std::string& path, const std::string& type);
+
+  std::vector<Map> maps;
+  // by cache path, an image used as diffuse and specular map is two maps
+  std::map<std::string, int> map_index;
+  std::vector<Material> materials;
+  std::map<std::pair<int, int>, int> material_index;
+  // arrays and their bindless handles
+  std::vector<unsigned int> arrays;
+  std::vector<uint64_t> handles;
+  bool use_bindless = false;
+  // buffer texture of two uvec4 per material: the diffuse and specular layers, then the
+  // diffuse and specular array handles split into 32-bit halves
+  unsigned int table_vbo = 0, table_texture = 0;
+};
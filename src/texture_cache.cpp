@@ -0,0 +1,548 @@
+#include "texture_cache.h"
+
+#include "bc_encoder.h"
+#include "file_map.h"
+#include "job_system.h"
+#include "stb_image.h"
+
+// clang-format off
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+// clang-format on
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// work a cooking job does at least
+#define TEXELS_PER_JOB 16384
+#define ROWS_PER_JOB 16
+
+// On-disk layout, offsets in bytes from the start of the file:
+//   TextureHeader
+//   TextureLevel[num_levels]     largest level first
+//   level data, 16 byte aligned, rows tightly packed or BCn blocks
+static const char CACHE_MAGIC[4] = { 'T', 'E', 'X', 'C' };
+
+struct TextureHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t source_mtime;
+  uint64_t source_size;
+  uint32_t width, height;
+  uint32_t channels;
+  // GL compressed internal format of every level, 0 for uncompressed texels
+  uint32_t compressed_format;
+  uint32_t num_levels;
+};
+
+struct TextureLevel {
+  uint32_t width, height;
+  uint64_t offset;
+  uint64_t size;
+};
+
+static size_t memory_used = 0;
+
+static uint64_t align16(uint64_t offset) {
+  return (offset + 15) & ~(uint64_t)15;
+}
+
+static GLenum channel_format(uint32_t channels) {
+  if (channels == 1) return GL_RED;
+  if (channels == 2) return GL_RG;
+  if (channels == 3) return GL_RGB;
+  return GL_RGBA;
+}
+
+// sRGB transfer functions, tabulated since they are evaluated per texel per level
+static float srgb_to_linear_table[256];
+static unsigned char linear_to_srgb_table[4096];
+
+static void init_srgb_tables() {
+  static bool initialized = false;
+  if (initialized) return;
+  for (int i = 0; i < 256; i++) {
+    float c = i / 255.0f;
+    srgb_to_linear_table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+  }
+  for (int i = 0; i < 4096; i++) {
+    float l = i / 4095.0f;
+    float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+    linear_to_srgb_table[i] = (unsigned char)(c * 255.0f + 0.5f);
+  }
+  initialized = true;
+}
+
+// whether channel c holds gamma encoded color rather than alpha
+static bool is_color_channel(int c, int channels) {
+  if (channels == 2) return c == 0;
+  return c < 3;
+}
+
+// expand 8-bit texels to 4-channel linear floats so a texel fits one SIMD register
+static void expand_level(
+  const unsigned char* src, int width, int height, int channels, bool srgb, float* dst) {
+  long texels = (long)width * height;
+  parallel_for(0, texels, TEXELS_PER_JOB, [&](size_t first, size_t last) {
+    for (long i = first; i < (long)last; i++) {
+      for (int c = 0; c < 4; c++) {
+        float v = 0.0f;
+        if (c < channels) {
+          unsigned char b = src[i * channels + c];
+          v = (srgb && is_color_channel(c, channels)) ? srgb_to_linear_table[b] : b / 255.0f;
+        }
+        dst[i * 4 + c] = v;
+      }
+    }
+  });
+}
+
+// pack 4-channel linear floats back into the source channel layout, stride bytes per texel
+static void pack_level(
+  const float* src,
+  int width,
+  int height,
+  int channels,
+  bool srgb,
+  int stride,
+  unsigned char* dst) {
+  long texels = (long)width * height;
+  parallel_for(0, texels, TEXELS_PER_JOB, [&](size_t first, size_t last) {
+    for (long i = first; i < (long)last; i++) {
+      for (int c = 0; c < stride; c++) {
+        float v = std::fmin(std::fmax(src[i * 4 + c], 0.0f), 1.0f);
+        if (srgb && c < channels && is_color_channel(c, channels))
+          dst[i * stride + c] = linear_to_srgb_table[(int)(v * 4095.0f + 0.5f)];
+        else
+          dst[i * stride + c] = (unsigned char)(v * 255.0f + 0.5f);
+      }
+    }
+  });
+}
+
+// Block compressed format for a texture type, or 0 to keep it uncompressed.
+// BC1/BC3 need EXT_texture_compression_s3tc, RGTC (BC4/BC5) is core since GL 3.0.
+static GLenum compressed_format(const std::string& type, int channels) {
+  if (type == "texture_diffuse" && channels >= 3 && GLAD_GL_EXT_texture_compression_s3tc)
+    return channels == 4 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  if (type == "texture_specular") return GL_COMPRESSED_RED_RGTC1;
+  if (type == "texture_normal" && channels >= 2) return GL_COMPRESSED_RG_RGTC2;
+  return 0;
+}
+
+// produce one level from the 4-channel linear floats, compressed if format is non-zero
+static std::vector<unsigned char> make_level(
+  const float* src, int width, int height, int channels, bool srgb, GLenum format) {
+  if (format == 0) {
+    std::vector<unsigned char> level((size_t)width * height * channels);
+    pack_level(src, width, height, channels, srgb, channels, level.data());
+    return level;
+  }
+  std::vector<unsigned char> rgba((size_t)width * height * 4);
+  pack_level(src, width, height, channels, srgb, 4, rgba.data());
+  std::vector<unsigned char> level;
+  switch (format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+      level.resize(bc_encoded_size(width, height, 8));
+      encode_bc1(rgba.data(), width, height, level.data());
+      break;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+      level.resize(bc_encoded_size(width, height, 16));
+      encode_bc3(rgba.data(), width, height, level.data());
+      break;
+    case GL_COMPRESSED_RED_RGTC1:
+      level.resize(bc_encoded_size(width, height, 8));
+      encode_bc4(rgba.data(), width, height, level.data());
+      break;
+    case GL_COMPRESSED_RG_RGTC2:
+      level.resize(bc_encoded_size(width, height, 16));
+      encode_bc5(rgba.data(), width, height, level.data());
+      break;
+  }
+  return level;
+}
+
+// 2x2 box filter in linear space. Odd edges clamp, so non power-of-two sizes work.
+static void downsample(const float* src, int src_w, int src_h, float* dst, int dst_w, int dst_h) {
+  parallel_for(0, dst_h, ROWS_PER_JOB, [&](size_t first, size_t last) {
+    for (int y = first; y < (int)last; y++) {
+      int y0 = std::min(2 * y, src_h - 1);
+      int y1 = std::min(2 * y + 1, src_h - 1);
+      for (int x = 0; x < dst_w; x++) {
+        int x0 = std::min(2 * x, src_w - 1);
+        int x1 = std::min(2 * x + 1, src_w - 1);
+        const float* a = src + ((long)y0 * src_w + x0) * 4;
+        const float* b = src + ((long)y0 * src_w + x1) * 4;
+        const float* c = src + ((long)y1 * src_w + x0) * 4;
+        const float* d = src + ((long)y1 * src_w + x1) * 4;
+        float* out = dst + ((long)y * dst_w + x) * 4;
+#ifdef __SSE2__
+        __m128 sum = _mm_add_ps(
+          _mm_add_ps(_mm_loadu_ps(a), _mm_loadu_ps(b)),
+          _mm_add_ps(_mm_loadu_ps(c), _mm_loadu_ps(d)));
+        _mm_storeu_ps(out, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+        for (int i = 0; i < 4; i++) out[i] = (a[i] + b[i] + c[i] + d[i]) * 0.25f;
+#endif
+      }
+    }
+  });
+}
+
+// side of the square power of two an image is cooked at: the one nearest to its texel count,
+// so that textures fall into a few sizes and can share texture arrays
+static int cooked_size(int width, int height) {
+  double side = std::sqrt((double)width * height);
+  int size = 1;
+  while (size * 2 <= TEXTURE_COOK_MAX_SIZE && size * 2 <= side * std::sqrt(2.0)) size *= 2;
+  return size;
+}
+
+// resize rows of 4-channel floats from src_w to dst_w texels. Each destination texel
+// averages the source texels it covers when shrinking and interpolates when growing.
+static void resize_rows(const float* src, int src_w, float* dst, int dst_w, int rows) {
+  float scale = (float)src_w / dst_w;
+  parallel_for(0, rows, ROWS_PER_JOB, [&](size_t first, size_t last) {
+    for (int y = first; y < (int)last; y++) {
+      const float* row = src + (long)y * src_w * 4;
+      float* out = dst + (long)y * dst_w * 4;
+      for (int x = 0; x < dst_w; x++) {
+        float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        if (scale > 1.0f) {
+          float begin = x * scale, end = begin + scale;
+          for (int i = (int)begin; i < end && i < src_w; i++) {
+            float weight = std::min(end, i + 1.0f) - std::max(begin, (float)i);
+            for (int c = 0; c < 4; c++) sum[c] += row[i * 4 + c] * weight / scale;
+          }
+        } else {
+          float center = std::max((x + 0.5f) * scale - 0.5f, 0.0f);
+          int i0 = std::min((int)center, src_w - 1);
+          int i1 = std::min(i0 + 1, src_w - 1);
+          float t = center - i0;
+          for (int c = 0; c < 4; c++) sum[c] = row[i0 * 4 + c] * (1.0f - t) + row[i1 * 4 + c] * t;
+        }
+        for (int c = 0; c < 4; c++) out[x * 4 + c] = sum[c];
+      }
+    }
+  });
+}
+
+// transpose a w x h image of 4-channel floats
+static void transpose(const float* src, int w, int h, float* dst) {
+  parallel_for(0, h, ROWS_PER_JOB, [&](size_t first, size_t last) {
+    for (int y = first; y < (int)last; y++) {
+      for (int x = 0; x < w; x++) {
+        const float* texel = src + ((long)y * w + x) * 4;
+        for (int c = 0; c < 4; c++) dst[((long)x * h + y) * 4 + c] = texel[c];
+      }
+    }
+  });
+}
+
+// resize a level of 4-channel floats, rows first and then columns through a transpose
+static void resize_level(
+  const float* src, int src_w, int src_h, std::vector<float>& dst, int dst_w, int dst_h) {
+  std::vector<float> rows((size_t)dst_w * src_h * 4), columns((size_t)dst_w * src_h * 4);
+  resize_rows(src, src_w, rows.data(), dst_w, src_h);
+  transpose(rows.data(), dst_w, src_h, columns.data());
+  rows.resize((size_t)dst_w * dst_h * 4);
+  resize_rows(columns.data(), src_h, rows.data(), dst_h, dst_w);
+  dst.resize((size_t)dst_w * dst_h * 4);
+  transpose(rows.data(), dst_h, dst_w, dst.data());
+}
+
+std::string texture_cache_path(const std::string& source_path, const std::string& type) {
+  return source_path + "." + type + ".texcache";
+}
+
+bool texture_cache_cook(const std::string& source_path, const std::string& type) {
+  TextureHeader header;
+  memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  header.version = TEXTURE_CACHE_VERSION;
+  if (!file_stat(source_path, &header.source_mtime, &header.source_size)) return false;
+
+  int width, height, channels;
+  unsigned char* data = stbi_load(source_path.c_str(), &width, &height, &channels, 0);
+  if (!data) return false;
+  init_srgb_tables();
+  // only color maps are gamma encoded
+  bool srgb = type == "texture_diffuse";
+  GLenum format = compressed_format(type, channels);
+
+  // build the chain down to 1x1
+  std::vector<TextureLevel> levels;
+  std::vector<std::vector<unsigned char>> level_data;
+  std::vector<float> current((size_t)width * height * 4);
+  std::vector<float> next;
+  expand_level(data, width, height, channels, srgb, current.data());
+  int size = cooked_size(width, height);
+  bool resized = size != width || size != height;
+  if (resized) {
+    resize_level(current.data(), width, height, next, size, size);
+    current.swap(next);
+    width = height = size;
+  }
+  if (format == 0 && !resized) {
+    level_data.push_back(
+      std::vector<unsigned char>(data, data + (size_t)width * height * channels));
+  } else {
+    level_data.push_back(make_level(current.data(), width, height, channels, srgb, format));
+  }
+  stbi_image_free(data);
+
+  int w = width, h = height;
+  TextureLevel level = { (uint32_t)w, (uint32_t)h, 0, level_data.back().size() };
+  levels.push_back(level);
+  while (w > 1 || h > 1) {
+    int next_w = std::max(w / 2, 1);
+    int next_h = std::max(h / 2, 1);
+    next.resize((size_t)next_w * next_h * 4);
+    downsample(current.data(), w, h, next.data(), next_w, next_h);
+    level_data.push_back(make_level(next.data(), next_w, next_h, channels, srgb, format));
+    current.swap(next);
+    w = next_w;
+    h = next_h;
+    TextureLevel level = { (uint32_t)w, (uint32_t)h, 0, level_data.back().size() };
+    levels.push_back(level);
+  }
+
+  header.width = width;
+  header.height = height;
+  header.channels = channels;
+  header.compressed_format = format;
+  header.num_levels = levels.size();
+  uint64_t offset = sizeof(TextureHeader) + levels.size() * sizeof(TextureLevel);
+  for (TextureLevel& l : levels) {
+    l.offset = align16(offset);
+    offset = l.offset + l.size;
+  }
+
+  std::vector<FileChunk> chunks = {
+    { &header, sizeof(header), 0 },
+    { levels.data(), levels.size() * sizeof(TextureLevel), 0 },
+  };
+  for (unsigned int i = 0; i < levels.size(); i++) {
+    chunks.push_back({ level_data[i].data(), levels[i].size, levels[i].offset });
+  }
+  return write_file_atomically(texture_cache_path(source_path, type), chunks);
+}
+
+// bytes per 4x4 block of a compressed format
+static int block_bytes(GLenum compressed) {
+  return (compressed == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || compressed == GL_COMPRESSED_RED_RGTC1)
+    ? 8
+    : 16;
+}
+
+// the header of a mapped cache of source_path, null if the cache is stale, corrupt or cooked
+// to a format this context cannot load
+static const TextureHeader* check_cache(const std::string& source_path, const MappedFile& file) {
+  uint64_t source_mtime, source_size;
+  if (!file_stat(source_path, &source_mtime, &source_size)) return nullptr;
+  if (!file.is_open() || file.size() < sizeof(TextureHeader)) return nullptr;
+  const unsigned char* base = file.data();
+  const TextureHeader* header = (const TextureHeader*)base;
+  if (
+    memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+    header->version != TEXTURE_CACHE_VERSION || header->source_mtime != source_mtime ||
+    header->source_size != source_size || header->num_levels == 0 || header->channels == 0 ||
+    header->channels > 4 ||
+    sizeof(TextureHeader) + header->num_levels * sizeof(TextureLevel) > file.size()) {
+    return nullptr;
+  }
+  // S3TC blocks cooked on another machine; re-cook so we fall back to plain texels
+  GLenum compressed = header->compressed_format;
+  bool s3tc = compressed == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ||
+              compressed == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  if (s3tc && !GLAD_GL_EXT_texture_compression_s3tc) return nullptr;
+
+  const TextureLevel* levels = (const TextureLevel*)(base + sizeof(TextureHeader));
+  for (uint32_t i = 0; i < header->num_levels; i++) {
+    uint64_t expected = (uint64_t)levels[i].width * levels[i].height * header->channels;
+    if (compressed) {
+      expected = bc_encoded_size(levels[i].width, levels[i].height, block_bytes(compressed));
+    }
+    if (levels[i].offset + levels[i].size > file.size() || levels[i].size < expected) {
+      return nullptr;
+    }
+  }
+  return header;
+}
+
+// sampling state shared by single textures and texture arrays
+static void set_sampling(GLenum target, const TextureHeader* header) {
+  glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, header->num_levels - 1);
+  if (header->compressed_format == GL_COMPRESSED_RED_RGTC1) {
+    // BC4 only stores red, keep .rgb reads of grayscale maps working
+    glTexParameteri(target, GL_TEXTURE_SWIZZLE_G, GL_RED);
+    glTexParameteri(target, GL_TEXTURE_SWIZZLE_B, GL_RED);
+  }
+
+  glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+unsigned int texture_cache_load(const std::string& source_path, const std::string& type) {
+  MappedFile file(texture_cache_path(source_path, type));
+  const TextureHeader* header = check_cache(source_path, file);
+  if (!header) return 0;
+  const unsigned char* base = file.data();
+  const TextureLevel* levels = (const TextureLevel*)(base + sizeof(TextureHeader));
+  GLenum compressed = header->compressed_format;
+  GLenum format = channel_format(header->channels);
+
+  unsigned int texture_id;
+  glGenTextures(1, &texture_id);
+  glBindTexture(GL_TEXTURE_2D, texture_id);
+  // levels are tightly packed, rows of 1 and 3 channel data are not 4-byte aligned
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (uint32_t i = 0; i < header->num_levels; i++) {
+    if (compressed) {
+      glCompressedTexImage2D(
+        GL_TEXTURE_2D,
+        i,
+        compressed,
+        levels[i].width,
+        levels[i].height,
+        0,
+        levels[i].size,
+        base + levels[i].offset);
+    } else {
+      glTexImage2D(
+        GL_TEXTURE_2D,
+        i,
+        format,
+        levels[i].width,
+        levels[i].height,
+        0,
+        format,
+        GL_UNSIGNED_BYTE,
+        base + levels[i].offset);
+    }
+    memory_used += levels[i].size;
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  set_sampling(GL_TEXTURE_2D, header);
+  return texture_id;
+}
+
+bool texture_cache_format(
+  const std::string& source_path, const std::string& type, TextureFormat& format) {
+  MappedFile file(texture_cache_path(source_path, type));
+  const TextureHeader* header = check_cache(source_path, file);
+  if (!header) return false;
+  format.width = header->width;
+  format.height = header->height;
+  format.channels = header->channels;
+  format.compressed_format = header->compressed_format;
+  format.num_levels = header->num_levels;
+  return true;
+}
+
+unsigned int texture_cache_create_array(
+  const std::string& source_path, const std::string& type, unsigned int layers) {
+  MappedFile file(texture_cache_path(source_path, type));
+  const TextureHeader* header = check_cache(source_path, file);
+  if (!header) return 0;
+  const TextureLevel* levels = (const TextureLevel*)(file.data() + sizeof(TextureHeader));
+  GLenum compressed = header->compressed_format;
+  GLenum format = channel_format(header->channels);
+
+  unsigned int texture_id;
+  glGenTextures(1, &texture_id);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, texture_id);
+  // contents are left undefined, every layer is loaded with texture_cache_load_layer
+  for (uint32_t i = 0; i < header->num_levels; i++) {
+    if (compressed) {
+      size_t size = bc_encoded_size(levels[i].width, levels[i].height, block_bytes(compressed));
+      glCompressedTexImage3D(
+        GL_TEXTURE_2D_ARRAY,
+        i,
+        compressed,
+        levels[i].width,
+        levels[i].height,
+        layers,
+        0,
+        size * layers,
+        nullptr);
+    } else {
+      glTexImage3D(
+        GL_TEXTURE_2D_ARRAY,
+        i,
+        format,
+        levels[i].width,
+        levels[i].height,
+        layers,
+        0,
+        format,
+        GL_UNSIGNED_BYTE,
+        nullptr);
+    }
+  }
+  set_sampling(GL_TEXTURE_2D_ARRAY, header);
+  return texture_id;
+}
+
+bool texture_cache_load_layer(
+  const std::string& source_path, const std::string& type, unsigned int layer) {
+  MappedFile file(texture_cache_path(source_path, type));
+  const TextureHeader* header = check_cache(source_path, file);
+  if (!header) return false;
+  const unsigned char* base = file.data();
+  const TextureLevel* levels = (const TextureLevel*)(base + sizeof(TextureHeader));
+  GLenum compressed = header->compressed_format;
+  GLenum format = channel_format(header->channels);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (uint32_t i = 0; i < header->num_levels; i++) {
+    if (compressed) {
+      size_t size = bc_encoded_size(levels[i].width, levels[i].height, block_bytes(compressed));
+      glCompressedTexSubImage3D(
+        GL_TEXTURE_2D_ARRAY,
+        i,
+        0,
+        0,
+        layer,
+        levels[i].width,
+        levels[i].height,
+        1,
+        compressed,
+        size,
+        base + levels[i].offset);
+    } else {
+      glTexSubImage3D(
+        GL_TEXTURE_2D_ARRAY,
+        i,
+        0,
+        0,
+        layer,
+        levels[i].width,
+        levels[i].height,
+        1,
+        format,
+        GL_UNSIGNED_BYTE,
+        base + levels[i].offset);
+    }
+    memory_used += levels[i].size;
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  return true;
+}
+
+size_t texture_memory_used() {
+  return memory_used;
+}
+
+void texture_memory_add(size_t bytes) {
+  memory_used += bytes;
+}
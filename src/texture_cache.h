@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Cooked texture container. Source images are decoded once, their full mip chain is
+// generated offline and written to <image>.<type>.texcache next to the source. Loading maps
+// that file and uploads every level directly, skipping decode and glGenerateMipmap.
+// Diffuse, specular and normal maps are stored block compressed (BC1/BC3, BC4, BC5).
+// Images are resized to the square power of two nearest their texel count, so that few
+// distinct sizes remain and textures of the same size and format can share a texture array.
+// Bump the version whenever the file layout changes so stale caches are re-cooked.
+#define TEXTURE_CACHE_VERSION 3
+// largest side an image is cooked at
+#define TEXTURE_COOK_MAX_SIZE 2048
+
+// what a cooked texture has to share with the others in a texture array
+struct TextureFormat {
+  uint32_t width, height;
+  uint32_t channels;
+  // GL compressed internal format, 0 for uncompressed texels
+  uint32_t compressed_format;
+  uint32_t num_levels;
+  bool operator<(const TextureFormat& other) const {
+    if (width != other.width) return width < other.width;
+    if (height != other.height) return height < other.height;
+    if (channels != other.channels) return channels < other.channels;
+    if (compressed_format != other.compressed_format)
+      return compressed_format < other.compressed_format;
+    return num_levels < other.num_levels;
+  }
+};
+
+// path of the cache file of a source image used as type; the type picks the block format, so
+// an image used as two types has a cache for each
+std::string texture_cache_path(const std::string& source_path, const std::string& type);
+// decode source_path and write its mip chain to the cache. type is the Texture::type the
+// image is used as; it picks the block format and gamma-correct filtering of color maps.
+// Needs a current GL context to know whether S3TC is available.
+bool texture_cache_cook(const std::string& source_path, const std::string& type);
+// The functions below read the cache of source_path cooked as type.
+// create a GL texture from the cache. Returns 0 if the cache is missing, stale or corrupt.
+unsigned int texture_cache_load(const std::string& source_path, const std::string& type);
+// read the format of the cache, false if it is missing, stale or corrupt
+bool texture_cache_format(
+  const std::string& source_path, const std::string& type, TextureFormat& format);
+// create a GL_TEXTURE_2D_ARRAY of layers textures in the format of the cache, left bound.
+// Returns 0 if the cache is missing, stale or corrupt.
+unsigned int texture_cache_create_array(
+  const std::string& source_path, const std::string& type, unsigned int layers);
+// upload the cache to a layer of the bound texture array, which has to be of its format
+bool texture_cache_load_layer(
+  const std::string& source_path, const std::string& type, unsigned int layer);
+// bytes of texture memory uploaded so far, across all textures
+size_t texture_memory_used();
+// account for a texture uploaded outside of the cache (runtime mip generation)
+void texture_memory_add(size_t bytes);
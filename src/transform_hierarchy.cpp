@@ -0,0 +1,65 @@
+#include "transform_hierarchy.h"
+
+#include "job_system.h"
+
+#include <iostream>
+
+// below this many nodes the update is not worth spreading over threads
+#define PARALLEL_UPDATE_NODES 4096
+
+int TransformHierarchy::add_node(int parent, const glm::mat4& local) {
+  int node = parents.size();
+  if (parent >= (int)parents.size() || (parent >= 0 && subtree_ends[parent] != node)) {
+    std::cout << "Transform node " << node << " added out of order under " << parent
+              << std::endl;
+    return -1;
+  }
+  parents.push_back(parent);
+  subtree_ends.push_back(node + 1);
+  locals.push_back(local);
+  worlds.push_back(local);
+  dirty.push_back(1);
+  changed.push_back(0);
+  if (parent < 0) roots.push_back(node);
+  // grow the subtrees of every ancestor
+  for (int ancestor = parent; ancestor >= 0; ancestor = parents[ancestor])
+    subtree_ends[ancestor] = node + 1;
+  return node;
+}
+
+void TransformHierarchy::set_local(int node, const glm::mat4& local) {
+  locals[node] = local;
+  dirty[node] = 1;
+}
+
+void TransformHierarchy::update_range(int begin, int end) {
+  // parents come first, so their changed flag and world matrix are final when a child is reached
+  for (int i = begin; i < end; i++) {
+    int parent = parents[i];
+    changed[i] = dirty[i] || (parent >= 0 && changed[parent]);
+    if (!changed[i]) continue;
+    worlds[i] = parent >= 0 ? worlds[parent] * locals[i] : locals[i];
+    dirty[i] = 0;
+  }
+}
+
+void TransformHierarchy::update() {
+  if (parents.size() < PARALLEL_UPDATE_NODES) {
+    update_range(0, parents.size());
+    return;
+  }
+  // root subtrees share no nodes
+  parallel_for(0, roots.size(), 16, [this](size_t first, size_t last) {
+    for (size_t i = first; i < last; i++) update_range(roots[i], subtree_ends[roots[i]]);
+  });
+}
+
+void TransformHierarchy::clear() {
+  parents.clear();
+  subtree_ends.clear();
+  roots.clear();
+  locals.clear();
+  worlds.clear();
+  dirty.clear();
+  changed.clear();
+}
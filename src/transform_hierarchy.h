@@ -0,0 +1,44 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Flat transform hierarchy. Nodes are stored parent-before-child and added depth first, so
+// every subtree is a contiguous range and one forward pass computes all world matrices.
+// Only nodes whose local transform changed, and their descendants, are recomputed.
+class TransformHierarchy {
+public:
+  // append a node under parent (-1 for a root) and return its index. The parent's subtree
+  // must end at the last node added, or -1 is returned.
+  int add_node(int parent, const glm::mat4& local);
+  // change a local transform, world matrices follow on the next update
+  void set_local(int node, const glm::mat4& local);
+  const glm::mat4& local(int node) const {
+    return locals[node];
+  }
+  // world matrix as of the last update
+  const glm::mat4& world(int node) const {
+    return worlds[node];
+  }
+  int parent(int node) const {
+    return parents[node];
+  }
+  // recompute the world matrices of dirty nodes and their descendants. Independent root
+  // subtrees are updated in parallel for large hierarchies.
+  void update();
+  void clear();
+  size_t size() const {
+    return parents.size();
+  }
+
+private:
+  std::vector<int> parents;
+  // one past the last node of the subtree rooted at each node
+  std::vector<int> subtree_ends;
+  std::vector<int> roots;
+  std::vector<glm::mat4> locals, worlds;
+  std::vector<unsigned char> dirty;
+  // nodes whose world matrix changed during the current update
+  std::vector<unsigned char> changed;
+  void update_range(int begin, int end);
+};
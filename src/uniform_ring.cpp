@@ -0,0 +1,174 @@
+#include "uniform_ring.h"
+
+// clang-format off
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+// clang-format on
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// nanoseconds to wait for a fence before checking again
+#define FENCE_WAIT_TIMEOUT 1000000
+
+static unsigned int ubo = 0;
+// persistent mapping of the whole buffer, null when falling back to glBufferSubData
+static unsigned char* mapped = nullptr;
+static bool persistent = false;
+static size_t segment_size = 0;
+static size_t alignment = 256;
+// segment being written, and the next offset in it
+static unsigned int segment = 0;
+static size_t offset = 0;
+// fence of the last frame that wrote each segment, null if there is none to wait for
+static GLsync fences[UNIFORM_RING_FRAMES] = {};
+// buffers replaced by a larger one during the frame. Deleting a buffer unbinds it from every
+// binding point, so they live until the next frame binds everything anew.
+static std::vector<unsigned int> retired;
+
+// statistics since the last report
+static size_t pushed_bytes = 0;
+static unsigned int num_pushes = 0, num_stalls = 0, num_grows = 0;
+static double push_time = 0.0, stall_time = 0.0;
+
+// bytes of the whole buffer. Orphaning needs no more than one segment.
+static size_t buffer_size() {
+  return segment_size * (persistent ? UNIFORM_RING_FRAMES : 1);
+}
+
+static void delete_retired() {
+  if (!retired.empty()) glDeleteBuffers(retired.size(), retired.data());
+  retired.clear();
+}
+
+// (re)create the buffer with segments of size bytes, retiring the previous one
+static void allocate(size_t size) {
+  if (ubo) {
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    if (mapped) glUnmapBuffer(GL_UNIFORM_BUFFER);
+    mapped = nullptr;
+    retired.push_back(ubo);
+  }
+  // a new buffer has no frame in flight
+  for (GLsync& fence : fences) {
+    if (fence) glDeleteSync(fence);
+    fence = nullptr;
+  }
+  segment_size = size;
+  glGenBuffers(1, &ubo);
+  glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+  if (persistent) {
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_UNIFORM_BUFFER, buffer_size(), nullptr, flags);
+    mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, buffer_size(), flags);
+  } else {
+    glBufferData(GL_UNIFORM_BUFFER, buffer_size(), nullptr, GL_STREAM_DRAW);
+  }
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void uniform_ring_init() {
+  GLint value = 0;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &value);
+  if (value > 0) alignment = value;
+  persistent = GLAD_GL_ARB_buffer_storage;
+  allocate(UNIFORM_RING_SEGMENT_SIZE);
+  segment = 0;
+  offset = 0;
+}
+
+void uniform_ring_destroy() {
+  for (GLsync& fence : fences) {
+    if (fence) glDeleteSync(fence);
+    fence = nullptr;
+  }
+  delete_retired();
+  if (!ubo) return;
+  glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+  if (mapped) glUnmapBuffer(GL_UNIFORM_BUFFER);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  glDeleteBuffers(1, &ubo);
+  ubo = 0;
+  mapped = nullptr;
+}
+
+void uniform_ring_begin_frame() {
+  delete_retired();
+  offset = 0;
+  if (!persistent) {
+    // respecifying orphans the storage of the frames still in flight
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, buffer_size(), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    return;
+  }
+  segment = (segment + 1) % UNIFORM_RING_FRAMES;
+  GLsync& fence = fences[segment];
+  if (!fence) return;
+  // normally the GPU finished this segment UNIFORM_RING_FRAMES - 1 frames ago
+  GLenum status = glClientWaitSync(fence, 0, 0);
+  if (status == GL_TIMEOUT_EXPIRED) {
+    double start = glfwGetTime();
+    do {
+      status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_WAIT_TIMEOUT);
+    } while (status == GL_TIMEOUT_EXPIRED);
+    num_stalls++;
+    stall_time += glfwGetTime() - start;
+  }
+  glDeleteSync(fence);
+  fence = nullptr;
+}
+
+void uniform_ring_end_frame() {
+  if (persistent) fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void uniform_ring_push(unsigned int binding, const void* data, size_t size) {
+  double start = glfwGetTime();
+  size_t aligned = (offset + alignment - 1) / alignment * alignment;
+  if (aligned + size > segment_size) {
+    // ranges bound earlier in the frame keep pointing into the retired buffer
+    allocate(std::max(segment_size * 2, size + alignment));
+    num_grows++;
+    aligned = 0;
+  }
+  size_t position = segment * segment_size + aligned;
+  if (persistent) {
+    memcpy(mapped + position, data, size);
+  } else {
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, position, size, data);
+  }
+  glBindBufferRange(GL_UNIFORM_BUFFER, binding, ubo, position, size);
+  offset = aligned + size;
+  pushed_bytes += size;
+  num_pushes++;
+  push_time += glfwGetTime() - start;
+}
+
+void uniform_ring_bind_blocks(unsigned int program) {
+  const char* names[3] = { "FrameBlock", "ObjectBlock", "LightingBlock" };
+  const unsigned int bindings[3] = { FRAME_BLOCK_BINDING,
+                                     OBJECT_BLOCK_BINDING,
+                                     LIGHTING_BLOCK_BINDING };
+  for (int i = 0; i < 3; i++) {
+    unsigned int index = glGetUniformBlockIndex(program, names[i]);
+    if (index != GL_INVALID_INDEX) glUniformBlockBinding(program, index, bindings[i]);
+  }
+}
+
+void uniform_ring_report(unsigned int frames) {
+  if (frames == 0) return;
+  std::cout << "Uniform ring (" << (persistent ? "persistent" : "orphaned") << ", "
+            << buffer_size() / 1024 << " KB): "
+            << pushed_bytes / 1024.0 / frames << " KB and " << (double)num_pushes / frames
+            << " binds per frame, " << push_time * 1000.0 / frames << " ms CPU per frame, "
+            << num_stalls << " stalls (" << stall_time * 1000.0 << " ms)";
+  if (num_grows > 0) std::cout << ", grown " << num_grows << " times";
+  std::cout << std::endl;
+  pushed_bytes = 0;
+  num_pushes = num_stalls = num_grows = 0;
+  push_time = stall_time = 0.0;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+// Per-frame shader constants go through one uniform buffer split into UNIFORM_RING_FRAMES
+// segments, a frame writing one segment while the GPU may still read the previous ones. With
+// ARB_buffer_storage the buffer stays persistently mapped and each segment is fenced when its
+// frame is submitted, so writes are plain copies. Without it every push is a glBufferSubData
+// and the buffer is orphaned once per frame. Pushed constants are bound to the uniform blocks
+// of shaders/uniform_blocks.glsl with glBindBufferRange.
+#define UNIFORM_RING_FRAMES 3
+// bytes of a segment to start with, doubled whenever a frame runs out
+#define UNIFORM_RING_SEGMENT_SIZE (256 * 1024)
+
+// binding points of the uniform blocks
+#define FRAME_BLOCK_BINDING 0
+#define OBJECT_BLOCK_BINDING 1
+#define LIGHTING_BLOCK_BINDING 2
+
+// std140 layouts of the blocks, keep in sync with shaders/uniform_blocks.glsl
+struct FrameConstants {
+  glm::mat4 projection;
+  glm::mat4 view;
+  // xyz, w unused
+  glm::vec4 view_pos;
+};
+
+struct ObjectConstants {
+  glm::mat4 model;
+  // dequantization of compact vertices in xyz, w unused
+  glm::vec4 pos_offset;
+  glm::vec4 pos_scale;
+  int32_t oct_normals;
+  int32_t instanced;
+  int32_t material_index;
+  int32_t padding;
+};
+
+struct LightingConstants {
+  int32_t num_lights;
+  float light_linear;
+  float light_quadratic;
+  float light_alpha;
+};
+
+// create the ring, needs a current GL context
+void uniform_ring_init();
+// release the ring before the context goes away
+void uniform_ring_destroy();
+// start writing the next segment, waiting for the GPU if it still reads it
+void uniform_ring_begin_frame();
+// fence the segment of the frame just submitted
+void uniform_ring_end_frame();
+// copy size bytes of constants to the current segment and bind them to a block binding point
+void uniform_ring_push(unsigned int binding, const void* data, size_t size);
+template <typename T> void uniform_ring_push(unsigned int binding, const T& constants) {
+  uniform_ring_push(binding, &constants, sizeof(T));
+}
+// point the blocks of a linked program at their binding points
+void uniform_ring_bind_blocks(unsigned int program);
+// print the bytes, binds and CPU time per frame and the waits for the GPU over the last frames
+// frames, and start counting again
+void uniform_ring_report(unsigned int frames);
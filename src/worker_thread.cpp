@@ -0,0 +1,43 @@
+#include "worker_thread.h"
+
+WorkerThread::WorkerThread() {
+  thread = std::thread(&WorkerThread::main, this);
+}
+
+WorkerThread::~WorkerThread() {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return !busy; });
+    quit = true;
+  }
+  changed.notify_all();
+  thread.join();
+}
+
+void WorkerThread::run(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->task = std::move(task);
+    busy = true;
+  }
+  changed.notify_all();
+}
+
+void WorkerThread::wait() {
+  std::unique_lock<std::mutex> lock(mutex);
+  changed.wait(lock, [this] { return !busy; });
+}
+
+void WorkerThread::main() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    changed.wait(lock, [this] { return busy || quit; });
+    if (quit) return;
+    // the owner does not touch task until busy is cleared
+    lock.unlock();
+    task();
+    lock.lock();
+    busy = false;
+    changed.notify_all();
+  }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// A thread running one task at a time on behalf of its owner, used to overlap CPU work with
+// GL submission on the thread owning the context.
+class WorkerThread {
+public:
+  WorkerThread();
+  // waits for the running task
+  ~WorkerThread();
+  // start task on the worker. The previous task must have been waited for.
+  void run(std::function<void()> task);
+  // block until the task passed to run has finished
+  void wait();
+
+private:
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::function<void()> task;
+  bool busy = false;
+  bool quit = false;
+  void main();
+};